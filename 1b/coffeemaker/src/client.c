@@ -4,7 +4,10 @@
  * @date 24.03.2017
  *
  * @brief This Program sends a coffee request (size, flavour) to the server(coffee machine)
-    and prints the answer of the server on stdout.
+    and prints the answer of the server on stdout. Several requests are sent one
+    per connection, or with -b in frames of up to BATCH orders over one connection.
+    Flavours beyond the first 32 of the catalog are always sent as wide orders
+    in frames, see coffee.h.
  **/
 #include <stdio.h>
 #include <stdlib.h>
@@ -20,31 +23,47 @@
 #include <assert.h>
 #include <getopt.h>
 #include <stdbool.h>
-#include <strings.h>
 
-#define BUFFER_BYTES (2)
-#define RESPONSE_WIDTH (1)
+#include "tcpconn.h"
+#include "sockio.h"
+#include "coffee.h"
+#include "flavours.h"
+
+#define USAGE "[-h HOSTNAME] [-p PORT] [-b BATCH] SIZE FLAVOUR [SIZE FLAVOUR ...]"
+
+/* Frames sent before the first of them is answered; their orders and answers
+   fit into the socket buffers, so neither side blocks the other */
+#define PIPELINE_FRAMES (8)
 
 static const char *progname; /* < Name of the program */
 
 static int connfd = -1; /* < File descriptor for connection socket */
 
+static struct addrinfo *server_addrs = NULL; /* < Addresses of the server, resolved once for all connections */
+
+static struct sockio conn; /* < Buffered I/O on connfd */
+static uint8_t conn_in[SOCKIO_BUFFER], conn_out[SOCKIO_BUFFER];
+
 struct coffee{ /* < Struct storing information about the coffee request*/
     long int size;
-    char *flavour;
+    const char *flavour;
+    int flavourID;
 };
 
 struct opts{ /* < Struct storing information how to connect to the server*/
     char *host;
     char *port;
+    int batch; /* < maximum number of orders per frame, 1 for the original protocol */
 };
 
 /**
  * @brief           Connect to the game server using given hostname and port.
+                    The host is resolved by the first call only.
  * @param host      the ip address or hostname of the server
  * @param port      the port the server is listening on
  * @return status   the status code of the connect() method
- * @details global variables: connfd: File descriptor for connection socket
+ * @details global variables: connfd: File descriptor for connection socket,
+                    server_addrs
  */
 static int connect_to_server(char *host, char *port);
 
@@ -60,59 +79,101 @@ static void bail_out(int exitcode, const char *fmt, ...);
  * @brief Parse command line options and/or sets default values
  * @param argc The argument counter
  * @param argv The argument vector
- * @param options struct where parsed arguments host and port are stored
- * @param cof struct where parsed arguments size and flavour are stored
+ * @param options struct where parsed arguments host, port and batch are stored
  */
-static void parse_args(int argc, char **argv, struct opts *options, struct coffee *cof);
+static void parse_args(int argc, char **argv, struct opts *options);
 
 /**
- * @brief Sends and receives bytes to and from the server. Prints server answer on stdout
- * @param block contains coffee info flavour and size
+ * @brief Looks up the flavour of a coffee request and stores its ID.
+ * @param cof the coffee request
  * @details global variable: progname
  */
-static void communicate(uint16_t block);
+static void lookup_flavour(struct coffee *cof);
 
 /**
-* @brief calculates the parity bit of buffer sent to the server.
-* @param block contains flavour and size 
-* @return the partity bit
-*/
-static uint8_t calculate_parity16(uint16_t block);
+ * @brief Stores an order with its parity bit in a buffer.
+ * @param buffer where the order is stored
+ * @param cof the coffee request
+ * @param wide true for a wide order
+ * @return number of bytes stored
+ */
+static size_t put_order(uint8_t *buffer, const struct coffee *cof, bool wide);
 
 /**
-* @brief calculates the parity bit of buffer recieved from the server.
-* @param response contains time until coffee is produced or error information
-* @return the partity bit
-*/
-static uint8_t calculate_parity8(uint8_t response);
+ * @brief Sends one order per connection and prints the server answers on stdout
+ * @param options host and port of the server
+ * @param coffees the orders
+ * @param count number of orders
+ * @details global variable: connfd
+ */
+static void communicate(struct opts *options, const struct coffee *coffees, int count);
+
+/**
+ * @brief Asks the server to use the batch protocol. Terminates the program if
+ *        the server does not support it: an old server takes the hello for an
+ *        order with a parity error and exits, so there is no server left to
+ *        send the orders one per connection to.
+ * @param batch requested number of orders per frame, lowered to the server's maximum
+ * @param wide true to ask for wide orders
+ * @details global variable: connfd
+ */
+static void negotiate_batch(int *batch, bool wide);
+
+/**
+ * @brief Sends the orders in frames over the negotiated connection and prints
+ *        the server answers on stdout
+ * @param coffees the orders
+ * @param count number of orders
+ * @param batch maximum number of orders per frame
+ * @param wide true if wide orders were negotiated
+ * @details global variable: connfd
+ */
+static void communicate_batched(const struct coffee *coffees, int count, int batch, bool wide);
+
+/**
+ * @brief Checks the parity of an answer and prints it
+ * @param answer the answer of the server
+ * @details global variable: progname
+ */
+static void print_answer(uint8_t answer);
+
+/**
+ * @brief Queues a message for the server, terminates on errors
+ * @param buffer the message
+ * @param n its size
+ */
+static void write_to_server(const uint8_t *buffer, size_t n);
 
 /**
- * @brief Writes message to server
- * @param fd Socket to write from
- * @param buffer Buffer where wirte data is stored
- * @param n Size to write
- * @return number of bytes written
+ * @brief Sends all queued messages, terminates on errors
  */
-static int write_to_server(int fd, uint8_t *buffer, size_t n);
+static void flush_to_server(void);
 
 /**
- * @brief Read message from socket (deals with partial reads)
- * @param fd socket to read from
+ * @brief Reads n bytes from the server
  * @param buffer buffer where read data is stored
  * @param n size to read
- * @return -1 on failure number of bytes read on success
+ * @return -1 on failure, 0 on success
+ */
+static int read_from_server(uint8_t *buffer, size_t n);
+
+/**
+ * @brief closes the connection to the server
+ * @details global variable: connfd
  */
-static int read_from_server(int fd, uint8_t *buffer, size_t n);
+static void close_connection(void);
 
 /**
- * @brief free allocated resources (closes socket)
+ * @brief free allocated resources (closes socket, frees the server addresses)
+ * @details global variables: connfd, server_addrs
  */
 static void free_resources(void);
 
 /**
 *Program entry point
-*@brief calls the functions parse_args, connect_to_server and communicate. Checks if flavour exists.
-        saves flavour and size into the uint16_t block.
+*@brief calls the functions parse_args and lookup_flavour for every SIZE FLAVOUR pair, then
+        sends the orders batched if requested or if a flavour needs wide
+        orders, else with communicate.
 *@param argc The argument counter
 *@param argv The argument vector
 *@details global variables: progname
@@ -120,67 +181,137 @@ static void free_resources(void);
 */
 int main(int argc, char *argv[]){
     struct opts options;
-    struct coffee cof;
-    parse_args(argc, argv, &options, &cof);
-    if (argc < 3){
-      bail_out(EXIT_FAILURE,"[-h HOSTNAME] [-p PORT] SIZE FLAVOUR");
+    parse_args(argc, argv, &options);
+    int count = (argc - optind) / 2;
+    if (count < 1 || (argc - optind) % 2 != 0){
+      bail_out(EXIT_FAILURE, USAGE);
     }
-    int flavourID = 255, size;
-    static char *arr[] = {"Decaffeinato", "Kazaar", "Volluto", "Ciocattino",
-     "Vanilio", "Linizio Lungo", "Vivalto Lungo","Fortissio Lungo",
-     "Bukeela ka Ethiopia Lungo","Decaffeinato Lungo", "Cosi", "Capriccio", "Livanto",
-     "Roma", "Arpeggio", "Ristretto", "Dharkan", "Dulsao do Brasil", "Rosabaya de Colombia",
-     "Indrya from India", "Decaffeinato Intenso", "Caramelito", "Cauca", "Santander", "Cubania", 
-     "Selection Vintage", "Sachertorte", "Linzer Torte", "Apfelstrudel", "SULUJA ti South Sudan", 
-     "CAFECITO de Cuba", "Cafezinho do Brazil"};
-    for(uint8_t i=0; i<sizeof(arr)/sizeof(char*); ++i){
-        if(strcasecmp(arr[i], cof.flavour)==0){
-            size = cof.size;
-            flavourID = i;
-            break;
-        }
+    struct coffee *coffees = malloc(count * sizeof(*coffees));
+    if (coffees == NULL){
+      bail_out(EXIT_FAILURE, "malloc");
     }
-    if(flavourID==255){
-        bail_out(EXIT_FAILURE, "Flavour '%s' does not exist", cof.flavour);
+    bool wide = false;
+    for(int i = 0; i < count; ++i){
+        char *endptr;
+        coffees[i].size = strtol(argv[optind + 2 * i], &endptr, 10);
+        coffees[i].flavour = argv[optind + 2 * i + 1];
+        lookup_flavour(&coffees[i]);
+        if (coffees[i].flavourID >= 1 << FLAVOUR_BITS){
+            wide = true;
+        }
     }
-    cof.flavour = arr[flavourID];
-    uint16_t block = flavourID;
-    block += (size << 5);
-    (void)printf("[%s] requestig a %ld ml cup of coffee of flavour '%s' (id=%d).\n", progname, cof.size, cof.flavour, flavourID);
-    if (connect_to_server(options.host, options.port) < 0){
-        bail_out(EXIT_FAILURE, "connection");
+    if (wide || (options.batch > 1 && count > 1)){
+        if (connect_to_server(options.host, options.port) < 0){
+            bail_out(EXIT_FAILURE, "connection");
+        }
+        negotiate_batch(&options.batch, wide);
+        communicate_batched(coffees, count, options.batch, wide);
+    } else {
+        communicate(&options, coffees, count);
     }
-    communicate(block);
+    free_resources();
+    free(coffees);
     return EXIT_SUCCESS;
 }
 
-static void communicate(uint16_t block) {
-    uint8_t read_buffer;
-    uint8_t parity = calculate_parity16(block);
-    block |= (parity << 15);
-    uint8_t buff[2];
-    buff[0] = block;
-    buff[1] = block>>8;
-    if(write_to_server(connfd, buff, BUFFER_BYTES) < 0) {
-      bail_out(EXIT_FAILURE, "Error writing to server");
+static void lookup_flavour(struct coffee *cof){
+    cof->flavourID = flavour_lookup(cof->flavour);
+    if(cof->flavourID < 0){
+        bail_out(EXIT_FAILURE, "Flavour '%s' does not exist", cof->flavour);
     }
-    if(read_from_server(connfd, buff, RESPONSE_WIDTH) < 0) {
-	    bail_out(EXIT_FAILURE, "Error reading from server");
+    cof->flavour = flavour_names[cof->flavourID];
+    (void)printf("[%s] requestig a %ld ml cup of coffee of flavour '%s' (id=%d).\n", progname, cof->size, cof->flavour, cof->flavourID);
+}
+
+static size_t put_order(uint8_t *buffer, const struct coffee *cof, bool wide){
+    if(wide){
+        codec_put(buffer, coffee_encode_wide_order(cof->size, cof->flavourID), WIDE_ORDER_BYTES);
+        return WIDE_ORDER_BYTES;
     }
-    read_buffer = buff[0]<<1;
-    read_buffer = read_buffer>>1;
-    uint8_t temp = read_buffer;
-    parity = calculate_parity8(temp);
-    if(parity != buff[0]>>7){
+    codec_put(buffer, coffee_encode_order(cof->size, cof->flavourID), ORDER_BYTES);
+    return ORDER_BYTES;
+}
+
+static void communicate(struct opts *options, const struct coffee *coffees, int count) {
+    for(int i = 0; i < count; ++i){
+        uint8_t buff[ORDER_BYTES];
+        if (connect_to_server(options->host, options->port) < 0){
+            bail_out(EXIT_FAILURE, "connection");
+        }
+        (void)put_order(buff, &coffees[i], false);
+        write_to_server(buff, ORDER_BYTES);
+        flush_to_server();
+        if(read_from_server(buff, ANSWER_BYTES) < 0) {
+            bail_out(EXIT_FAILURE, "Error reading from server");
+        }
+        print_answer(buff[0]);
+        close_connection();
+    }
+}
+
+static void negotiate_batch(int *batch, bool wide) {
+    uint8_t buff[ORDER_BYTES];
+
+    codec_put(buff, wide ? PROTO_HELLO_WIDE : PROTO_HELLO, ORDER_BYTES);
+    write_to_server(buff, ORDER_BYTES);
+    flush_to_server();
+    if(read_from_server(buff, 2) < 0 || buff[0] != PROTO_ACK) {
+        errno = 0;
+        if (wide){
+            bail_out(EXIT_FAILURE, "Server does not support wide orders");
+        }
+        bail_out(EXIT_FAILURE, "Server does not support batches, run without -b");
+    }
+    if(buff[1] < *batch) {
+        *batch = buff[1];
+    }
+}
+
+static void communicate_batched(const struct coffee *coffees, int count, int batch, bool wide) {
+    uint8_t frame[1 + MAX_BATCH * WIDE_ORDER_BYTES];
+
+    /* the server answers the frames in order, so PIPELINE_FRAMES of them go
+       out with one write before their answers are read */
+    for(int start = 0; start < count; start += PIPELINE_FRAMES * batch){
+        int end = count - start < PIPELINE_FRAMES * batch ? count : start + PIPELINE_FRAMES * batch;
+
+        for(int first = start; first < end; first += batch){
+            int n = end - first < batch ? end - first : batch;
+            size_t len = 1;
+            frame[0] = n;
+            for(int i = 0; i < n; ++i){
+                len += put_order(frame + len, &coffees[first + i], wide);
+            }
+            write_to_server(frame, len);
+        }
+        flush_to_server();
+        for(int first = start; first < end; first += batch){
+            int n = end - first < batch ? end - first : batch;
+            if(read_from_server(frame, n * ANSWER_BYTES) < 0) {
+                bail_out(EXIT_FAILURE, "Error reading from server");
+            }
+            for(int i = 0; i < n; ++i){
+                print_answer(frame[i]);
+            }
+        }
+    }
+}
+
+static void print_answer(uint8_t answer) {
+    int read_buffer = coffee_decode_answer(answer);
+    if(read_buffer < 0){
         bail_out(EXIT_FAILURE, "parity check failed");
     }
-    if(read_buffer == 125){
+    if(read_buffer == ANSWER_BUSY){
+        (void)fprintf(stderr, "[%s] Error %d - busy\n", progname, read_buffer>>5);
+    }
+    else if(read_buffer == ANSWER_FULL_BIN){
         (void)fprintf(stderr, "[%s] Error %d - full_bin\n", progname, read_buffer>>5);
     }
-    else if(read_buffer == 126){
+    else if(read_buffer == ANSWER_NO_WATER){
         (void)fprintf(stderr, "[%s] Error %d - no_water\n", progname, read_buffer>>5);
     }
-    else if(read_buffer == 127){
+    else if(read_buffer == ANSWER_NO_WATER_AND_FULL_BIN){
         (void)fprintf(stderr, "[%s] Error %d - no_water_and_full_bin\n", progname, read_buffer>>5);
     }
     else{
@@ -188,53 +319,18 @@ static void communicate(uint16_t block) {
     }
 }
 
-static uint8_t calculate_parity8(uint8_t block){
-  int8_t parity_calc = 0;
-  for (int i = 0; i < 7; ++i) {
-    parity_calc ^= block;
-    block >>= 0x1;
-  }
-  return parity_calc &= 0x1;
-}
-
-static uint8_t calculate_parity16(uint16_t block){
-  int8_t parity_calc = 0;
-  for (int i = 0; i < 15; ++i) {
-    parity_calc ^= block;
-    block >>= 0x1;
-  }
-  return parity_calc &= 0x1;
-}
-
 static int connect_to_server(char *host, char *port) {
 
-    struct addrinfo hints;
-    struct addrinfo *result;
-
-    int addr, conn;
-    bzero(&hints, sizeof(hints));
-
-    hints.ai_family = AF_UNSPEC;          //IPv4
-    hints.ai_socktype = SOCK_STREAM;    //TCP
-    addr = getaddrinfo(host, port, &hints, &result);
-
-    if(addr!=0){
-      bail_out(EXIT_FAILURE, "getaddrinfo: %s\n", gai_strerror(addr));
+    if(server_addrs == NULL && (server_addrs = tcpconn_resolve(host, port)) == NULL){
+      errno = 0;
+      bail_out(EXIT_FAILURE, "getaddrinfo: %s", tcpconn_error());
     }
-    //create socket file descriptor
-    connfd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+    connfd = tcpconn_open_addrs(server_addrs, TCPCONN_TIMEOUT);
     if(connfd == -1){
-      bail_out(EXIT_FAILURE, "socket()");
-    }
-
-    /* Connect the socket to the address */
-    conn = connect(connfd, result->ai_addr, result->ai_addrlen);
-    if(conn == -1){
       bail_out(EXIT_FAILURE, "connect");
     }
-    freeaddrinfo(result);
-
-    return conn;
+    sockio_init(&conn, connfd, conn_in, sizeof(conn_in), conn_out, sizeof(conn_out));
+    return 0;
 }
 
 static void bail_out(int exitcode, const char *fmt, ...) {
@@ -256,14 +352,15 @@ static void bail_out(int exitcode, const char *fmt, ...) {
     exit(exitcode);
 }
 
-static void parse_args(int argc, char **argv, struct opts *options, struct coffee *cof)
+static void parse_args(int argc, char **argv, struct opts *options)
 {
     char *endptr;
     progname = argv[0];
     options->host = "localhost";
     options->port = "1821";
+    options->batch = 1;
     int argument;
-    while((argument = getopt(argc, argv, "h:p:"))!=-1){
+    while((argument = getopt(argc, argv, "h:p:b:"))!=-1){
         switch(argument){
             case 'h': 
                 options->host = optarg;
@@ -271,61 +368,50 @@ static void parse_args(int argc, char **argv, struct opts *options, struct coffe
             case 'p': 
                 options->port = optarg;
                 break;
+            case 'b':
+                options->batch = strtol(optarg, &endptr, 10);
+                if (*endptr != '\0' || options->batch < 1 || options->batch > MAX_BATCH) {
+                    bail_out(EXIT_FAILURE, "BATCH must be between 1 and %d", MAX_BATCH);
+                }
+                break;
             case '?': 
-                bail_out(EXIT_FAILURE, "[-h HOSTNAME] [-p PORT] SIZE FLAVOUR");
+                bail_out(EXIT_FAILURE, USAGE);
             default: 
                 assert(0); //unreachable
         }
     }
-    cof->size = strtol(argv[argc-2], &endptr, 10);
-    cof->flavour = argv[argc-1];
 }
 
-static int write_to_server(int fd, uint8_t *buffer, size_t n){
-
-	size_t bytes_sent = 0;
-
-	do {
-		ssize_t r;
-		r = write(fd, buffer + bytes_sent, n - bytes_sent);
-		if (r <= 0) {
-			bail_out(EXIT_FAILURE, "write");
-		}
-		bytes_sent += r;
-	} while (bytes_sent < n);
-
-	if (bytes_sent < n) {
-		bail_out(EXIT_FAILURE, "write");
-	}
+static void write_to_server(const uint8_t *buffer, size_t n){
+    if(sockio_write(&conn, buffer, n) < 0){
+        bail_out(EXIT_FAILURE, "write");
+    }
+}
 
-	return bytes_sent;
+static void flush_to_server(void){
+    if(sockio_flush(&conn) < 0){
+        bail_out(EXIT_FAILURE, "write");
+    }
 }
 
-static int read_from_server(int fd, uint8_t *buffer, size_t n)
+static int read_from_server(uint8_t *buffer, size_t n)
 {
+    return sockio_read(&conn, buffer, n) < 0 ? -1 : 0;
+}
 
-	size_t bytes_read = 0;
-
-	do {
-		ssize_t r;
-		r = read(fd, buffer + bytes_read, n - bytes_read);
-		if (r <= 0) {
-			return -1;
-		}
-		bytes_read += r;
-	} while (bytes_read < n);
-
-	if (bytes_read < n) {
-		return -1;
-	}
-
-	return bytes_read;
+static void close_connection(void) {
+    if (connfd >= 0) {
+        (void) close(connfd);
+        connfd = -1;
+    }
 }
 
 static void free_resources(void) {
 
     /* clean up resources */
-    if (connfd >= 0) {
-        (void) close(connfd);
+    close_connection();
+    if (server_addrs != NULL) {
+        freeaddrinfo(server_addrs);
+        server_addrs = NULL;
     }
 }
\ No newline at end of file
@@ -0,0 +1,192 @@
+/**
+ * @file codecbench.c
+ * @date 2017-05-12
+ *
+ * @brief Checks and times the order and answer codec of coffee.h against the
+ *        bit-by-bit parity loops and shifts the client and server used before.
+ *        Every possible order and answer is decoded by both and every valid
+ *        order and answer is encoded and decoded again; the program fails on
+ *        the first difference. Then it reports ns per order for both variants.
+ *
+ *        usage: codecbench [ROUNDS]
+ **/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "coffee.h"
+
+/* Default number of passes over all 2^16 orders when timing */
+#define ROUNDS (200)
+
+/* @brief Sink of the timed loops, keeps the compiler from dropping them */
+static volatile unsigned long sink;
+
+/**
+ * @brief The former parity of 15 bits, one bit after the other.
+ */
+static uint8_t reference_parity16(uint16_t info);
+
+/**
+ * @brief The former parity of 7 bits, one bit after the other.
+ */
+static uint8_t reference_parity8(uint8_t info);
+
+/**
+ * @brief Decodes an order like the former server.
+ * @param order the order including its parity bit
+ * @param size where the ml of coffee are stored
+ * @param flavourID where the flavour is stored
+ * @return 0 on success, -1 on a parity error
+ */
+static int reference_decode_order(uint16_t order, uint16_t *size, uint8_t *flavourID);
+
+/**
+ * @brief Checks codec and reference against each other on all inputs.
+ * @return the number of differences
+ */
+static long check(void);
+
+/**
+ * @brief Times decoding every order and encoding its answer.
+ * @param rounds passes over all orders
+ * @param codec true for coffee.h, false for the reference
+ * @return ns per order
+ */
+static double time_decode(int rounds, int codec);
+
+/**
+ * @brief Program entry point
+ * @param argc The argument counter
+ * @param argv The argument vector
+ * @return EXIT_SUCCESS if codec and reference agree
+ */
+int main(int argc, char *argv[])
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : ROUNDS;
+    long errors;
+
+    if (rounds < 1) {
+        (void) fprintf(stderr, "usage: %s [ROUNDS]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if ((errors = check()) != 0) {
+        (void) printf("codec and reference differ on %ld inputs\n", errors);
+        return EXIT_FAILURE;
+    }
+    (void) printf("codec and reference agree on all orders and answers\n");
+    (void) printf("reference %6.2f ns per order\n", time_decode(rounds, 0));
+    (void) printf("codec     %6.2f ns per order\n", time_decode(rounds, 1));
+    return EXIT_SUCCESS;
+}
+
+static long check(void)
+{
+    long errors = 0;
+
+    for (uint32_t wire = 0; wire <= UINT16_MAX; wire++) {
+        uint16_t size, ref_size;
+        uint8_t flavourID, ref_flavourID;
+        int res = coffee_decode_order(wire, &size, &flavourID);
+        int ref = reference_decode_order(wire, &ref_size, &ref_flavourID);
+
+        if (res != ref || (res == 0 && (size != ref_size || flavourID != ref_flavourID))) {
+            (void) printf("order 0x%04x: codec %d %u %u, reference %d %u %u\n",
+                (unsigned int) wire, res, size, flavourID, ref, ref_size, ref_flavourID);
+            errors++;
+        }
+    }
+    for (unsigned int size = 0; size < 1 << SIZE_BITS; size++) {
+        for (unsigned int flavourID = 0; flavourID < 1 << FLAVOUR_BITS; flavourID++) {
+            uint16_t order = coffee_encode_order(size, flavourID);
+            uint16_t ref = (flavourID | size << FLAVOUR_BITS);
+            uint16_t dsize;
+            uint8_t dflavourID;
+
+            ref |= reference_parity16(ref) << ORDER_PARITY_BIT;
+            if (order != ref || coffee_decode_order(order, &dsize, &dflavourID) != 0
+                || dsize != size || dflavourID != flavourID) {
+                (void) printf("round trip of %u ml, flavour %u failed\n", size, flavourID);
+                errors++;
+            }
+        }
+    }
+    for (unsigned int wire = 0; wire <= UINT8_MAX; wire++) {
+        uint8_t answer = wire & 0x7f;
+        int ref = reference_parity8(answer) == wire >> 7 ? answer : -1;
+
+        if (coffee_decode_answer(wire) != ref) {
+            (void) printf("answer 0x%02x: codec %d, reference %d\n", wire, coffee_decode_answer(wire), ref);
+            errors++;
+        }
+        if (wire < 128 && coffee_encode_answer(wire) != (wire | reference_parity8(wire) << ANSWER_PARITY_BIT)) {
+            (void) printf("encoding answer %u failed\n", wire);
+            errors++;
+        }
+    }
+    return errors;
+}
+
+static double time_decode(int rounds, int codec)
+{
+    struct timespec from, to;
+    unsigned long sum = 0;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &from);
+    for (int r = 0; r < rounds; r++) {
+        for (uint32_t wire = 0; wire <= UINT16_MAX; wire++) {
+            uint16_t size;
+            uint8_t flavourID;
+
+            if (codec) {
+                if (coffee_decode_order(wire, &size, &flavourID) == 0) {
+                    sum += coffee_encode_answer((size + flavourID) & 0x7f);
+                }
+            } else if (reference_decode_order(wire, &size, &flavourID) == 0) {
+                uint8_t answer = (size + flavourID) & 0x7f;
+                sum += answer | reference_parity8(answer) << 7;
+            }
+        }
+    }
+    (void) clock_gettime(CLOCK_MONOTONIC, &to);
+    sink = sum;
+    return ((to.tv_sec - from.tv_sec) * 1e9 + (to.tv_nsec - from.tv_nsec))
+        / ((double) rounds * (UINT16_MAX + 1));
+}
+
+static int reference_decode_order(uint16_t order, uint16_t *size, uint8_t *flavourID)
+{
+    uint8_t buffer[ORDER_BYTES] = {order & 0xff, order >> 8};
+    uint8_t parity = reference_parity16(order);
+
+    if (parity != (order >> 15)) {
+        return -1;
+    }
+    *flavourID = buffer[0] << 3;
+    *flavourID = *flavourID >> 3;
+    uint8_t temp_no_parity = buffer[1] << 1;
+    buffer[1] = temp_no_parity >> 1;
+    *size = ((buffer[0] >> 5) + (buffer[1] << 3));
+    return 0;
+}
+
+static uint8_t reference_parity16(uint16_t info)
+{
+    int8_t parity_calc = 0;
+    for (int i = 0; i < 15; ++i) {
+        parity_calc ^= info;
+        info >>= 0x1;
+    }
+    return parity_calc &= 0x1;
+}
+
+static uint8_t reference_parity8(uint8_t info)
+{
+    int8_t parity_calc = 0;
+    for (int i = 0; i < 7; ++i) {
+        parity_calc ^= info;
+        info >>= 0x1;
+    }
+    return parity_calc &= 0x1;
+}
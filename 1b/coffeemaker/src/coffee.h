@@ -0,0 +1,149 @@
+/**
+ * @file coffee.h
+ * @date 2017-05-09
+ *
+ * @brief Wire protocol shared by the coffeemaker client and server.
+ *
+ *        An order is 2 bytes, little endian: flavour in bits 0-4, size in ml in
+ *        bits 5-14, parity in bit 15. The answer is 1 byte: the waiting time in
+ *        s or an error code (124 busy, 125 full_bin, 126 no_water, 127 both) in
+ *        bits 0-6, parity in bit 7. Busy means the server rejected the order
+ *        without queueing it, the client may retry later. The original protocol sends one order per connection.
+ *
+ *        Batch protocol: the client opens with PROTO_HELLO, which has a wrong
+ *        parity bit, so a server without batch support takes it for an order
+ *        with a parity error (the original server exits). A client can
+ *        therefore not fall back to one order per connection, batches need a
+ *        new server. A server supporting it answers PROTO_ACK and the maximum
+ *        number of orders per frame. Then the client sends frames of a count byte
+ *        (1..maximum) followed by that many orders and reads one answer per
+ *        order, in order, for as long as it keeps the connection open.
+ *
+ *        Wide orders: 5 bits reach the first 32 flavours of flavours.def only.
+ *        A client opening with PROTO_HELLO_WIDE instead, again with a wrong
+ *        parity bit, gets the same answer and then sends frames of wide
+ *        orders of 3 bytes: flavour in bits 0-12, size in bits 13-22, parity in
+ *        bit 23. A server without wide orders fails the same way.
+ **/
+#ifndef COFFEE_H
+#define COFFEE_H
+
+#include <stdint.h>
+
+#include "codec.h"
+
+/* Bytes of an order and of an answer */
+#define ORDER_BYTES (2)
+#define ANSWER_BYTES (1)
+
+/* Fields of an order and position of the parity bits */
+#define FLAVOUR_BITS (5)
+#define SIZE_BITS (10)
+#define ORDER_PARITY_BIT (FLAVOUR_BITS + SIZE_BITS)
+#define ANSWER_PARITY_BIT (7)
+
+/* Bytes, flavour field and parity bit of a wide order */
+#define WIDE_ORDER_BYTES (3)
+#define WIDE_FLAVOUR_BITS (13)
+#define WIDE_ORDER_PARITY_BIT (WIDE_FLAVOUR_BITS + SIZE_BITS)
+
+/* Error codes of an answer, smaller answers are waiting times */
+#define ANSWER_BUSY (124)
+#define ANSWER_FULL_BIN (125)
+#define ANSWER_NO_WATER (126)
+#define ANSWER_NO_WATER_AND_FULL_BIN (127)
+
+/* Opening of the batch protocol: all bits set but the parity bit */
+#define PROTO_HELLO (0x7fff)
+
+/* Opening of the batch protocol with wide orders, parity bit wrong as well */
+#define PROTO_HELLO_WIDE (0xfffe)
+
+/* Answer of a server supporting the batch protocol */
+#define PROTO_ACK (0xff)
+
+/* Maximum number of orders in a frame */
+#define MAX_BATCH (64)
+
+/**
+ * @brief Encodes an order with its parity bit.
+ * @param size ml of coffee, less than 2^SIZE_BITS
+ * @param flavourID flavour, less than 2^FLAVOUR_BITS
+ * @return the order as sent in ORDER_BYTES bytes
+ */
+static inline uint16_t coffee_encode_order(unsigned int size, unsigned int flavourID)
+{
+    return codec_add_parity(flavourID | size << FLAVOUR_BITS, ORDER_PARITY_BIT);
+}
+
+/**
+ * @brief Decodes a received order.
+ * @param order the order including its parity bit
+ * @param size where the ml of coffee are stored
+ * @param flavourID where the flavour is stored
+ * @return 0 on success, -1 on a parity error
+ */
+static inline int coffee_decode_order(uint16_t order, uint16_t *size, uint8_t *flavourID)
+{
+    uint64_t value;
+    int res = codec_check_parity(order, ORDER_PARITY_BIT, &value);
+
+    *flavourID = value & ((1 << FLAVOUR_BITS) - 1);
+    *size = value >> FLAVOUR_BITS;
+    return res;
+}
+
+/**
+ * @brief Encodes a wide order with its parity bit.
+ * @param size ml of coffee, less than 2^SIZE_BITS
+ * @param flavourID flavour, less than 2^WIDE_FLAVOUR_BITS
+ * @return the order as sent in WIDE_ORDER_BYTES bytes
+ */
+static inline uint32_t coffee_encode_wide_order(unsigned int size, unsigned int flavourID)
+{
+    return codec_add_parity(flavourID | size << WIDE_FLAVOUR_BITS, WIDE_ORDER_PARITY_BIT);
+}
+
+/**
+ * @brief Decodes a received wide order.
+ * @param order the order including its parity bit
+ * @param size where the ml of coffee are stored
+ * @param flavourID where the flavour is stored
+ * @return 0 on success, -1 on a parity error
+ */
+static inline int coffee_decode_wide_order(uint32_t order, uint16_t *size, uint16_t *flavourID)
+{
+    uint64_t value;
+    int res = codec_check_parity(order, WIDE_ORDER_PARITY_BIT, &value);
+
+    *flavourID = value & ((1 << WIDE_FLAVOUR_BITS) - 1);
+    *size = value >> WIDE_FLAVOUR_BITS;
+    return res;
+}
+
+/**
+ * @brief Encodes an answer with its parity bit.
+ * @param answer waiting time in s or error code, less than 128
+ * @return the answer as sent in ANSWER_BYTES bytes
+ */
+static inline uint8_t coffee_encode_answer(uint8_t answer)
+{
+    return codec_add_parity(answer, ANSWER_PARITY_BIT);
+}
+
+/**
+ * @brief Decodes a received answer.
+ * @param wire the answer including its parity bit
+ * @return the waiting time in s or error code, -1 on a parity error
+ */
+static inline int coffee_decode_answer(uint8_t wire)
+{
+    uint64_t value;
+
+    if (codec_check_parity(wire, ANSWER_PARITY_BIT, &value) < 0) {
+        return -1;
+    }
+    return value;
+}
+
+#endif /* COFFEE_H */
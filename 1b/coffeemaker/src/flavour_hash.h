@@ -0,0 +1,40 @@
+/**
+ * @file flavour_hash.h
+ * @date 2017-05-13
+ *
+ * @brief Case-insensitive string hash of the flavour lookup, shared by
+ *        genflavours and the generated flavours.c.
+ *
+ *        The lookup is a hash and displace perfect hash: the hash with seed 0
+ *        picks a bucket, the bucket's displacement is the seed of a second
+ *        hash which picks the slot. genflavours searches displacements until
+ *        every flavour has a slot of its own.
+ **/
+#ifndef FLAVOUR_HASH_H
+#define FLAVOUR_HASH_H
+
+#include <stdint.h>
+#include <ctype.h>
+
+/**
+ * @brief FNV-1a hash of a string, ignoring case.
+ * @param name the string
+ * @param seed 0 for the bucket, the bucket's displacement for the slot
+ * @return the hash
+ */
+static inline uint32_t flavour_hash(const char *name, uint32_t seed)
+{
+    uint32_t h = 2166136261u ^ (seed * 0x9e3779b9u);
+
+    for (const unsigned char *p = (const unsigned char *) name; *p != '\0'; p++) {
+        h ^= tolower(*p);
+        h *= 16777619u;
+    }
+    /* mix the high bits into the low bits used for the table index */
+    h ^= h >> 15;
+    h *= 0x2c1b3c6du;
+    h ^= h >> 12;
+    return h;
+}
+
+#endif /* FLAVOUR_HASH_H */
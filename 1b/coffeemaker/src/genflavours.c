@@ -0,0 +1,214 @@
+/**
+ * @file genflavours.c
+ * @date 2017-05-13
+ *
+ * @brief Generates the flavour catalog (flavours.h and flavours.c) from
+ *        flavours.def. Called by make.
+ *
+ *        flavour_lookup() finds a name with a perfect hash: flavour_hash(name, 0)
+ *        selects one of FLAVOUR_BUCKETS buckets, flavour_hash(name, disp[bucket])
+ *        one of FLAVOUR_SLOTS slots holding the flavour ID. The displacements
+ *        are searched here, biggest bucket first, until all flavours of a
+ *        bucket fall into free slots. A lookup costs two hashes and one
+ *        strcasecmp, independent of the size of the catalog.
+ **/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+
+#include "flavour_hash.h"
+
+/* Largest displacement tried before the table is doubled */
+#define MAX_DISP (1 << 16)
+
+/* @brief The catalog, see flavours.def */
+static const char *const names[] = {
+#define FLAVOUR(name) name,
+#include "flavours.def"
+#undef FLAVOUR
+};
+
+#define COUNT ((int) (sizeof(names) / sizeof(names[0])))
+
+static int nslots;              /* < number of slots, a power of two */
+static int nbuckets;            /* < number of buckets, a power of two */
+static uint32_t *disp;          /* < displacement of every bucket */
+static int *slots;              /* < flavour ID of every slot, -1 if free */
+
+/**
+ * @brief Searches the displacements for the current table size.
+ * @return 0 on success, -1 if a bucket found no displacement
+ */
+static int build(void);
+
+/**
+ * @brief Prints the header with the declarations of the catalog.
+ */
+static void print_header(void);
+
+/**
+ * @brief Prints the tables and flavour_lookup().
+ */
+static void print_tables(void);
+
+/**
+ * @brief Program entry point
+ * @param argc The argument counter
+ * @param argv The argument vector, argv[1] is either "h" or "c"
+ * @return EXIT_SUCCESS on success
+ */
+int main(int argc, char *argv[])
+{
+    if (argc != 2 || (strcmp(argv[1], "h") != 0 && strcmp(argv[1], "c") != 0)) {
+        (void) fprintf(stderr, "Usage: %s h|c\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < COUNT; i++) {
+        for (int j = 0; j < i; j++) {
+            if (strcasecmp(names[i], names[j]) == 0) {
+                (void) fprintf(stderr, "%s: flavour \"%s\" listed twice\n", argv[0], names[i]);
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    nslots = 1;
+    while (nslots < COUNT) {
+        nslots <<= 1;
+    }
+    while (build() < 0) {
+        nslots <<= 1;
+    }
+
+    if (argv[1][0] == 'h') {
+        print_header();
+    } else {
+        print_tables();
+    }
+    free(disp);
+    free(slots);
+    return EXIT_SUCCESS;
+}
+
+static int build(void)
+{
+    int *bucket_of = malloc(COUNT * sizeof(int));
+    int *size = NULL, *order = NULL;
+    int res = 0;
+
+    nbuckets = nslots > 4 ? nslots / 4 : 1;
+    free(disp);
+    free(slots);
+    disp = calloc(nbuckets, sizeof(uint32_t));
+    slots = malloc(nslots * sizeof(int));
+    size = calloc(nbuckets, sizeof(int));
+    order = malloc(nbuckets * sizeof(int));
+    if (bucket_of == NULL || disp == NULL || slots == NULL || size == NULL || order == NULL) {
+        (void) fprintf(stderr, "genflavours: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int s = 0; s < nslots; s++) {
+        slots[s] = -1;
+    }
+    for (int i = 0; i < COUNT; i++) {
+        bucket_of[i] = flavour_hash(names[i], 0) & (nbuckets - 1);
+        size[bucket_of[i]]++;
+    }
+    /* biggest buckets first, they are the hardest to place */
+    for (int b = 0; b < nbuckets; b++) {
+        int j = b;
+
+        while (j > 0 && size[order[j - 1]] < size[b]) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = b;
+    }
+
+    for (int k = 0; k < nbuckets && size[order[k]] > 0 && res == 0; k++) {
+        int b = order[k];
+        uint32_t d;
+
+        for (d = 1; d < MAX_DISP; d++) {
+            int placed = 0;
+
+            for (int i = 0; i < COUNT; i++) {
+                if (bucket_of[i] != b) {
+                    continue;
+                }
+                int s = flavour_hash(names[i], d) & (nslots - 1);
+                if (slots[s] != -1) {
+                    break;
+                }
+                slots[s] = i;
+                placed++;
+            }
+            if (placed == size[b]) {
+                break;
+            }
+            /* take back the flavours of this bucket placed so far */
+            for (int s = 0; s < nslots; s++) {
+                if (slots[s] != -1 && bucket_of[slots[s]] == b) {
+                    slots[s] = -1;
+                }
+            }
+        }
+        if (d == MAX_DISP) {
+            res = -1;
+        }
+        disp[b] = d;
+    }
+
+    free(bucket_of);
+    free(size);
+    free(order);
+    return res;
+}
+
+static void print_header(void)
+{
+    (void) printf("/* generated by genflavours, do not edit */\n");
+    (void) printf("#ifndef FLAVOURS_H\n#define FLAVOURS_H\n\n");
+    (void) printf("/* number of flavours, IDs are 0 .. FLAVOUR_COUNT - 1 */\n");
+    (void) printf("#define FLAVOUR_COUNT (%d)\n\n", COUNT);
+    (void) printf("#define FLAVOUR_SLOTS (%d)\n", nslots);
+    (void) printf("#define FLAVOUR_BUCKETS (%d)\n\n", nbuckets);
+    (void) printf("/* name of every flavour, indexed by its ID */\n");
+    (void) printf("extern const char *const flavour_names[FLAVOUR_COUNT];\n\n");
+    (void) printf("/* ID of a flavour name, ignoring case, -1 if unknown */\n");
+    (void) printf("int flavour_lookup(const char *name);\n");
+    (void) printf("\n#endif /* FLAVOURS_H */\n");
+}
+
+static void print_tables(void)
+{
+    (void) printf("/* generated by genflavours, do not edit */\n");
+    (void) printf("#include <stdint.h>\n#include <strings.h>\n\n");
+    (void) printf("#include \"flavours.h\"\n#include \"flavour_hash.h\"\n\n");
+
+    (void) printf("const char *const flavour_names[FLAVOUR_COUNT] = {\n");
+    for (int i = 0; i < COUNT; i++) {
+        (void) printf("    \"%s\",\n", names[i]);
+    }
+    (void) printf("};\n\n");
+
+    (void) printf("static const uint32_t disp[FLAVOUR_BUCKETS] = {");
+    for (int b = 0; b < nbuckets; b++) {
+        (void) printf("%s%u,", b % 12 == 0 ? "\n    " : " ", (unsigned int) disp[b]);
+    }
+    (void) printf("\n};\n\n");
+
+    (void) printf("static const int16_t slots[FLAVOUR_SLOTS] = {");
+    for (int s = 0; s < nslots; s++) {
+        (void) printf("%s%d,", s % 12 == 0 ? "\n    " : " ", slots[s]);
+    }
+    (void) printf("\n};\n\n");
+
+    (void) printf("int flavour_lookup(const char *name)\n{\n");
+    (void) printf("    uint32_t bucket = flavour_hash(name, 0) & (FLAVOUR_BUCKETS - 1);\n");
+    (void) printf("    int id = slots[flavour_hash(name, disp[bucket]) & (FLAVOUR_SLOTS - 1)];\n\n");
+    (void) printf("    if (id < 0 || strcasecmp(name, flavour_names[id]) != 0) {\n");
+    (void) printf("        return -1;\n    }\n    return id;\n}\n");
+}
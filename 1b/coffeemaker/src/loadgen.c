@@ -0,0 +1,972 @@
+/**
+ * @file loadgen.c
+ * @date 2017-05-11
+ *
+ * @brief Load generator for the coffeemaker server. Keeps many connections
+ *        open at the same time, spread over several threads with an epoll
+ *        instance each, and orders coffees of random flavour and size, either
+ *        one order per connection like the client or in frames of the batch
+ *        protocol. With -r the orders are paced to a total rate, else every
+ *        connection orders again as soon as it got its answers. Reports
+ *        orders/s, the mix of answers and error codes, latency percentiles and
+ *        a histogram of the round trips and, if the pid of the server is
+ *        given, the server's CPU time per order.
+ **/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <time.h>
+#include <getopt.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netdb.h>
+#include <pthread.h>
+
+#include "coffee.h"
+#include "sockio.h"
+
+/* Maximum number of events handled per epoll_wait() */
+#define MAX_EVENTS (256)
+
+/* Milliseconds a loader sleeps at most in epoll_wait() before checking the time */
+#define POLL_TIMEOUT (100)
+
+/* Milliseconds a connection waits for the connect or an answer of the server
+   before its orders count as failed */
+#define ROUND_TIMEOUT (5000)
+
+/* Number of flavour IDs and largest size of an order */
+#define FLAVOURS (1 << FLAVOUR_BITS)
+#define MAX_SIZE ((1 << SIZE_BITS) - 1)
+
+/* Buckets of the latency histogram, bucket i counts latencies below 2^i us */
+#define HISTOGRAM_BUCKETS (32)
+
+/* === Type Definitions === */
+
+/* @brief States of a connection */
+enum state {
+    CONNECTING,   /* < non-blocking connect() in progress */
+    HELLO,        /* < waiting for the answer to PROTO_HELLO */
+    ORDERING,     /* < waiting for the answers to the sent orders */
+    WAITING,      /* < waiting for its turn to order, with -r */
+    FINISHED      /* < no more orders */
+};
+
+/* @brief One connection ordering one coffee or frame after another */
+struct connection {
+    int fd;
+    enum state state;
+    int batch;                         /* < orders per frame, 1 for the original protocol */
+    int pending;                       /* < orders to send next */
+    int sent;                          /* < orders waiting for an answer */
+    struct sockio io;
+    uint8_t in[MAX_BATCH];
+    uint8_t out[1 + MAX_BATCH * ORDER_BYTES];
+    struct timespec sent_at;           /* < time the orders were sent */
+    struct timespec deadline;          /* < end of CONNECTING, HELLO or ORDERING */
+    struct connection *next_waiting;
+};
+
+/* @brief Parsed arguments */
+struct opts {
+    const char *host;
+    const char *port;
+    int connections;
+    int threads;
+    int batch;
+    int max_size;          /* < orders are between 1 and max_size ml */
+    double rate;           /* < orders per second of all threads, 0 for no limit */
+    long orders;           /* < stop after this many orders, 0 for no limit */
+    double duration;       /* < stop sending orders after this many seconds */
+    long server_pid;       /* < pid of the server for the CPU statistics, 0 if unknown */
+};
+
+/* @brief Collected measurements */
+struct stats {
+    long sent;
+    long answered;
+    long ready;            /* < coffees accepted by the server */
+    long busy;             /* < orders rejected by the admission control */
+    long full_bin;
+    long no_water;
+    long no_water_and_full_bin;
+    long failed;           /* < orders or connections lost to an error */
+    uint64_t *latencies;   /* < round trip times in nanoseconds */
+    size_t nlatencies;
+    size_t capacity;
+};
+
+/* @brief A thread driving its share of the connections */
+struct loader {
+    pthread_t thread;
+    int epfd;
+    int nconns;
+    int active;                    /* < connections not FINISHED */
+    long orders;                   /* < orders this loader sends, -1 for no limit */
+    long interval;                 /* < ns between two orders with -r, 0 for no limit */
+    struct timespec next_order;    /* < earliest time of the next order with -r */
+    struct connection *waiting_head, *waiting_tail;
+    unsigned int seed;
+    struct connection *conns;
+    const struct opts *options;
+    struct stats stats;
+};
+
+/* === Global Variables === */
+
+/* @brief Name of the program */
+static const char *progname = "loadgen";
+
+/* @brief Address of the server */
+static struct addrinfo *server_addr = NULL;
+
+/* @brief Time the load generator started */
+static struct timespec start;
+
+/* @brief This variable is set upon receipt of a signal */
+volatile sig_atomic_t quit = 0;
+
+/* === Prototypes === */
+
+/**
+ * @brief Parse command line options
+ * @param argc The argument counter
+ * @param argv The argument vector
+ * @param options Struct where parsed arguments are stored
+ */
+static void parse_args(int argc, char **argv, struct opts *options);
+
+/**
+ * @brief Thread function: orders on the loader's connections until the
+ *        duration or the number of orders is reached.
+ * @param arg the struct loader
+ * @return NULL
+ */
+static void *run_loader(void *arg);
+
+/**
+ * @brief Fails the connections which wait for the server past their
+ *        deadline. After the duration the orders in flight get one more
+ *        POLL_TIMEOUT, on a signal they fail at once.
+ * @param l the loader
+ * @param now current time
+ */
+static void check_deadlines(struct loader *l, const struct timespec *now);
+
+/**
+ * @brief Sets the deadline of a connection to ROUND_TIMEOUT from now.
+ * @param c the connection
+ */
+static void set_deadline(struct connection *c);
+
+/**
+ * @brief Checks whether the loader stops sending orders.
+ * @param l the loader
+ * @param now current time
+ * @return true after the duration, on a signal or if all orders were sent
+ */
+static bool stopping(const struct loader *l, const struct timespec *now);
+
+/**
+ * @brief Called when a connection may order again: finishes it if the loader
+ *        stops, queues it until its turn with -r, else reserves the orders of
+ *        the next frame and sends them, connecting first if needed.
+ * @param l the loader owning the connection
+ * @param c the connection
+ */
+static void ready(struct loader *l, struct connection *c);
+
+/**
+ * @brief Starts a non-blocking connect.
+ * @param l the loader owning the connection
+ * @param c the connection
+ * @return true on success
+ */
+static bool start_connection(struct loader *l, struct connection *c);
+
+/**
+ * @brief Sends the pending orders of a connection with random flavours and sizes.
+ * @param l the loader owning the connection
+ * @param c the connection
+ * @return true on success
+ */
+static bool send_orders(struct loader *l, struct connection *c);
+
+/**
+ * @brief Handles an event on a connection.
+ * @param l the loader owning the connection
+ * @param c the connection
+ */
+static void handle_event(struct loader *l, struct connection *c);
+
+/**
+ * @brief Processes the received bytes of a connection.
+ * @param l the loader owning the connection
+ * @param c the connection
+ * @return 1 if all answers arrived, 0 if more are expected, -1 on a protocol error
+ */
+static int process_answers(struct loader *l, struct connection *c);
+
+/**
+ * @brief Counts an error, closes the connection and lets it order again.
+ * @param l the loader owning the connection
+ * @param c the connection
+ */
+static void fail(struct loader *l, struct connection *c);
+
+/**
+ * @brief Adds a latency sample.
+ * @param stats collected measurements
+ * @param ns round trip time in nanoseconds
+ */
+static void add_latency(struct stats *stats, uint64_t ns);
+
+/**
+ * @brief Closes the socket of a connection.
+ * @param c the connection
+ */
+static void close_connection(struct connection *c);
+
+/**
+ * @brief Adds the measurements of a loader to the total.
+ * @param total merged measurements
+ * @param stats measurements of one loader
+ */
+static void merge_stats(struct stats *total, struct stats *stats);
+
+/**
+ * @brief Prints the collected measurements.
+ * @param stats collected measurements
+ * @param seconds duration of the run
+ * @param server_cpu CPU seconds used by the server, negative if unknown
+ */
+static void print_stats(struct stats *stats, double seconds, double server_cpu);
+
+/**
+ * @brief Prints a histogram of the latencies in power of two buckets.
+ * @param stats collected measurements, latencies sorted
+ */
+static void print_histogram(const struct stats *stats);
+
+/**
+ * @brief Reads the CPU time used by a process from /proc.
+ * @param pid the process
+ * @return user and system time in seconds, negative on error
+ */
+static double process_cpu(long pid);
+
+/**
+ * @brief Returns the difference between two points in time in nanoseconds.
+ * @param from start
+ * @param to end
+ * @return to - from in nanoseconds, negative if to is before from
+ */
+static int64_t diff_ns(const struct timespec *from, const struct timespec *to);
+
+/**
+ * @brief Adds nanoseconds to a point in time.
+ * @param t the point in time
+ * @param ns nanoseconds
+ */
+static void add_ns(struct timespec *t, long ns);
+
+/**
+ * @brief compares two latencies, used by qsort
+ */
+static int compare_latency(const void *a, const void *b);
+
+/**
+ * @brief terminate program on program error
+ * @param exitcode exit code
+ * @param fmt format string
+ */
+static void bail_out(int exitcode, const char *fmt, ...);
+
+/**
+ * @brief Signal handler
+ * @param sig Signal number catched
+ */
+static void signal_handler(int sig);
+
+/* === Implementations === */
+
+/**
+ * @brief Program entry point
+ * @param argc The argument counter
+ * @param argv The argument vector
+ * @return EXIT_SUCCESS if no order failed
+ */
+int main(int argc, char *argv[])
+{
+    struct opts options;
+    struct stats stats;
+    struct loader *loaders;
+    struct timespec now;
+    struct addrinfo hints;
+    struct sigaction s;
+    double cpu_before = -1, cpu_after = -1;
+    int res;
+
+    parse_args(argc, argv, &options);
+
+    s.sa_handler = signal_handler;
+    s.sa_flags = 0;
+    (void) sigemptyset(&s.sa_mask);
+    if (sigaction(SIGINT, &s, NULL) < 0 || sigaction(SIGTERM, &s, NULL) < 0) {
+        bail_out(EXIT_FAILURE, "sigaction");
+    }
+    s.sa_handler = SIG_IGN;
+    if (sigaction(SIGPIPE, &s, NULL) < 0) {
+        bail_out(EXIT_FAILURE, "sigaction");
+    }
+
+    (void) memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if ((res = getaddrinfo(options.host, options.port, &hints, &server_addr)) != 0) {
+        bail_out(EXIT_FAILURE, "getaddrinfo: %s", gai_strerror(res));
+    }
+
+    if ((loaders = calloc(options.threads, sizeof(*loaders))) == NULL) {
+        bail_out(EXIT_FAILURE, "calloc");
+    }
+    (void) clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < options.threads; i++) {
+        struct loader *l = &loaders[i];
+        l->options = &options;
+        /* spread the connections, orders and rate evenly */
+        l->nconns = options.connections / options.threads
+            + (i < options.connections % options.threads);
+        l->orders = options.orders == 0 ? -1 : options.orders / options.threads
+            + (i < options.orders % options.threads);
+        l->interval = options.rate > 0 ? (long) (1e9 * options.threads / options.rate) : 0;
+        l->next_order = start;
+        l->seed = (unsigned int) start.tv_nsec + i;
+        if ((l->conns = calloc(l->nconns, sizeof(*l->conns))) == NULL) {
+            bail_out(EXIT_FAILURE, "calloc");
+        }
+        if ((l->epfd = epoll_create(MAX_EVENTS)) < 0) {
+            bail_out(EXIT_FAILURE, "epoll_create");
+        }
+    }
+
+    if (options.server_pid > 0 && (cpu_before = process_cpu(options.server_pid)) < 0) {
+        bail_out(EXIT_FAILURE, "Cannot read CPU time of process %ld", options.server_pid);
+    }
+
+    for (int i = 1; i < options.threads; i++) {
+        errno = pthread_create(&loaders[i].thread, NULL, run_loader, &loaders[i]);
+        if (errno != 0) {
+            bail_out(EXIT_FAILURE, "pthread_create");
+        }
+    }
+    (void) run_loader(&loaders[0]);
+    for (int i = 1; i < options.threads; i++) {
+        (void) pthread_join(loaders[i].thread, NULL);
+    }
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &now);
+    if (options.server_pid > 0) {
+        cpu_after = process_cpu(options.server_pid);
+    }
+
+    (void) memset(&stats, 0, sizeof(stats));
+    for (int i = 0; i < options.threads; i++) {
+        merge_stats(&stats, &loaders[i].stats);
+        free(loaders[i].stats.latencies);
+        free(loaders[i].conns);
+        (void) close(loaders[i].epfd);
+    }
+    print_stats(&stats, diff_ns(&start, &now) / 1e9,
+        cpu_before >= 0 && cpu_after >= 0 ? cpu_after - cpu_before : -1);
+
+    free(stats.latencies);
+    free(loaders);
+    freeaddrinfo(server_addr);
+    return stats.failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static void *run_loader(void *arg)
+{
+    struct loader *l = arg;
+
+    struct timespec checked;         /* < last check of the deadlines */
+
+    l->active = l->nconns;
+    (void) clock_gettime(CLOCK_MONOTONIC, &checked);
+    for (int i = 0; i < l->nconns; i++) {
+        struct connection *c = &l->conns[i];
+        c->fd = -1;
+        c->batch = l->options->batch;
+        ready(l, c);
+    }
+
+    while (l->active > 0) {
+        struct epoll_event events[MAX_EVENTS];
+        struct timespec now;
+        int timeout = POLL_TIMEOUT;
+        int n;
+
+        if (l->waiting_head != NULL) {
+            (void) clock_gettime(CLOCK_MONOTONIC, &now);
+            int64_t wait = diff_ns(&now, &l->next_order);
+            if (wait < (int64_t) timeout * 1000000) {
+                timeout = wait > 0 ? (wait + 999999) / 1000000 : 0;
+            }
+        }
+        if ((n = epoll_wait(l->epfd, events, MAX_EVENTS, timeout)) < 0) {
+            if (errno != EINTR) {
+                bail_out(EXIT_FAILURE, "epoll_wait");
+            }
+            n = 0;
+        }
+        for (int i = 0; i < n; i++) {
+            handle_event(l, events[i].data.ptr);
+        }
+
+        /* connections whose turn has come, or all of them when the loader stops */
+        (void) clock_gettime(CLOCK_MONOTONIC, &now);
+        while (l->waiting_head != NULL
+            && (diff_ns(&l->next_order, &now) >= 0 || stopping(l, &now))) {
+            struct connection *c = l->waiting_head;
+            l->waiting_head = c->next_waiting;
+            if (l->waiting_head == NULL) {
+                l->waiting_tail = NULL;
+            }
+            ready(l, c);
+        }
+
+        if (quit || diff_ns(&checked, &now) >= POLL_TIMEOUT * 1000000L) {
+            checked = now;
+            check_deadlines(l, &now);
+        }
+    }
+    return NULL;
+}
+
+static void check_deadlines(struct loader *l, const struct timespec *now)
+{
+    bool drained = diff_ns(&start, now) / 1e6 >= l->options->duration * 1e3 + POLL_TIMEOUT;
+
+    for (int i = 0; i < l->nconns; i++) {
+        struct connection *c = &l->conns[i];
+
+        if (c->state != CONNECTING && c->state != HELLO && c->state != ORDERING) {
+            continue;
+        }
+        if (quit || drained || diff_ns(&c->deadline, now) >= 0) {
+            fail(l, c);
+        }
+    }
+}
+
+static void set_deadline(struct connection *c)
+{
+    (void) clock_gettime(CLOCK_MONOTONIC, &c->deadline);
+    add_ns(&c->deadline, ROUND_TIMEOUT * 1000000L);
+}
+
+static bool stopping(const struct loader *l, const struct timespec *now)
+{
+    return quit || diff_ns(&start, now) / 1e9 >= l->options->duration
+        || (l->orders >= 0 && l->stats.sent >= l->orders);
+}
+
+static void ready(struct loader *l, struct connection *c)
+{
+    struct timespec now;
+    long left;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &now);
+    if (stopping(l, &now)) {
+        close_connection(c);
+        c->state = FINISHED;
+        l->active--;
+        return;
+    }
+    if (l->interval > 0) {
+        if (diff_ns(&l->next_order, &now) < 0) {
+            c->state = WAITING;
+            c->next_waiting = NULL;
+            if (l->waiting_tail != NULL) {
+                l->waiting_tail->next_waiting = c;
+            } else {
+                l->waiting_head = c;
+            }
+            l->waiting_tail = c;
+            return;
+        }
+        /* do not make up for time the loader was behind */
+        if (diff_ns(&l->next_order, &now) > l->interval) {
+            l->next_order = now;
+        }
+    }
+    c->pending = c->batch;
+    left = l->orders - l->stats.sent;
+    if (l->orders >= 0 && left < c->pending) {
+        c->pending = left;
+    }
+    /* reserve the orders, a connection still connecting counts already */
+    l->stats.sent += c->pending;
+    add_ns(&l->next_order, c->pending * l->interval);
+
+    if (c->fd >= 0) {
+        if (!send_orders(l, c)) {
+            fail(l, c);
+        }
+    } else if (!start_connection(l, c)) {
+        fail(l, c);
+    }
+}
+
+static bool start_connection(struct loader *l, struct connection *c)
+{
+    struct epoll_event ev;
+
+    c->fd = socket(server_addr->ai_family, server_addr->ai_socktype, server_addr->ai_protocol);
+    if (c->fd < 0) {
+        bail_out(EXIT_FAILURE, "socket");
+    }
+    if (fcntl(c->fd, F_SETFL, O_NONBLOCK) < 0) {
+        bail_out(EXIT_FAILURE, "fcntl");
+    }
+    c->state = CONNECTING;
+    set_deadline(c);
+    c->sent = 0;
+    sockio_init(&c->io, c->fd, c->in, sizeof(c->in), c->out, sizeof(c->out));
+    ev.events = EPOLLOUT;
+    ev.data.ptr = c;
+    if (epoll_ctl(l->epfd, EPOLL_CTL_ADD, c->fd, &ev) < 0) {
+        bail_out(EXIT_FAILURE, "epoll_ctl");
+    }
+    return connect(c->fd, server_addr->ai_addr, server_addr->ai_addrlen) == 0
+        || errno == EINPROGRESS;
+}
+
+static bool send_orders(struct loader *l, struct connection *c)
+{
+    uint8_t buff[1 + MAX_BATCH * ORDER_BYTES];
+    size_t len = 0;
+
+    if (l->options->batch > 1) {
+        buff[len++] = c->pending;
+    }
+    for (int i = 0; i < c->pending; i++) {
+        int size = 1 + rand_r(&l->seed) % l->options->max_size;
+        codec_put(buff + len, coffee_encode_order(size, rand_r(&l->seed) % FLAVOURS), ORDER_BYTES);
+        len += ORDER_BYTES;
+    }
+    c->sent = c->pending;
+    c->pending = 0;
+    c->state = ORDERING;
+    (void) clock_gettime(CLOCK_MONOTONIC, &c->sent_at);
+    c->deadline = c->sent_at;
+    add_ns(&c->deadline, ROUND_TIMEOUT * 1000000L);
+    /* a frame always fits into the empty socket buffer */
+    return sockio_write(&c->io, buff, len) == 0 && sockio_flush(&c->io) == 0;
+}
+
+static void handle_event(struct loader *l, struct connection *c)
+{
+    if (c->state == WAITING) {
+        /* the server dropped the idle connection, reconnect when it is its turn */
+        close_connection(c);
+        return;
+    }
+    if (c->state == CONNECTING) {
+        struct epoll_event ev;
+        int err = 0;
+        socklen_t len = sizeof(err);
+
+        if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+            fail(l, c);
+            return;
+        }
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        if (epoll_ctl(l->epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0) {
+            bail_out(EXIT_FAILURE, "epoll_ctl");
+        }
+        if (l->options->batch > 1) {
+            uint8_t hello[ORDER_BYTES];
+            codec_put(hello, PROTO_HELLO, ORDER_BYTES);
+            c->state = HELLO;
+            set_deadline(c);
+            if (sockio_write(&c->io, hello, sizeof(hello)) < 0 || sockio_flush(&c->io) < 0) {
+                fail(l, c);
+            }
+        } else if (!send_orders(l, c)) {
+            fail(l, c);
+        }
+        return;
+    }
+
+    /* the server answers only what was sent, one read gets all there is */
+    ssize_t r = sockio_fill(&c->io);
+    int res;
+
+    if (r == SOCKIO_AGAIN) {
+        return;
+    }
+    if (r <= 0) {
+        fail(l, c);
+        return;
+    }
+    if ((res = process_answers(l, c)) < 0) {
+        fail(l, c);
+        return;
+    }
+    if (res == 0) {
+        return;
+    }
+    if (l->options->batch == 1) {
+        /* the original protocol: one order per connection */
+        close_connection(c);
+        ready(l, c);
+    } else if (c->pending > 0) {
+        /* orders reserved before the batch protocol was negotiated */
+        if (!send_orders(l, c)) {
+            fail(l, c);
+        }
+    } else {
+        ready(l, c);
+    }
+}
+
+static int process_answers(struct loader *l, struct connection *c)
+{
+    struct stats *stats = &l->stats;
+    const uint8_t *in = sockio_data(&c->io);
+    size_t received = sockio_buffered(&c->io);
+    struct timespec now;
+
+    if (c->state == HELLO) {
+        if (received < 2) {
+            return 0;
+        }
+        if (in[0] != PROTO_ACK || in[1] < 1) {
+            return -1;
+        }
+        if (in[1] < c->batch) {
+            c->batch = in[1];
+            if (c->pending > c->batch) {
+                /* hand the reserved orders that do not fit back */
+                stats->sent -= c->pending - c->batch;
+                c->pending = c->batch;
+            }
+        }
+        sockio_consume(&c->io, 2);
+        return 1;
+    }
+
+    if (received < c->sent * ANSWER_BYTES) {
+        return 0;
+    }
+    (void) clock_gettime(CLOCK_MONOTONIC, &now);
+    add_latency(stats, diff_ns(&c->sent_at, &now));
+    for (int i = 0; i < c->sent; i++) {
+        int answer = coffee_decode_answer(in[i]);
+
+        if (answer < 0) {
+            return -1;
+        }
+        stats->answered++;
+        switch (answer) {
+        case ANSWER_BUSY:
+            stats->busy++;
+            break;
+        case ANSWER_FULL_BIN:
+            stats->full_bin++;
+            break;
+        case ANSWER_NO_WATER:
+            stats->no_water++;
+            break;
+        case ANSWER_NO_WATER_AND_FULL_BIN:
+            stats->no_water_and_full_bin++;
+            break;
+        default:
+            stats->ready++;
+        }
+    }
+    sockio_consume(&c->io, c->sent * ANSWER_BYTES);
+    c->sent = 0;
+    return 1;
+}
+
+static void fail(struct loader *l, struct connection *c)
+{
+    long lost = c->sent + c->pending;
+
+    /* the unanswered orders, or the connection if it had none */
+    l->stats.failed += lost > 0 ? lost : 1;
+    c->sent = c->pending = 0;
+    close_connection(c);
+    ready(l, c);
+}
+
+static void add_latency(struct stats *stats, uint64_t ns)
+{
+    if (stats->nlatencies == stats->capacity) {
+        size_t capacity = stats->capacity == 0 ? 4096 : 2 * stats->capacity;
+        uint64_t *tmp = realloc(stats->latencies, capacity * sizeof(*tmp));
+        if (tmp == NULL) {
+            bail_out(EXIT_FAILURE, "realloc");
+        }
+        stats->latencies = tmp;
+        stats->capacity = capacity;
+    }
+    stats->latencies[stats->nlatencies++] = ns;
+}
+
+static void close_connection(struct connection *c)
+{
+    if (c->fd >= 0) {
+        (void) close(c->fd);
+        c->fd = -1;
+    }
+}
+
+static void merge_stats(struct stats *total, struct stats *stats)
+{
+    total->sent += stats->sent;
+    total->answered += stats->answered;
+    total->ready += stats->ready;
+    total->busy += stats->busy;
+    total->full_bin += stats->full_bin;
+    total->no_water += stats->no_water;
+    total->no_water_and_full_bin += stats->no_water_and_full_bin;
+    total->failed += stats->failed;
+    for (size_t i = 0; i < stats->nlatencies; i++) {
+        add_latency(total, stats->latencies[i]);
+    }
+}
+
+static void print_stats(struct stats *stats, double seconds, double server_cpu)
+{
+    const double percentiles[] = {50, 99, 99.9};
+    const char *names[] = {"p50", "p99", "p999"};
+
+    (void) printf("orders     %ld sent, %ld answered, %ld failed in %.2fs\n",
+        stats->sent, stats->answered, stats->failed, seconds);
+    (void) printf("orders/s   %.1f\n", stats->answered / seconds);
+    if (stats->answered > 0) {
+        (void) printf("answers    %.1f%% ready, %.1f%% busy, %.1f%% full_bin, %.1f%% no_water, "
+            "%.1f%% no_water_and_full_bin\n",
+            100.0 * stats->ready / stats->answered, 100.0 * stats->busy / stats->answered,
+            100.0 * stats->full_bin / stats->answered,
+            100.0 * stats->no_water / stats->answered,
+            100.0 * stats->no_water_and_full_bin / stats->answered);
+    }
+    if (stats->nlatencies > 0) {
+        qsort(stats->latencies, stats->nlatencies, sizeof(*stats->latencies), compare_latency);
+        for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++) {
+            size_t idx = (size_t) (percentiles[i] / 100 * (stats->nlatencies - 1) + 0.5);
+            (void) printf("%-10s %.1fus\n", names[i], stats->latencies[idx] / 1e3);
+        }
+        print_histogram(stats);
+    }
+    if (server_cpu >= 0 && stats->answered > 0) {
+        (void) printf("server cpu %.1fus per order\n", server_cpu / stats->answered * 1e6);
+    }
+}
+
+static void print_histogram(const struct stats *stats)
+{
+    size_t counts[HISTOGRAM_BUCKETS] = {0};
+    size_t most = 0;
+    int first = HISTOGRAM_BUCKETS, last = 0;
+
+    for (size_t i = 0; i < stats->nlatencies; i++) {
+        uint64_t us = stats->latencies[i] / 1000;
+        int bucket = 0;
+
+        while (bucket < HISTOGRAM_BUCKETS - 1 && us >= (1ULL << bucket)) {
+            bucket++;
+        }
+        counts[bucket]++;
+    }
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        if (counts[i] > 0) {
+            first = i < first ? i : first;
+            last = i;
+            most = counts[i] > most ? counts[i] : most;
+        }
+    }
+    (void) printf("latency histogram:\n");
+    for (int i = first; i <= last; i++) {
+        int width = (int) (40 * counts[i] / most);
+
+        (void) printf("  < %10lluus %8zu ", 1ULL << i, counts[i]);
+        for (int j = 0; j < width; j++) {
+            (void) putchar('#');
+        }
+        (void) putchar('\n');
+    }
+}
+
+static double process_cpu(long pid)
+{
+    char path[64];
+    char line[1024];
+    char *p;
+    unsigned long utime, stime;
+    FILE *f;
+
+    (void) snprintf(path, sizeof(path), "/proc/%ld/stat", pid);
+    if ((f = fopen(path, "r")) == NULL) {
+        return -1;
+    }
+    p = fgets(line, sizeof(line), f);
+    (void) fclose(f);
+    /* the command name may contain spaces, fields are counted from its end */
+    if (p == NULL || (p = strrchr(line, ')')) == NULL) {
+        return -1;
+    }
+    if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+            &utime, &stime) != 2) {
+        return -1;
+    }
+    return (double) (utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+static int64_t diff_ns(const struct timespec *from, const struct timespec *to)
+{
+    return (int64_t) (to->tv_sec - from->tv_sec) * 1000000000 + to->tv_nsec - from->tv_nsec;
+}
+
+static void add_ns(struct timespec *t, long ns)
+{
+    t->tv_sec += ns / 1000000000;
+    t->tv_nsec += ns % 1000000000;
+    if (t->tv_nsec >= 1000000000) {
+        t->tv_sec++;
+        t->tv_nsec -= 1000000000;
+    }
+}
+
+static int compare_latency(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+static void signal_handler(int sig)
+{
+    quit = 1;
+}
+
+static void bail_out(int exitcode, const char *fmt, ...)
+{
+    va_list ap;
+
+    (void) fprintf(stderr, "%s: ", progname);
+    if (fmt != NULL) {
+        va_start(ap, fmt);
+        (void) vfprintf(stderr, fmt, ap);
+        va_end(ap);
+    }
+    if (errno != 0) {
+        (void) fprintf(stderr, ": %s", strerror(errno));
+    }
+    (void) fprintf(stderr, "\n");
+    exit(exitcode);
+}
+
+static void parse_args(int argc, char **argv, struct opts *options)
+{
+    const char *usage = "Usage: %s [-h hostname] [-p port] [-c connections] [-t threads] "
+        "[-b batch] [-r orders/s] [-s max-size] [-n orders] [-d seconds] [-P server-pid]";
+    char *endptr;
+    int opt;
+
+    if (argc > 0) {
+        progname = argv[0];
+    }
+    options->host = "localhost";
+    options->port = "1821";
+    options->connections = 100;
+    options->threads = 1;
+    options->batch = 1;
+    options->max_size = 200;
+    options->rate = 0;
+    options->orders = 0;
+    options->duration = 5;
+    options->server_pid = 0;
+
+    while ((opt = getopt(argc, argv, "h:p:c:t:b:r:s:n:d:P:")) != -1) {
+        switch (opt) {
+        case 'h':
+            options->host = optarg;
+            break;
+        case 'p':
+            options->port = optarg;
+            break;
+        case 'c':
+            options->connections = strtol(optarg, &endptr, 10);
+            if (*endptr != '\0' || options->connections < 1) {
+                bail_out(EXIT_FAILURE, "Invalid number of connections '%s'", optarg);
+            }
+            break;
+        case 't':
+            options->threads = strtol(optarg, &endptr, 10);
+            if (*endptr != '\0' || options->threads < 1) {
+                bail_out(EXIT_FAILURE, "Invalid number of threads '%s'", optarg);
+            }
+            break;
+        case 'b':
+            options->batch = strtol(optarg, &endptr, 10);
+            if (*endptr != '\0' || options->batch < 1 || options->batch > MAX_BATCH) {
+                bail_out(EXIT_FAILURE, "Batch size has to be in 1-%d", MAX_BATCH);
+            }
+            break;
+        case 'r':
+            options->rate = strtod(optarg, &endptr);
+            if (*endptr != '\0' || options->rate < 0) {
+                bail_out(EXIT_FAILURE, "Invalid rate '%s'", optarg);
+            }
+            break;
+        case 's':
+            options->max_size = strtol(optarg, &endptr, 10);
+            if (*endptr != '\0' || options->max_size < 1 || options->max_size > MAX_SIZE) {
+                bail_out(EXIT_FAILURE, "Maximum size has to be in 1-%d", MAX_SIZE);
+            }
+            break;
+        case 'n':
+            options->orders = strtol(optarg, &endptr, 10);
+            if (*endptr != '\0' || options->orders < 0) {
+                bail_out(EXIT_FAILURE, "Invalid number of orders '%s'", optarg);
+            }
+            break;
+        case 'd':
+            options->duration = strtod(optarg, &endptr);
+            if (*endptr != '\0' || options->duration <= 0) {
+                bail_out(EXIT_FAILURE, "Invalid duration '%s'", optarg);
+            }
+            break;
+        case 'P':
+            options->server_pid = strtol(optarg, &endptr, 10);
+            if (*endptr != '\0' || options->server_pid < 1) {
+                bail_out(EXIT_FAILURE, "Invalid pid '%s'", optarg);
+            }
+            break;
+        default:
+            bail_out(EXIT_FAILURE, usage, progname);
+        }
+    }
+    if (argc != optind) {
+        bail_out(EXIT_FAILURE, usage, progname);
+    }
+    if (options->threads > options->connections) {
+        options->threads = options->connections;
+    }
+}
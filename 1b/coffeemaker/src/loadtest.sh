@@ -0,0 +1,37 @@
+#!/bin/sh
+# @file loadtest.sh
+# @brief Starts the server on localhost with 1, 2, 4, ... up to one worker per
+#        core, each with MACHINES machines, and runs the load generator
+#        against each of them for SECONDS. The machines get enough water and
+#        bin space for the whole run unless WATER or BIN are given.
+#        Prints orders/s, the answer mix, round trip percentiles and histogram
+#        and server CPU per order.
+#
+# usage: loadtest.sh [CONNECTIONS] [SECONDS] [BATCH] [RATE]
+
+PORT=${PORT:-4243}
+MACHINES=${MACHINES:-16}
+WATER=${WATER:-100000000}
+BIN=${BIN:-1000000}
+CONNECTIONS=${1:-1000}
+SECONDS_PER_RUN=${2:-5}
+BATCH=${3:-1}
+RATE=${4:-0}
+CORES=$(nproc)
+
+trap 'kill $server 2>/dev/null' EXIT
+
+workers=1
+while [ "$workers" -le "$CORES" ]; do
+    ./server -p "$PORT" -w "$workers" -m "$MACHINES" -l "$WATER" -c "$BIN" -v error >/dev/null 2>&1 &
+    server=$!
+    sleep 0.2
+
+    echo "=== $workers worker(s), $MACHINES machines, $CONNECTIONS connections, batch $BATCH, rate $RATE ==="
+    ./loadgen -p "$PORT" -c "$CONNECTIONS" -t "$CORES" -b "$BATCH" -r "$RATE" -d "$SECONDS_PER_RUN" \
+        -P "$server"
+
+    kill -INT "$server"
+    wait "$server" 2>/dev/null
+    workers=$(( workers * 2 ))
+done
@@ -0,0 +1,213 @@
+/**
+ * @file log.c
+ * @date 2017-05-10
+ *
+ * @brief Asynchronous logging, see log.h.
+ *
+ *        The ring is a bounded multi-producer, single-consumer queue: every
+ *        slot carries a sequence number. A producer claims the slot at `head`
+ *        with a compare-and-swap when its sequence equals the position, fills
+ *        it and publishes it by setting the sequence to position + 1. The
+ *        flusher consumes slots in order and hands them back for the next
+ *        round by setting the sequence to position + LOG_SLOTS.
+ **/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <strings.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "log.h"
+
+#define LOG_MASK (LOG_SLOTS - 1)
+
+/* @brief A line in the ring */
+struct slot {
+    size_t seq;             /* < position + 1 when filled, position + LOG_SLOTS when free */
+    enum log_level level;
+    char text[LOG_LINE];
+};
+
+enum log_level log_level = LVL_INFO;
+
+static const char *name = "";
+static struct slot ring[LOG_SLOTS];
+static size_t head = 0;         /* < next position claimed by a producer */
+static size_t tail = 0;         /* < next position written by the flusher */
+static unsigned long dropped = 0;
+static bool running = false;
+static int stopping = 0;
+static pthread_t flusher;
+
+static const char *level_names[] = {"error", "warn", "info", "debug"};
+
+/**
+ * @brief Body of the flusher thread: writes published lines until log_stop.
+ * @param arg unused
+ */
+static void *flush_loop(void *arg);
+
+/**
+ * @brief Writes all published lines and flushes the streams.
+ * @return number of lines written
+ */
+static int drain(void);
+
+/**
+ * @brief Formats a line into a buffer, truncated to LOG_LINE bytes.
+ */
+static void format_line(char *text, const char *fmt, va_list ap);
+
+int log_parse_level(const char *level_name, enum log_level *level)
+{
+    for (int i = 0; i <= LVL_DEBUG; i++) {
+        if (strcasecmp(level_name, level_names[i]) == 0) {
+            *level = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int log_start(const char *progname)
+{
+    sigset_t all, old;
+    int res;
+
+    name = progname;
+    for (size_t i = 0; i < LOG_SLOTS; i++) {
+        ring[i].seq = i;
+    }
+    head = tail = 0;
+    stopping = 0;
+    (void) sigfillset(&all);
+    (void) pthread_sigmask(SIG_BLOCK, &all, &old);
+    res = pthread_create(&flusher, NULL, flush_loop, NULL);
+    (void) pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (res == 0) {
+        running = true;
+    }
+    return res;
+}
+
+void log_stop(void)
+{
+    if (!running || pthread_equal(pthread_self(), flusher)) {
+        return;
+    }
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    (void) pthread_join(flusher, NULL);
+    running = false;
+    if (dropped > 0) {
+        (void) fprintf(stderr, "[%s] %lu log messages dropped.\n", name, dropped);
+        dropped = 0;
+    }
+}
+
+void log_msg(enum log_level level, const char *fmt, ...)
+{
+    va_list ap;
+    size_t pos;
+    struct slot *s;
+
+    if (level > log_level) {
+        return;
+    }
+    if (!running) {
+        char text[LOG_LINE];
+
+        va_start(ap, fmt);
+        format_line(text, fmt, ap);
+        va_end(ap);
+        (void) fputs(text, level <= LVL_WARN ? stderr : stdout);
+        return;
+    }
+
+    pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    for (;;) {
+        s = &ring[pos & LOG_MASK];
+        size_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        long diff = (long) (seq - pos);
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&head, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            /* full: the flusher has not written this slot of the last round yet */
+            __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+            return;
+        } else {
+            pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+        }
+    }
+    s->level = level;
+    va_start(ap, fmt);
+    format_line(s->text, fmt, ap);
+    va_end(ap);
+    __atomic_store_n(&s->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+static void *flush_loop(void *arg)
+{
+    const struct timespec pause = {0, LOG_FLUSH_MS * 1000000L};
+
+    for (;;) {
+        /* read the flag first, lines published before log_stop are drained below */
+        int stop = __atomic_load_n(&stopping, __ATOMIC_ACQUIRE);
+
+        if (drain() == 0 && stop) {
+            return NULL;
+        }
+        (void) nanosleep(&pause, NULL);
+    }
+}
+
+static int drain(void)
+{
+    bool out = false, err = false;
+    int n = 0;
+
+    for (;;) {
+        struct slot *s = &ring[tail & LOG_MASK];
+
+        if (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) != tail + 1) {
+            break;
+        }
+        if (s->level <= LVL_WARN) {
+            (void) fputs(s->text, stderr);
+            err = true;
+        } else {
+            (void) fputs(s->text, stdout);
+            out = true;
+        }
+        __atomic_store_n(&s->seq, tail + LOG_SLOTS, __ATOMIC_RELEASE);
+        tail++;
+        n++;
+    }
+    if (out) {
+        (void) fflush(stdout);
+    }
+    if (err) {
+        (void) fflush(stderr);
+    }
+    return n;
+}
+
+static void format_line(char *text, const char *fmt, va_list ap)
+{
+    size_t len;
+
+    /* leave room for the newline */
+    (void) snprintf(text, LOG_LINE - 1, "[%s] ", name);
+    len = strlen(text);
+    (void) vsnprintf(text + len, LOG_LINE - 1 - len, fmt, ap);
+    len = strlen(text);
+    text[len] = '\n';
+    text[len + 1] = '\0';
+}
@@ -0,0 +1,65 @@
+/**
+ * @file log.h
+ * @date 2017-05-10
+ *
+ * @brief Asynchronous logging of the coffeemaker server.
+ *
+ *        log_msg() formats a line into a slot of a lock-free ring buffer and
+ *        returns; it never blocks on stdout. A flusher thread started by
+ *        log_start() writes the lines in batches, messages of LVL_WARN and
+ *        below to stderr, the others to stdout. When the ring is full,
+ *        messages are dropped and counted instead of stalling the server.
+ *        Before log_start() and after log_stop() lines are written directly.
+ **/
+#ifndef LOG_H
+#define LOG_H
+
+/* Number of slots in the ring, a power of two */
+#define LOG_SLOTS (4096)
+
+/* Maximum length of a line including the program name */
+#define LOG_LINE (160)
+
+/* Milliseconds the flusher sleeps when the ring is empty */
+#define LOG_FLUSH_MS (10)
+
+/* @brief Log levels, a message is logged if its level is at most log_level */
+enum log_level {
+    LVL_ERROR,
+    LVL_WARN,
+    LVL_INFO,
+    LVL_DEBUG
+};
+
+/* @brief Current log level, LVL_INFO by default */
+extern enum log_level log_level;
+
+/**
+ * @brief Parses a log level.
+ * @param name error, warn, info or debug
+ * @param level where the level is stored
+ * @return 0 on success, -1 for an unknown name
+ */
+int log_parse_level(const char *name, enum log_level *level);
+
+/**
+ * @brief Starts the flusher thread. All signals are blocked in the thread.
+ * @param progname prefix of every line
+ * @return 0 on success, else an error number of pthread_create
+ */
+int log_start(const char *progname);
+
+/**
+ * @brief Writes all pending lines and stops the flusher thread. Reports the
+ *        number of dropped messages, if any. Does nothing if it is not running.
+ */
+void log_stop(void);
+
+/**
+ * @brief Logs a line "[progname] message". Safe to call from any thread.
+ * @param level level of the message
+ * @param fmt format string, without the trailing newline
+ */
+void log_msg(enum log_level level, const char *fmt, ...);
+
+#endif /* LOG_H */
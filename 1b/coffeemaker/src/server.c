@@ -3,8 +3,16 @@
  * @author Aaron Duxler 1427540 <e1427540@student.tuwien.ac.at>
  * @date 24.03.2017
  *
- * @brief This Program reads the clients coffee request, prints the list of coffees in the queue and answers the client.
+ * @brief This Program reads the clients coffee request, logs it and answers the client. SIGUSR1 logs the list of coffees in the queue.
             The answer is either the time it will take to produce its  coffee request por an error and it's cause (no_water, full_bin, no_water_and_full_bin).
+            With -m the server runs several machines behind one port, each order goes to the machine which finishes it first.
+            With -w the machines are split into one shard per worker and an order only goes to a machine of the shard of the
+            worker which reads it, even when another shard would finish it earlier. With -w equal to -m every worker has a
+            single machine and orders are not routed at all, so use fewer workers than machines when routing matters.
+            With -s the machines live in a memory mapped state file, so a restarted server continues with their water, bins and queues.
+            Admission control answers busy instead of queueing an order when its machine has -q coffees in production, when the
+            coffee would be ready later than -d s or when the client sent more than -r orders/s. SIGUSR1 and shutdown log the rejections.
+            Counters and histograms are published in the shared memory object /coffeemaker.PORT, metricstat prints them.
  **/
 #include <unistd.h>
 #include <stdlib.h>
@@ -12,7 +20,11 @@
 #include <getopt.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <netdb.h>
+#include <netinet/in.h>
 #include <signal.h>
 #include <string.h>
 #include <stdarg.h>
@@ -20,47 +32,218 @@
 #include <errno.h>
 #include <time.h>
 #include <stdbool.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "coffee.h"
+#include "log.h"
+#include "flavours.h"
+#include "metrics.h"
+#include "sockio.h"
 
 /* Length of an array */
 #define COUNT_OF(x) (sizeof(x)/sizeof(x[0]))
-#define BUFFER_BYTES (2)
-#define READ_BYTES (2)
-#define BACKLOG (5)
+#define BACKLOG (128)
+/* Maximum number of events handled per epoll_wait */
+#define MAX_EVENTS (64)
+/* Receive buffer of a connection, holds several full frames, and its send
+   buffer for the answers of several frames */
+#define RECV_BYTES (4 * (1 + MAX_BATCH * WIDE_ORDER_BYTES))
+#define SEND_BYTES (4 * MAX_BATCH)
+/* Default time in ms a client may stay idle before its connection is dropped */
+#define CONN_TIMEOUT (5000)
+/* Largest timeout of -t in ms, one day */
+#define MAX_TIMEOUT (86400000)
+/* Brewing time per ml of coffee in ms */
+#define BREW_MS_PER_ML (100)
+/* Largest waiting time in s an answer can carry, 124 to 127 are error codes */
+#define MAX_WAIT (123)
+/* Maximum number of machines and worker threads */
+#define MAX_MACHINES (1024)
+#define MAX_WORKERS (256)
+/* Milliseconds a worker thread sleeps in epoll_wait before checking `quit` */
+#define POLL_TIMEOUT (200)
+/* Minimum milliseconds between two log messages about refused connections */
+#define REFUSE_LOG_INTERVAL (1000)
+/* Identification of a state file and milliseconds between two of its syncs.
+   The magic changes whenever struct snapshot, machine or order changes. */
+#define SNAPSHOT_MAGIC "COFFEE2"
+#define SNAPSHOT_INTERVAL (1000)
+/* Clients whose order rate the server tracks, a power of two, and the slots
+   of a set, which are searched for a client before the least recently seen
+   one is replaced. Every set has its own lock. */
+#define CLIENT_SLOTS (1024)
+#define CLIENT_PROBES (8)
+#define CLIENT_SETS (CLIENT_SLOTS / CLIENT_PROBES)
 
 /* @brief Name of the program */
-static const char *progname;    
-
- /* @brief File descriptor for server socket */
-static int sockfd = -1;   
-
-/* @brief File descriptor for connection socket */
-static int connfd = -1;    
+static const char *progname;
 
 /* @brief This variable is set upon receipt of a signal */
-volatile sig_atomic_t quit = 0;     
+volatile sig_atomic_t quit = 0;
+
+/* @brief Incremented upon receipt of SIGUSR1, every worker then logs its queues */
+volatile sig_atomic_t dump = 0;
 
 /* === Type Definitions === */
 
-/* @brief struct containing info parsed by argument as well as request recieved from client */
-struct opts {  
+/* @brief struct containing info parsed by argument */
+struct opts {
     char *portno;
+    long int water;         /* < initial water of every machine */
+    long int binsize;       /* < bin size of every machine */
+    long timeout;
+    int machines;
+    int workers;            /* < threads, each routes orders to its own machines/workers machines only */
+    char *state_file;       /* < state file, NULL to keep the state in memory only */
+    long max_depth;         /* < coffees in production per machine, 0 for no limit */
+    long max_wait;          /* < predicted waiting time in ms, 0 for no limit */
+    long rate;              /* < orders per s and client, 0 for no limit */
+};
+
+/* @brief A client connection, from accept until the last answer is sent */
+struct conn {
+    int fd;
+    bool batched;                   /* < client negotiated the batch protocol */
+    bool wide;                      /* < its frames hold wide orders */
+    bool done;                      /* < close the connection once the answers are sent */
+    bool writing;                   /* < waiting for EPOLLOUT instead of EPOLLIN */
+    uint8_t peer[16];               /* < address of the client, IPv4 mapped to IPv6 */
+    long frame_start;               /* < monotonic time in us of the first byte of the oldest frame */
+    int answered;                   /* < frames whose answers are not sent yet */
+    struct sockio io;
+    uint8_t in[RECV_BYTES];         /* < received, not yet processed frames */
+    uint8_t out[SEND_BYTES];        /* < answers with parity bit, not yet sent */
+    long deadline;                  /* < monotonic time in ms when the connection is dropped */
+    struct conn *prev, *next;       /* < connections ordered by deadline */
+};
+
+/* @brief A coffee in the queue */
+struct order {
+    uint16_t size;
+    uint16_t flavourID;
+    long done;      /* < monotonic time in ms when the coffee is ready */
+};
+
+/* @brief Queue of the coffees in production, a ring buffer allocated once.
+    No more than binsize coffees can be accepted, which bounds its length.
+    The machine brews one coffee after the other, so the completion times
+    increase from the oldest to the newest coffee: the queue is the list of
+    pending completion events, the next one always at its head. */
+struct coffee_queue {
+    struct order *orders;
+    size_t capacity;
+    size_t first;   /* < index of the oldest coffee */
+    size_t count;
+};
+
+/* @brief A coffee machine with its own water, bin and queue */
+struct machine {
+    int id;
     long int water;
     long int binsize;
     int cups;
+    struct coffee_queue queue;
 };
 
-/* @brief Linkedlist node */
-struct node { 
-    uint16_t size;
-    uint8_t flavourID;
-    struct node *next;
-}typedef node_t;
+/* @brief Token bucket of a client address. A client earns `rate` orders per
+    s up to a burst of `rate` orders, an order costs 1000 tokens. */
+struct client {
+    uint8_t addr[16];
+    bool used;
+    long tokens;
+    long seen;      /* < monotonic time in ms of the last order */
+};
+
+/* @brief The buckets of the client addresses hashed to this set. Connections
+    of one client land on any worker, so all workers share the sets. */
+struct client_set {
+    pthread_mutex_t lock;
+    struct client slots[CLIENT_PROBES];
+};
 
-/* @brief head of the Linkedlist*/
-static node_t *head = NULL; 
+/* @brief Counters and histograms of every worker, see metrics.h */
+enum counter {
+    M_CONNECTIONS,
+    M_ORDERS,
+    M_COFFEES,          /* < orders answered with a waiting time */
+    M_FULL_BIN,         /* < orders refused for a full bin, with or without water */
+    M_NO_WATER,         /* < orders refused for water only */
+    M_BUSY_DEPTH,       /* < orders answered busy, by the limit they exceeded */
+    M_BUSY_WAIT,
+    M_BUSY_RATE,
+    M_PARITY,
+    M_TIMEOUTS,
+    M_COUNTERS
+};
+
+enum histogram {
+    H_LATENCY,          /* < us from the first byte of a frame until its answers are sent */
+    H_DEPTH,            /* < coffees in production on the machine an order is routed to */
+    H_HISTS
+};
+
+/* @brief A worker thread. Every worker owns its listening socket (bound with
+    SO_REUSEPORT), its epoll instance, its connections and a shard of the
+    machines, so workers share nothing but the read-only options and the
+    rate buckets of -r. */
+struct worker {
+    pthread_t thread;
+    int sockfd;
+    int epfd;
+    struct conn *conns_head, *conns_tail;   /* < open connections, the one to expire first at the head */
+    struct machine *machines;               /* < the worker's shard */
+    int nmachines;
+    sig_atomic_t dumped;                    /* < value of `dump` when the queues were logged last */
+    int spare;                              /* < reserved descriptor, given up to refuse a client
+                                                 when the descriptors run out */
+    bool paused;                            /* < listening socket not watched, no spare */
+    long refused;                           /* < clients refused since the last log message */
+    long refused_logged;                    /* < monotonic time in ms of the last log message */
+    struct metrics_thread *metrics;         /* < the worker's slot of the metrics page */
+    const struct opts *options;
+};
+
+/* @brief Layout of the state file: this header, the machines and their
+    queues, nmachines * capacity orders. The file is mapped shared and the
+    workers update the machines in place, so the state reaches the page
+    cache without a single write call and survives a crash of the server.
+    The queue pointers are set again when the file is mapped. */
+struct snapshot {
+    char magic[8];
+    int32_t nmachines;
+    int32_t capacity;       /* < orders per queue */
+    int32_t machine_size;   /* < sizeof(struct machine) and sizeof(struct order) */
+    int32_t order_size;     /* < of the server which wrote the file */
+    int64_t mono_ms;        /* < monotonic and real time of the last sync, to */
+    int64_t real_ms;        /* < convert completion times after a reboot */
+    struct machine machines[];
+};
+
+/* === Global Variables === */
+
+/* @brief All machines, every worker owns a contiguous shard */
+static struct machine *machines = NULL;
+static int nmachines = 0;
+
+/* @brief Rate buckets of all workers, CLIENT_SETS sets with -r, else NULL */
+static struct client_set *clients = NULL;
+
+/* @brief The mapped state file, NULL without -s */
+static struct snapshot *snapshot = NULL;
+static size_t snapshot_size = 0;
+
+/* @brief Names of the metrics, in the order of enum counter and enum histogram */
+static const char *const counter_names[M_COUNTERS] = {"connections", "orders", "coffees",
+    "full_bin", "no_water", "busy_depth", "busy_wait", "busy_rate", "parity_errors", "timeouts"};
+static const char *const hist_names[H_HISTS] = {"latency_us", "queue_depth"};
+
+/* @brief All workers, workers[0] runs in the main thread */
+static struct worker workers[MAX_WORKERS];
+static int nworkers = 0;
 
 /**
- * @brief Signal handler
+ * @brief Signal handler, SIGUSR1 requests a dump of the queues, the others terminate
  * @param sig Signal number catched
  */
 static void signal_handler(int sig);
@@ -74,18 +257,73 @@ static void signal_handler(int sig);
 static void bail_out(int exitcode, const char *fmt, ...);
 
 /**
- * @brief closes socket and conn to client. Calls function free_list.
+ * @brief closes the server sockets and all client connections. Calls function free_list.
  */
 static void free_resources(void);
 
 /**
-* @brief free memory allocated by the linkedlist
-* @detail global variables: sockfd, connfd
+* @brief allocates all machines with the initial water and bin size, or maps
+    them from the state file. Restored machines replace the options -m, -l
+    and -c, and the workers are limited to the restored machines. Prints the
+    initial status.
+* @param options contains the number of machines, water, binsize and state file
+* @detail global variables: machines, nmachines, snapshot
+*/
+static void init_machines(struct opts *options);
+
+/**
+* @brief allocates the rate buckets shared by all workers if -r is set.
+* @param options contains the rate
+* @detail global variable: clients
 */
-static void free_list(void);
+static void init_clients(const struct opts *options);
 
 /**
- * @brief Parse command line options and/or sets default values. Prints initial status
+* @brief maps the state file, restores its machines or creates it with new
+    machines. Completion times are converted to the current monotonic clock.
+* @param options contains the number of machines, water, binsize and state file
+* @detail global variables: machines, nmachines, snapshot, snapshot_size
+* @return true if the machines were restored, false for a new state file
+*/
+static bool map_snapshot(struct opts *options);
+
+/**
+* @brief checks a machine restored from the state file, so that a damaged
+    file cannot index beyond its queue
+* @param m the machine
+* @param capacity orders per queue of the file
+* @return true if the counters and the queue are in range
+*/
+static bool valid_machine(const struct machine *m, long capacity);
+
+/**
+* @brief records the clocks in the state file and schedules its write back
+    without waiting for it, or with wait before shutdown.
+* @param wait true to wait until the file is written
+* @detail global variables: snapshot, snapshot_size
+*/
+static void sync_snapshot(bool wait);
+
+/**
+* @brief returns the time of the real time clock in ms.
+*/
+static long real_ms(void);
+
+/**
+* @brief allocates a coffee queue.
+* @param queue the queue
+* @param capacity maximum number of coffees in the queue
+*/
+static void init_queue(struct coffee_queue *queue, long capacity);
+
+/**
+* @brief free memory allocated by a queue
+* @param queue the queue
+*/
+static void free_list(struct coffee_queue *queue);
+
+/**
+ * @brief Parse command line options and/or sets default values.
  * @param argc The argument counter
  * @param argv The argument vector
  * @param options Struct where parsed arguments are stored
@@ -94,123 +332,229 @@ static void free_list(void);
 static void parse_args(int argc, char **argv, struct opts *options);
 
 /**
- * @brief Read message from socket
- * @param sockfd_con Socket to read from
- * @param buffer Buffer where read data is stored
- * @param n Size to read
- * @return Pointer to buffer on success, else NULL
- */
-static uint8_t *read_from_client(int fd, uint8_t *buffer, size_t n);
+* @brief routes the order to a machine of the worker. Answers ANSWER_BUSY if
+    the machine exceeds the limits of the admission control. Checks if an error accured. Updates water and cups. Logs info about the cup request. Calls function schedule_coffee
+* @param size ml of coffee request
+* @param flavourID of coffee request
+* @param w the worker whose machines may take the order
+* @details global variable: progname
+* @return Returns the answer for client without parity bit. (either time or error code);
+*/
+static uint8_t create_coffee(uint16_t size, uint16_t flavourID, struct worker *w);
 
 /**
- * @brief Writes message to client
- *
- * @param sockfd_con Socket to write from
- * @param buffer Buffer where wirte data is stored
- * @param n Size to write
- * @return number of bytes written
- */
-static int write_to_client(int fd, uint8_t *buffer, size_t n);
+* @brief takes an order from the token bucket of the client, -r. Replaces the
+    least recently seen slot of the client's set for an unknown client.
+* @param w the worker serving the client
+* @param c the connection of the client
+* @param now current monotonic time in ms
+* @return true if the order is admitted, false if the client exceeds the rate
+*/
+static bool admit_rate(struct worker *w, const struct conn *c, long now);
 
 /**
-* @brief calculates the parity bit of buffer recieved from client.
-* @param block contains flavour and size 
-* @return the partity bit
+* @brief checks the limits -q and -d of the machine chosen for an order,
+    before its water, bin or queue is touched.
+* @param w the worker, counts the rejections
+* @param m the machine
+* @param size coffee request
+* @param now current monotonic time in ms
+* @return true if the order is admitted
 */
-static uint8_t calculate_parity16(uint16_t info);
+static bool admit_order(struct worker *w, const struct machine *m, uint16_t size, long now);
 
 /**
-* @brief checks if an error accured. Updates water and cups. Prints info about the cup request. Calls function push_coffe_queue
-* @param buff contains request sent by client.
-* @param machine contains info about water and cups
-* @details global variable: progname 
-* @return Returns the answer for client without parity bit. (either time or error code);
+* @brief logs the number of orders rejected by each limit.
+* @param metrics the first metrics slot
+* @param n number of slots to sum
+*/
+static void print_rejections(const struct metrics_thread *metrics, int n);
+
+/**
+* @brief picks the machine for an order: of the worker's machines with enough
+    water and room in the bin the one which would finish the coffee first. If
+    no machine can make the coffee, the one finishing first anyway, which then
+    reports the error. Machines of other workers are not considered, they are
+    not locked.
+* @param w the worker
+* @param size coffee request
+* @param now current monotonic time in ms
+* @return the machine
+*/
+static struct machine *route_order(struct worker *w, uint16_t size, long now);
+
+/**
+* @brief returns the time a machine would finish a coffee ordered now.
+* @param m the machine
+* @param size coffee request
+* @param now current monotonic time in ms
+* @return monotonic time in ms
 */
-static uint8_t create_coffee(uint8_t *buff, struct opts *machine);
+static long predict_done(const struct machine *m, uint16_t size, long now);
 
 /**
-* @brief adds and removes coffees from the linkedlist and calculates the time to prodece the clients request. Calls the function print_list
+* @brief schedules a coffee behind all coffees in production.
+* @param m the machine
 * @param size coffee request
 * @param flavourID coffee request
-* @param arr contains the names of all flavours
-* @param water_bin_status if true coffee is pushed to the queue
-* @details global variables: progname, head 
-* @return Returns the time to produce the clients request
+* @param now current monotonic time in ms
+* @details global variables: progname
+* @return Returns the time in s until the coffee is ready
 */
-static int push_coffee_queue(uint16_t size, uint8_t flavourID, char *arr[], bool water_bin_status);
+static int schedule_coffee(struct machine *m, uint16_t size, uint16_t flavourID, long now);
 
 /**
-* @brief calculates the parity bit of buffer sent to client.
-* @param response contains time until coffee is produced or error information
-* @return the partity bit
+* @brief removes all coffees which are ready by now from the queue of a machine.
+* @param m the machine
+* @param now current monotonic time in ms
+* @details global variables: progname
 */
-static uint8_t calculate_parity8(uint8_t info);
+static void finish_coffees(struct machine *m, long now);
 
 /**
-* @brief creates new TCP/IP socket, set the SO_REUSEADDR
-       option for this socket, bind the socket to localhost:portno,
-       listen, and wait for new connections, which should be assigned to
-       `connfd`. Calls function 'communicate'. Terminates in case of error.
+* @brief creates new TCP/IP socket of a worker, set the SO_REUSEADDR (and with
+       several workers SO_REUSEPORT) option for this socket, bind the socket
+       to localhost:portno, listen and create the worker's epoll instance.
+       Assigns the worker its shard of machines. Terminates in case of error.
+* @param w the worker
 * @param options contains parsed arguments
+* @param id number of the worker
 */
-static void setup(struct opts *options);
+static void setup(struct worker *w, const struct opts *options, int id);
 
 /**
-* @brief accepts the connection to the client. Calls functions read_from_client. Calls function write_to_client with return value of create_coffee.
-    compares parity bits. Calls function calculate_parity8 and calculate_parity16. Closes connection to client.
-* @param options contains info parsed by argument
-* @detail global variables: progname (Program name), connfd (connection socket)
+* @brief Runs the event loop of a worker: accepts clients, processes each
+    order as soon as it is complete, finishes coffees when they are ready and
+    drops connections which exceed their timeout. Returns when a signal was caught.
+* @param arg the struct worker
+* @detail global variables: quit
 */
-static void communicate(struct opts *options);
+static void *serve(void *arg);
 
 /**
-* @brief pushes new coffee to linkedlist.
-* @param size ml of coffee request
-* @param flavourID of coffee request
-* @details global variable: head
+* @brief accepts all pending clients, in non-blocking mode.
+* @param w the worker owning the listening socket
+*/
+static void accept_clients(struct worker *w);
+
+/**
+* @brief handles accept running out of file descriptors: closes the spare
+    descriptor, accepts and closes the waiting client and reopens the spare,
+    else the level triggered listening socket wakes the worker again and
+    again. Without a spare the listening socket is not watched until
+    resume_accept gets one back. Logs at most once per REFUSE_LOG_INTERVAL.
+* @param w the worker owning the listening socket
+* @return true if a client was refused and the next one may be accepted
+*/
+static bool refuse_client(struct worker *w);
+
+/**
+* @brief watches the listening socket again after refuse_client paused it,
+    as soon as the spare descriptor can be reopened.
+* @param w the worker owning the listening socket
+*/
+static void resume_accept(struct worker *w);
+
+/**
+* @brief reads the orders of a client, processes each complete frame with
+    process_frame and sends the answers. Reads ahead as much as the socket
+    has, so a frame usually costs one recv and one send, however many arrived
+    at once. Closes the connection after a single order of the original
+    protocol, when the client closes it, or on errors.
+* @param w the worker owning the connection
+* @param c the connection
+*/
+static void handle_client(struct worker *w, struct conn *c);
+
+/**
+* @brief returns the size of the next frame of a connection: one order in the
+    original protocol, else the count byte followed by the orders.
+* @param c the connection
+* @param data the received data, starting with the frame
+* @param len number of received bytes, 0 if none
+* @return number of bytes
+*/
+static size_t frame_bytes(const struct conn *c, const uint8_t *data, size_t len);
+
+/**
+* @brief processes a complete frame: answers the batch protocol opening or
+    creates the coffees of all orders. Queues the answers for sending.
+* @param w the worker owning the connection
+* @param c the connection
+* @param frame the frame
+* @return false on a parity or framing error
+*/
+static bool process_frame(struct worker *w, struct conn *c, const uint8_t *frame);
+
+/**
+* @brief sets a new deadline for an active connection and moves it to the end of the list.
+* @param w the worker owning the connection
+* @param c the connection
+*/
+static void touch_client(struct worker *w, struct conn *c);
+
+/**
+* @brief changes the events the worker waits for on a connection.
+* @param w the worker owning the connection
+* @param c the connection
+* @param events EPOLLIN or EPOLLOUT
+* @return 0 on success, -1 on errors
+*/
+static int watch_client(struct worker *w, struct conn *c, uint32_t events);
+
+/**
+* @brief removes a connection from the worker's list of open connections and closes it.
+* @param w the worker owning the connection
+* @param c the connection
+*/
+static void close_client(struct worker *w, struct conn *c);
+
+/**
+* @brief returns the time of the monotonic clock in ms.
 */
-static void push(uint16_t size, uint8_t flavourID);
+static long now_ms(void);
 
 /**
-* @brief pops the first coffee (head) from the list and returns its size
-* @details global variable: head
-* @return size of head
+* @brief returns the time of the monotonic clock in us.
 */
-static int pop(void);
+static long now_us(void);
 
-/*
-* @brief returns head->size ml
-* @details global variable: head
-* @return head->size
+/**
+* @brief appends a new coffee to a queue in O(1).
+* @param queue the queue
+* @param size ml of coffee request
+* @param flavourID of coffee request
+* @param done monotonic time in ms when the coffee is ready
 */
-static int peak(void);
+static void push(struct coffee_queue *queue, uint16_t size, uint16_t flavourID, long done);
 
 /**
-* @brief returns size sum of all cups in the linkedlist
-* @details global variable: head
-* @return Returns size sum of all cups in the linkedlist
+* @brief removes the oldest coffee from a queue and returns its size
+* @param queue the queue
+* @return size of the oldest coffee, -1 if the queue is empty
 */
-static int sum_list(void);
+static int pop(struct coffee_queue *queue);
 
 /**
-* @brief prints a message on stdout if linkedlist is empty, else prints all elements in the linked list (size, id, flavour).
-* @param arr contains the names of all coffee flavours to match the ID
-* @detail global variables: head, progname
+* @brief logs the status of a machine and all elements in its queue (size, id, flavour).
+    Called on SIGUSR1 only, the dump takes time linear in the length of the queue.
+* @param m the machine
+* @detail global variables: progname
 */
-static void print_list(char *arr[]);
+static void print_list(const struct machine *m);
 
 /**
 *Program entry point
-*@brief saves program name, sets up signal handler, calls function parse_args, setup, free_resources.
+*@brief saves program name, sets up signal handler, calls function parse_args, setup, serve, free_resources.
 *@param argc The argument counter
 *@param argv The argument vector
 *@details global variables: progname
 *@return Returns EXIT_SUCCESS
 */
-int main(int argc, char *argv[]){   
+int main(int argc, char *argv[]){
     progname = argv[0];
 /* setup signal handlers */
-    const int signals[] = {SIGINT, SIGTERM};
+    const int signals[] = {SIGINT, SIGTERM, SIGUSR1};
     struct sigaction s;
 
     s.sa_handler = signal_handler;
@@ -225,237 +569,715 @@ int main(int argc, char *argv[]){
             exit(EXIT_FAILURE);
         }
     }
+    if((errno = log_start(progname)) != 0){
+        bail_out(EXIT_FAILURE, "log_start");
+    }
     struct opts options;
     parse_args(argc, argv, &options);
-    setup(&options);  
+    init_machines(&options);
+    init_clients(&options);
+    for(int i = 0; i < options.workers; i++){
+        setup(&workers[i], &options, i);
+        nworkers++;
+    }
+    /* only once the port is ours, the page may belong to a running server */
+    char metrics_name[64];
+    (void)snprintf(metrics_name, sizeof(metrics_name), "/coffeemaker.%s", options.portno);
+    struct metrics_thread *metrics = metrics_open(metrics_name, options.workers,
+        counter_names, M_COUNTERS, hist_names, H_HISTS);
+    if(metrics == NULL){
+        bail_out(EXIT_FAILURE, "metrics_open");
+    }
+    for(int i = 0; i < nworkers; i++){
+        workers[i].metrics = &metrics[i];
+    }
+
+    /* only the main thread handles signals, the other workers poll `quit` */
+    sigset_t blocked, old;
+    (void)sigemptyset(&blocked);
+    (void)sigaddset(&blocked, SIGINT);
+    (void)sigaddset(&blocked, SIGTERM);
+    (void)sigaddset(&blocked, SIGUSR1);
+    (void)pthread_sigmask(SIG_BLOCK, &blocked, &old);
+    for(int i = 1; i < nworkers; i++){
+        errno = pthread_create(&workers[i].thread, NULL, serve, &workers[i]);
+        if(errno != 0){
+            bail_out(EXIT_FAILURE, "pthread_create");
+        }
+    }
+    (void)pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    log_msg(LVL_INFO, "Waiting for clients ...");
+    (void)serve(&workers[0]);
+    for(int i = 1; i < nworkers; i++){
+        (void)pthread_join(workers[i].thread, NULL);
+    }
+    print_rejections(workers[0].metrics, nworkers);
     free_resources();
     printf("test\n");
     return EXIT_SUCCESS;
 }
 
-static void setup(struct opts *options){
+static void setup(struct worker *w, const struct opts *options, int id){
 
     struct addrinfo hints;
-    struct addrinfo *ai;
+    struct addrinfo *ai, *addrs;
+    struct epoll_event ev;
     int res;
     int reuse = 1;
+    int v6only = 0;
+
+    w->sockfd = -1;
+    w->epfd = -1;
+    w->conns_head = w->conns_tail = NULL;
+    w->dumped = 0;
+    w->options = options;
+    w->paused = false;
+    w->refused = 0;
+    w->refused_logged = 0;
+    if((w->spare = open("/dev/null", O_RDONLY)) < 0){
+        bail_out(EXIT_FAILURE, "open /dev/null");
+    }
+    /* contiguous shards, their sizes differ by at most one */
+    w->machines = &machines[(long)id * nmachines / options->workers];
+    w->nmachines = (long)(id + 1) * nmachines / options->workers - (long)id * nmachines / options->workers;
+
     (void)memset (&hints , 0, sizeof (hints));
-    hints.ai_family = AF_INET6;
+    hints.ai_family = AF_UNSPEC;
     hints.ai_socktype = SOCK_STREAM;
     hints.ai_flags = AI_PASSIVE; /* <-- */
-    res = getaddrinfo (NULL, options->portno, &hints , &ai);
+    res = getaddrinfo (NULL, options->portno, &hints , &addrs);
     if(res!=0){
-        bail_out(EXIT_FAILURE, "getaddrinfo");
+        bail_out(EXIT_FAILURE, "getaddrinfo: %s", gai_strerror(res));
     }
-    sockfd = socket (ai->ai_family , ai->ai_socktype, ai->ai_protocol);
-    if(sockfd==-1){
-        bail_out(EXIT_FAILURE, "socket");
+    /* a dual stack IPv6 socket serves IPv4 clients too, fall back to the
+       other addresses on hosts without IPv6 */
+    for(int pass = 0; pass < 2 && w->sockfd < 0; pass++){
+        for(ai = addrs; ai != NULL; ai = ai->ai_next){
+            if((ai->ai_family == AF_INET6) != (pass == 0)){
+                continue;
+            }
+            if((w->sockfd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) == -1){
+                continue;
+            }
+            if(ai->ai_family == AF_INET6){
+                (void)setsockopt(w->sockfd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only));
+            }
+            if((setsockopt(w->sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse))) < 0){
+                bail_out(EXIT_FAILURE, "setsockopt");
+            }
+            /* every worker binds its own socket, the kernel balances new connections */
+            if(options->workers > 1
+                && (setsockopt(w->sockfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse))) < 0){
+                bail_out(EXIT_FAILURE, "setsockopt");
+            }
+            /* Assign the address to the socket */
+            if(bind(w->sockfd, ai->ai_addr, ai->ai_addrlen) == 0){
+                break;
+            }
+            (void)close(w->sockfd);
+            w->sockfd = -1;
+        }
+    }
+    freeaddrinfo (addrs);
+    if(w->sockfd==-1){
+        bail_out(EXIT_FAILURE, "bind");
     }
-    if((setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse))) < 0){
-        bail_out(EXIT_FAILURE, "setsockopt");
+    if((listen(w->sockfd, BACKLOG)) < 0){
+        bail_out(EXIT_FAILURE, "listen");
     }
-    /* Assign the address to the socket */
-    res = bind (sockfd, ai->ai_addr, ai->ai_addrlen);
-    if(res==-1){
-        bail_out(EXIT_FAILURE, "bind");      
+    if(fcntl(w->sockfd, F_SETFL, O_NONBLOCK) < 0){
+        bail_out(EXIT_FAILURE, "fcntl");
     }
-    if((listen(sockfd, BACKLOG)) < 0){
-        bail_out(EXIT_FAILURE, "listen");     
+    if((w->epfd = epoll_create1(0)) < 0){
+        bail_out(EXIT_FAILURE, "epoll_create1");
     }
-    freeaddrinfo (ai);
-    while(1){
-        communicate(options);
-        //printf("sleep 20\n");
-        //sleep(20);
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; /* <-- the server socket */
+    if(epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->sockfd, &ev) < 0){
+        bail_out(EXIT_FAILURE, "epoll_ctl");
     }
 }
 
-static void communicate(struct opts *options){
-    (void)printf("[%s] Waiting for client ...\n", progname);
-    if((connfd = accept(sockfd, NULL, NULL)) < 0){
-        bail_out(EXIT_FAILURE, "accept");   
-    }
-    else{
-        (void)printf("[%s] Client connected.\n", progname);
-    }
-    static uint8_t buffer[BUFFER_BYTES];
-
-    /* read from client and save to buffer */
-    if (read_from_client(connfd, &buffer[0], READ_BYTES) == NULL){
-        bail_out(EXIT_FAILURE, "read_from_client");
-    }
-    /*check parity*/
-    uint16_t block = (buffer[1]<<8) + buffer[0];
-    uint8_t parity = calculate_parity16(block);
-    if(parity!=(block>>15)){
-        bail_out(EXIT_FAILURE, "parity error");
-    }
-    
-    buffer[0] = create_coffee(buffer, options);
-    parity = calculate_parity8(buffer[0]);
-    buffer[0] |= (parity<<7);
-    if(write_to_client(connfd, &buffer[0], sizeof(buffer[0])) < 0){
-          bail_out(EXIT_FAILURE, "send");
-    }
-    (void)printf("[%s] Close connection to client.\n", progname);
-
-    close(connfd);
-}
-
-static uint8_t create_coffee(uint8_t *buffer, struct opts *machine){
-    static char *arr[] = {"Decaffeinato", "Kazaar", "Volluto", "Ciocattino",
-     "Vanilio", "Linizio Lungo", "Vivalto Lungo","Fortissio Lungo",
-     "Bukeela ka Ethiopia Lungo","Decaffeinato Lungo", "Cosi", "Capriccio", "Livanto",
-     "Roma", "Arpeggio", "Ristretto", "Dharkan", "Dulsao do Brasil", "Rosabaya de Colombia",
-     "Indrya from India", "Decaffeinato Intenso", "Caramelito", "Cauca", "Santander", "Cubania", 
-     "Selection Vintage", "Sachertorte", "Linzer Torte", "Apfelstrudel", "SULUJA ti South Sudan", 
-     "CAFECITO de Cuba", "Cafezinho do Brazil"};
-    uint8_t flavourID = buffer[0]<<3;
-    flavourID = flavourID>>3;
-    uint8_t temp_no_parity = buffer[1]<<1;
-    buffer[1] = temp_no_parity>>1;
-    uint16_t size = ((buffer[0]>>5) + (buffer[1]<<3));
-    buffer[0] = 0x0;
-    if(machine->cups <= machine->binsize){
-        ++machine->cups;
+static void *serve(void *arg){
+    struct worker *w = arg;
+    struct epoll_event events[MAX_EVENTS];
+
+    long next_sync = now_ms() + SNAPSHOT_INTERVAL;
+
+    while(!quit){
+        int timeout = -1;
+        int n;
+
+        long now = now_ms();
+        long next = -1;
+
+        if(w->paused){
+            resume_accept(w);
+        }
+
+        /* the main thread syncs the state file, the write back runs in the kernel */
+        if(snapshot != NULL && w == &workers[0] && now >= next_sync){
+            sync_snapshot(false);
+            next_sync = now + SNAPSHOT_INTERVAL;
+        }
+
+        /* the lists are ordered by deadline and completion time, only their heads can expire next */
+        if(w->conns_head != NULL){
+            next = w->conns_head->deadline;
+        }
+        for(int i = 0; i < w->nmachines; i++){
+            const struct coffee_queue *q = &w->machines[i].queue;
+            if(q->count > 0 && (next < 0 || q->orders[q->first].done < next)){
+                next = q->orders[q->first].done;
+            }
+        }
+        /* wake up for the next sync even without any orders */
+        if(snapshot != NULL && w == &workers[0] && (next < 0 || next_sync < next)){
+            next = next_sync;
+        }
+        if(next >= 0){
+            timeout = next > now ? next - now : 0;
+        }
+        /* signals only interrupt the main thread, a paused worker retries to accept */
+        if((w != &workers[0] || w->paused) && (timeout < 0 || timeout > POLL_TIMEOUT)){
+            timeout = POLL_TIMEOUT;
+        }
+        if((n = epoll_wait(w->epfd, events, MAX_EVENTS, timeout)) < 0){
+            if(errno != EINTR){
+                bail_out(EXIT_FAILURE, "epoll_wait");
+            }
+            n = 0; /* <-- a signal, check `quit` and `dump` */
+        }
+        for(int i = 0; i < n; i++){
+            if(events[i].data.ptr == NULL){
+                accept_clients(w);
+            }
+            else{
+                handle_client(w, events[i].data.ptr);
+            }
+        }
+        now = now_ms();
+        for(int i = 0; i < w->nmachines; i++){
+            finish_coffees(&w->machines[i], now);
+        }
+        while(w->conns_head != NULL && w->conns_head->deadline <= now){
+            log_msg(LVL_WARN, "Client timed out.");
+            metrics_add(w->metrics, M_TIMEOUTS, 1);
+            close_client(w, w->conns_head);
+        }
+        if(w->dumped != dump){
+            w->dumped = dump;
+            for(int i = 0; i < w->nmachines; i++){
+                print_list(&w->machines[i]);
+            }
+            print_rejections(w->metrics, 1);
+        }
     }
-    if(machine->binsize < machine->cups){
-        buffer[0] = 1;
-        for(int i = 6; i>1; --i){
-            buffer[0] |= (1<<i);
+    return NULL;
+}
+
+static void accept_clients(struct worker *w){
+    for(;;){
+        struct epoll_event ev;
+        struct conn *c;
+        struct sockaddr_storage addr;
+        socklen_t addrlen = sizeof(addr);
+        int fd = accept(w->sockfd, (struct sockaddr *)&addr, &addrlen);
+
+        if(fd < 0){
+            if(errno == EINTR || errno == ECONNABORTED){
+                continue;
+            }
+            if(errno == EMFILE || errno == ENFILE){
+                if(refuse_client(w)){
+                    continue;
+                }
+                return;
+            }
+            if(errno != EAGAIN && errno != EWOULDBLOCK){
+                log_msg(LVL_ERROR, "accept: %s", strerror(errno));
+            }
+            return;
+        }
+        if(fcntl(fd, F_SETFL, O_NONBLOCK) < 0 || (c = calloc(1, sizeof(*c))) == NULL){
+            (void)close(fd);
+            continue;
+        }
+        c->fd = fd;
+        sockio_init(&c->io, fd, c->in, sizeof(c->in), c->out, sizeof(c->out));
+        if(addr.ss_family == AF_INET6){
+            (void)memcpy(c->peer, &((struct sockaddr_in6 *)&addr)->sin6_addr, sizeof(c->peer));
+        }
+        else if(addr.ss_family == AF_INET){
+            c->peer[10] = c->peer[11] = 0xff;
+            (void)memcpy(c->peer + 12, &((struct sockaddr_in *)&addr)->sin_addr, 4);
+        }
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        if(epoll_ctl(w->epfd, EPOLL_CTL_ADD, fd, &ev) < 0){
+            (void)close(fd);
+            free(c);
+            continue;
+        }
+        /* every connection gets the same timeout, so appending keeps the order */
+        c->deadline = now_ms() + w->options->timeout;
+        c->prev = w->conns_tail;
+        if(w->conns_tail != NULL){
+            w->conns_tail->next = c;
+        }
+        else{
+            w->conns_head = c;
         }
+        w->conns_tail = c;
+        log_msg(LVL_INFO, "Client connected.");
+        metrics_add(w->metrics, M_CONNECTIONS, 1);
     }
-    if(machine->water < size){
-        buffer[0] += 2;
-        for(int i = 6; i>1; --i){
-            buffer[0] |= (1<<i);
+}
+
+static bool refuse_client(struct worker *w){
+    struct epoll_event ev;
+    long now = now_ms();
+    bool refused = false;
+    int fd;
+
+    if(w->spare >= 0){
+        (void)close(w->spare);
+        if((fd = accept(w->sockfd, NULL, NULL)) >= 0){
+            (void)close(fd);
+            w->refused++;
+            refused = true;
         }
+        w->spare = open("/dev/null", O_RDONLY);
     }
-    if(buffer[0] > 124){
-        (void)push_coffee_queue(size, flavourID, arr, false);
+    if(!refused && w->spare < 0){
+        /* another thread took the descriptor, wait for it to come back */
+        ev.events = 0;
+        ev.data.ptr = NULL;
+        if(epoll_ctl(w->epfd, EPOLL_CTL_MOD, w->sockfd, &ev) == 0){
+            w->paused = true;
+        }
     }
-    if(buffer[0] == 125){
-        (void)fprintf(stderr, "[%s] Error - full_bin.\n", progname);
+    if(w->refused > 0 && now - w->refused_logged >= REFUSE_LOG_INTERVAL){
+        log_msg(LVL_ERROR, "accept: out of file descriptors, refused %ld clients.", w->refused);
+        w->refused = 0;
+        w->refused_logged = now;
     }
-    else if(buffer[0] == 126){
-        (void)fprintf(stderr, "[%s] Error - no_water.\n", progname);
+    return refused;
+}
+
+static void resume_accept(struct worker *w){
+    struct epoll_event ev;
+
+    if(w->spare < 0 && (w->spare = open("/dev/null", O_RDONLY)) < 0){
+        return;
     }
-    else if(buffer[0] == 127){
-        (void)fprintf(stderr, "[%s] Error - no_water_and_full_bin.\n", progname);
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if(epoll_ctl(w->epfd, EPOLL_CTL_MOD, w->sockfd, &ev) == 0){
+        w->paused = false;
     }
-    else{
-        machine->water-=size;
-        (void)printf("[%s] New status: %ldml, %d cups bin.\n", progname, machine->water, machine->cups);
-        int all_time = push_coffee_queue(size, flavourID, arr, true);
-        (void)printf("[%s] Finish in %ds.\n", progname, all_time);
-        (void)printf("[%s] Start coffee for %dml cup with flavour '%s'.\n", progname, size, arr[flavourID]);
-        buffer[0] = all_time;
+}
+
+static void handle_client(struct worker *w, struct conn *c){
+    bool drained = false;
+
+    for(;;){
+        /* answers first, they go out in the order of the requests */
+        int res = sockio_flush(&c->io);
+        if(res == SOCKIO_AGAIN){
+            /* socket buffer full, wait until the client reads */
+            if(c->writing || watch_client(w, c, EPOLLOUT) == 0){
+                c->writing = true;
+                return;
+            }
+        }
+        if(res < 0){
+            log_msg(LVL_ERROR, "send: %s", strerror(errno));
+            close_client(w, c);
+            return;
+        }
+        if(c->answered > 0){
+            long latency = now_us() - c->frame_start;
+            for(; c->answered > 0; c->answered--){
+                metrics_observe(w->metrics, H_LATENCY, latency);
+            }
+        }
+        if(c->done){
+            log_msg(LVL_INFO, "Close connection to client.");
+            close_client(w, c);
+            return;
+        }
+        if(c->writing){
+            if(watch_client(w, c, EPOLLIN) < 0){
+                close_client(w, c);
+                return;
+            }
+            c->writing = false;
+        }
+
+        /* all complete frames whose answers fit into the send buffer */
+        size_t len = sockio_buffered(&c->io);
+        size_t need = frame_bytes(c, sockio_data(&c->io), len);
+        while(len >= need && !c->done && sockio_pending(&c->io) + MAX_BATCH <= SEND_BYTES){
+            if(!process_frame(w, c, sockio_data(&c->io))){
+                close_client(w, c);
+                return;
+            }
+            sockio_consume(&c->io, need);
+            c->answered++;
+            len = sockio_buffered(&c->io);
+            need = frame_bytes(c, sockio_data(&c->io), len);
+        }
+        if(c->answered > 0){
+            continue;
+        }
+        if(drained){
+            return; /* <-- rest of the frame not there yet, epoll reports it */
+        }
+
+        size_t room = sizeof(c->in) - len;
+        ssize_t r = sockio_fill(&c->io);
+        if(r == SOCKIO_AGAIN){
+            return;
+        }
+        if(r <= 0){
+            /* the end of a batch connection, else the client gave up */
+            if(r == 0 && c->batched && len == 0){
+                log_msg(LVL_INFO, "Close connection to client.");
+            }
+            close_client(w, c);
+            return;
+        }
+        if(len == 0){
+            c->frame_start = now_us();
+        }
+        /* a short read emptied the socket, save the recv which would fail */
+        drained = (size_t)r < room;
+        touch_client(w, c);
     }
-    return buffer[0];
 }
 
-static int push_coffee_queue(uint16_t size, uint8_t flavourID, char *arr[], bool water_bin_status){
-    static time_t start = 0, end = 0;
-    if(water_bin_status){
-        push(size, flavourID);
+static size_t frame_bytes(const struct conn *c, const uint8_t *data, size_t len){
+    if(!c->batched){
+        return ORDER_BYTES;
     }
-    static int all_time = 0;
-    if(time(&end)==-1){
-        bail_out(EXIT_FAILURE, "Error time() call end failed");
+    if(len == 0 || data[0] > MAX_BATCH){
+        return 1; /* <-- an invalid count is rejected by process_frame */
     }
-    if(all_time!=0){
-        all_time -= difftime (end,start);
-        if(all_time<0){
-        all_time = 0;
+    return 1 + data[0] * (c->wide ? WIDE_ORDER_BYTES : ORDER_BYTES);
+}
+
+static bool process_frame(struct worker *w, struct conn *c, const uint8_t *frame){
+    const uint8_t *orders = frame;
+    uint8_t answers[MAX_BATCH];
+    int nanswers = 0;
+    int count = 1;
+
+    if(c->batched){
+        count = frame[0];
+        orders = frame + 1;
+        if(count < 1 || count > MAX_BATCH){
+            log_msg(LVL_WARN, "Invalid frame of %d orders, dropping client.", count);
+            return false;
         }
     }
-    if(time(&start)==-1){
-        bail_out(EXIT_FAILURE, "Error time() call start failed");
+    else if(codec_get(orders, ORDER_BYTES) == PROTO_HELLO
+            || codec_get(orders, ORDER_BYTES) == PROTO_HELLO_WIDE){
+        c->batched = true;
+        c->wide = codec_get(orders, ORDER_BYTES) == PROTO_HELLO_WIDE;
+        answers[0] = PROTO_ACK;
+        answers[1] = MAX_BATCH;
+        return sockio_write(&c->io, answers, 2) == 0;
     }
-    if(water_bin_status){
-        if(all_time<=0){
-             all_time = size/10;
+    else{
+        /* the original protocol: one order per connection */
+        c->done = true;
+    }
+    for(int i = 0; i < count; i++){
+        uint16_t size;
+        uint16_t flavourID;
+        int res;
+        if(c->wide){
+            res = coffee_decode_wide_order(codec_get(orders + i * WIDE_ORDER_BYTES, WIDE_ORDER_BYTES), &size, &flavourID);
         }
         else{
-          all_time += size/10;
+            uint8_t narrowID;
+            res = coffee_decode_order(codec_get(orders + i * ORDER_BYTES, ORDER_BYTES), &size, &narrowID);
+            flavourID = narrowID;
+        }
+        if(res < 0){
+            log_msg(LVL_WARN, "Parity error, dropping client.");
+            metrics_add(w->metrics, M_PARITY, 1);
+            return false;
         }
-        if(all_time != size/10){
-          (void)printf("[%s] Another coffee still in production.\n", progname);
+        if(flavourID >= FLAVOUR_COUNT){
+            log_msg(LVL_WARN, "Unknown flavour %d, dropping client.", flavourID);
+            return false;
         }
+        metrics_add(w->metrics, M_ORDERS, 1);
+        if(clients != NULL && !admit_rate(w, c, now_ms())){
+            metrics_add(w->metrics, M_BUSY_RATE, 1);
+            log_msg(LVL_DEBUG, "Busy - client exceeds %ld orders/s.", w->options->rate);
+            answers[nanswers++] = coffee_encode_answer(ANSWER_BUSY);
+            continue;
+        }
+        answers[nanswers++] = coffee_encode_answer(create_coffee(size, flavourID, w));
+    }
+    return sockio_write(&c->io, answers, nanswers) == 0;
+}
+
+static void touch_client(struct worker *w, struct conn *c){
+    c->deadline = now_ms() + w->options->timeout;
+    if(c->next == NULL){
+        return;
+    }
+    /* unlink and append, the list stays ordered by deadline */
+    c->next->prev = c->prev;
+    if(c->prev != NULL){
+        c->prev->next = c->next;
     }
-    int sum = (sum_list()/10);
-    while(head!=NULL && sum-(peak()/10) >= all_time){
-        sum -= (pop()/10);
+    else{
+        w->conns_head = c->next;
     }
-    print_list(arr);
-    return all_time;
+    c->prev = w->conns_tail;
+    c->next = NULL;
+    w->conns_tail->next = c;
+    w->conns_tail = c;
 }
 
-static uint8_t calculate_parity8(uint8_t info){
-  int8_t parity_calc = 0;
-  for (int i = 0; i < 7; ++i) {
-    parity_calc ^= info;
-    info >>= 0x1;
-  }
-  return parity_calc &= 0x1;
+static int watch_client(struct worker *w, struct conn *c, uint32_t events){
+    struct epoll_event ev;
+
+    ev.events = events;
+    ev.data.ptr = c;
+    return epoll_ctl(w->epfd, EPOLL_CTL_MOD, c->fd, &ev);
 }
 
+static void close_client(struct worker *w, struct conn *c){
+    if(c->prev != NULL){
+        c->prev->next = c->next;
+    }
+    else{
+        w->conns_head = c->next;
+    }
+    if(c->next != NULL){
+        c->next->prev = c->prev;
+    }
+    else{
+        w->conns_tail = c->prev;
+    }
+    /* closing removes the socket from the epoll set */
+    (void)close(c->fd);
+    free(c);
+}
 
-static uint8_t calculate_parity16(uint16_t info){
-  int8_t parity_calc = 0;
-  for (int i = 0; i < 15; ++i) {
-    parity_calc ^= info;
-    info >>= 0x1;
-  }
-  return parity_calc &= 0x1;
+static long now_ms(void){
+    struct timespec ts;
+
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
 }
 
-static uint8_t *read_from_client(int fd, uint8_t *buffer, size_t n){
-    /* loop, as packet can arrive in several partial reads */
-    size_t bytes_recv = 0;
-    do {
-        ssize_t r;
-        r = recv(fd, buffer + bytes_recv, n - bytes_recv, 0);
-        if (r <= 0) {
-            return NULL;
+static long now_us(void){
+    struct timespec ts;
+
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+static uint8_t create_coffee(uint16_t size, uint16_t flavourID, struct worker *w){
+    uint8_t answer = 0;
+    long now = now_ms();
+    struct machine *machine = route_order(w, size, now);
+    if(nmachines > 1){
+        log_msg(LVL_DEBUG, "Order for machine %d.", machine->id);
+    }
+    metrics_observe(w->metrics, H_DEPTH, machine->queue.count);
+    if(!admit_order(w, machine, size, now)){
+        return ANSWER_BUSY;
+    }
+    if(machine->cups <= machine->binsize){
+        ++machine->cups;
+    }
+    if(machine->binsize < machine->cups){
+        answer = machine->water < size ? ANSWER_NO_WATER_AND_FULL_BIN : ANSWER_FULL_BIN;
+    }
+    else if(machine->water < size){
+        answer = ANSWER_NO_WATER;
+    }
+    if(answer == ANSWER_FULL_BIN){
+        log_msg(LVL_WARN, "Error - full_bin.");
+        metrics_add(w->metrics, M_FULL_BIN, 1);
+    }
+    else if(answer == ANSWER_NO_WATER){
+        log_msg(LVL_WARN, "Error - no_water.");
+        metrics_add(w->metrics, M_NO_WATER, 1);
+    }
+    else if(answer == ANSWER_NO_WATER_AND_FULL_BIN){
+        log_msg(LVL_WARN, "Error - no_water_and_full_bin.");
+        metrics_add(w->metrics, M_FULL_BIN, 1);
+    }
+    else{
+        metrics_add(w->metrics, M_COFFEES, 1);
+        machine->water-=size;
+        log_msg(LVL_INFO, "New status: %ldml, %d cups bin.", machine->water, machine->cups);
+        int all_time = schedule_coffee(machine, size, flavourID, now);
+        log_msg(LVL_INFO, "Finish in %ds.", all_time);
+        log_msg(LVL_INFO, "Start coffee for %dml cup with flavour '%s'.", size, flavour_names[flavourID]);
+        answer = all_time;
+    }
+    return answer;
+}
+
+static bool admit_rate(struct worker *w, const struct conn *c, long now){
+    uint32_t h = 2166136261u;
+    struct client_set *set;
+    struct client *cl = NULL;
+    bool admitted = false;
+
+    for(size_t i = 0; i < sizeof(c->peer); i++){
+        h = (h ^ c->peer[i]) * 16777619u;
+    }
+    set = &clients[h & (CLIENT_SETS - 1)];
+    (void)pthread_mutex_lock(&set->lock);
+    for(int i = 0; i < CLIENT_PROBES; i++){
+        struct client *probe = &set->slots[i];
+        if(probe->used && memcmp(probe->addr, c->peer, sizeof(c->peer)) == 0){
+            cl = probe;
+            break;
+        }
+        if(cl == NULL || !probe->used || (cl->used && probe->seen < cl->seen)){
+            cl = probe;
         }
-        bytes_recv += r;
-    } while (bytes_recv < n);
+    }
+    if(!cl->used || memcmp(cl->addr, c->peer, sizeof(c->peer)) != 0){
+        /* a new client starts with a full bucket */
+        (void)memcpy(cl->addr, c->peer, sizeof(c->peer));
+        cl->used = true;
+        cl->tokens = w->options->rate * 1000;
+        cl->seen = now;
+    }
+    /* another worker may have read the clock a little later */
+    if(now > cl->seen){
+        cl->tokens += (now - cl->seen) * w->options->rate;
+        if(cl->tokens > w->options->rate * 1000){
+            cl->tokens = w->options->rate * 1000;
+        }
+        cl->seen = now;
+    }
+    if(cl->tokens >= 1000){
+        cl->tokens -= 1000;
+        admitted = true;
+    }
+    (void)pthread_mutex_unlock(&set->lock);
+    return admitted;
+}
+
+static bool admit_order(struct worker *w, const struct machine *m, uint16_t size, long now){
+    const struct opts *options = w->options;
+
+    if(options->max_depth > 0 && (long)m->queue.count >= options->max_depth){
+        metrics_add(w->metrics, M_BUSY_DEPTH, 1);
+        log_msg(LVL_DEBUG, "Busy - %zu coffees in production.", m->queue.count);
+        return false;
+    }
+    if(options->max_wait > 0 && predict_done(m, size, now) - now > options->max_wait){
+        metrics_add(w->metrics, M_BUSY_WAIT, 1);
+        log_msg(LVL_DEBUG, "Busy - coffee would take more than %lds.", options->max_wait / 1000);
+        return false;
+    }
+    return true;
+}
+
+static void print_rejections(const struct metrics_thread *metrics, int n){
+    uint64_t depth = 0, wait = 0, rate = 0;
+
+    for(int i = 0; i < n; i++){
+        depth += metrics[i].counters[M_BUSY_DEPTH];
+        wait += metrics[i].counters[M_BUSY_WAIT];
+        rate += metrics[i].counters[M_BUSY_RATE];
+    }
+    log_msg(LVL_INFO, "Rejected: %llu for queue depth, %llu for waiting time, %llu for rate.",
+            (unsigned long long)depth, (unsigned long long)wait, (unsigned long long)rate);
+}
+
+static struct machine *route_order(struct worker *w, uint16_t size, long now){
+    struct machine *best = NULL, *fallback = NULL;
+    long best_done = 0, fallback_done = 0;
 
-    if (bytes_recv < n) {
-        return NULL;
+    for(int i = 0; i < w->nmachines; i++){
+        struct machine *m = &w->machines[i];
+        long done = predict_done(m, size, now);
+
+        if(fallback == NULL || done < fallback_done){
+            fallback = m;
+            fallback_done = done;
+        }
+        if(m->cups < m->binsize && m->water >= size && (best == NULL || done < best_done)){
+            best = m;
+            best_done = done;
+        }
     }
-    return buffer;
+    return best != NULL ? best : fallback;
 }
 
-static int write_to_client(int fd, uint8_t *buffer, size_t n){
+static long predict_done(const struct machine *m, uint16_t size, long now){
+    const struct coffee_queue *q = &m->queue;
+    long start = now;
 
-	size_t bytes_sent = 0;
-	do {
-		ssize_t r;
-		r = write(fd, buffer + bytes_sent, n - bytes_sent);
-		if (r <= 0) {
-			return -1;
-		}
-		bytes_sent += r;
-	} while (bytes_sent < n);
+    if(q->count > 0){
+        long last = q->orders[(q->first + q->count - 1) % q->capacity].done;
+        if(last > now){
+            start = last;
+        }
+    }
+    return start + (long)size * BREW_MS_PER_ML;
+}
 
-	if (bytes_sent < n) {
-		return -1;
-	}
-	return bytes_sent;
+static int schedule_coffee(struct machine *m, uint16_t size, uint16_t flavourID, long now){
+    finish_coffees(m, now);
+    if(m->queue.count > 0){
+        log_msg(LVL_DEBUG, "Another coffee still in production.");
+    }
+    long done = predict_done(m, size, now);
+    push(&m->queue, size, flavourID, done);
+    /* round up, the coffee is not ready before the announced time */
+    long wait = (done - now + 999) / 1000;
+    return wait > MAX_WAIT ? MAX_WAIT : wait;
+}
+
+static void finish_coffees(struct machine *m, long now){
+    struct coffee_queue *q = &m->queue;
+    while(q->count > 0 && q->orders[q->first].done <= now){
+        struct order *o = &q->orders[q->first];
+        if(nmachines > 1){
+            log_msg(LVL_INFO, "%dml cup of coffee with flavour '%s' ready on machine %d.", o->size, flavour_names[o->flavourID], m->id);
+        }
+        else{
+            log_msg(LVL_INFO, "%dml cup of coffee with flavour '%s' ready.", o->size, flavour_names[o->flavourID]);
+        }
+        (void)pop(q);
+    }
 }
 
 static void signal_handler(int sig)
 {
-    free_resources();
-    quit = 1;
-    exit(quit);
+    if(sig == SIGUSR1){
+        dump++;
+    }
+    else{
+        quit = 1;
+    }
 }
 
 static void bail_out(int exitcode, const char *fmt, ...)
 {
     va_list ap;
+    int error = errno;
+    /* the pending log lines come first */
+    log_stop();
+    errno = error;
     if(strcmp(fmt, "")!=0 || errno!=0){
         (void) fprintf(stderr, "%s: ", progname);
     }
@@ -479,24 +1301,206 @@ static void bail_out(int exitcode, const char *fmt, ...)
 static void free_resources(void)
 {
     /* clean up resources */
-    if(connfd >= 0) {
-        (void) close(connfd);
+    for(int i = 0; i < nworkers; i++) {
+        struct worker *w = &workers[i];
+        while(w->conns_head != NULL) {
+            close_client(w, w->conns_head);
+        }
+        if(w->epfd >= 0) {
+            (void) close(w->epfd);
+        }
+        if(w->sockfd >= 0) {
+            (void) close(w->sockfd);
+        }
+        if(w->spare >= 0) {
+            (void) close(w->spare);
+        }
     }
-    if(sockfd >= 0) {
-        (void) close(sockfd);
+    if(clients != NULL) {
+        for(int i = 0; i < CLIENT_SETS; i++) {
+            (void) pthread_mutex_destroy(&clients[i].lock);
+        }
+        free(clients);
+        clients = NULL;
+    }
+    if(snapshot != NULL) {
+        sync_snapshot(true);
+        (void) munmap(snapshot, snapshot_size);
+        snapshot = NULL;
+    }
+    else {
+        for(int i = 0; i < nmachines; i++) {
+            free_list(&machines[i].queue);
+        }
+        free(machines);
+    }
+    machines = NULL;
+    nmachines = 0;
+    metrics_close();
+    log_stop();
+}
+
+static void init_machines(struct opts *options){
+    if(options->state_file != NULL && map_snapshot(options)){
+        return; /* <-- restored */
+    }
+    log_msg(LVL_INFO, "Initialstatus: %ld ml water , %ld cups bin",options->water, options->binsize);
+    if(options->machines > 1){
+        log_msg(LVL_INFO, "%d machines, %d workers.", options->machines, options->workers);
+    }
+    if(snapshot != NULL){
+        return;
+    }
+    machines = calloc(options->machines, sizeof(*machines));
+    if(machines==NULL){
+        bail_out(EXIT_FAILURE, "Error malloc machines failed");
+    }
+    nmachines = options->machines;
+    for(int i = 0; i < nmachines; i++){
+        machines[i].id = i;
+        machines[i].water = options->water;
+        machines[i].binsize = options->binsize;
+        machines[i].cups = 0;
+        init_queue(&machines[i].queue, options->binsize);
     }
-    free_list();
 }
-static void free_list(void){
-    node_t * current = head;
-    node_t * prev;
-    while (current != NULL) {
-        prev = current;
-        current = current->next;
-        free(prev);
+
+static void init_clients(const struct opts *options){
+    if(options->rate == 0){
+        return;
+    }
+    clients = calloc(CLIENT_SETS, sizeof(*clients));
+    if(clients == NULL){
+        bail_out(EXIT_FAILURE, "calloc");
+    }
+    for(int i = 0; i < CLIENT_SETS; i++){
+        if((errno = pthread_mutex_init(&clients[i].lock, NULL)) != 0){
+            bail_out(EXIT_FAILURE, "pthread_mutex_init");
+        }
     }
 }
 
+static bool map_snapshot(struct opts *options){
+    struct stat st;
+    long capacity = options->binsize < 1 ? 1 : options->binsize;
+    bool restore;
+    int fd;
+
+    if((fd = open(options->state_file, O_RDWR | O_CREAT, 0644)) < 0){
+        bail_out(EXIT_FAILURE, "open %s", options->state_file);
+    }
+    if(fstat(fd, &st) < 0){
+        bail_out(EXIT_FAILURE, "fstat %s", options->state_file);
+    }
+    restore = st.st_size > 0;
+    if(restore){
+        struct snapshot header;
+        if(pread(fd, &header, sizeof(header), 0) != sizeof(header)
+            || memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0
+            || header.machine_size != sizeof(struct machine) || header.order_size != sizeof(struct order)
+            || header.nmachines < 1 || header.nmachines > MAX_MACHINES || header.capacity < 1){
+            errno = 0;
+            bail_out(EXIT_FAILURE, "%s is not a state file", options->state_file);
+        }
+        options->machines = header.nmachines;
+        capacity = header.capacity;
+    }
+    snapshot_size = sizeof(struct snapshot) + options->machines * sizeof(struct machine)
+        + (size_t)options->machines * capacity * sizeof(struct order);
+    if(restore && st.st_size != snapshot_size){
+        errno = 0;
+        bail_out(EXIT_FAILURE, "%s has a wrong size", options->state_file);
+    }
+    if(!restore && ftruncate(fd, snapshot_size) < 0){
+        bail_out(EXIT_FAILURE, "ftruncate %s", options->state_file);
+    }
+    snapshot = mmap(NULL, snapshot_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    (void) close(fd);
+    if(snapshot == MAP_FAILED){
+        snapshot = NULL;
+        bail_out(EXIT_FAILURE, "mmap %s", options->state_file);
+    }
+
+    machines = snapshot->machines;
+    nmachines = options->machines;
+    struct order *orders = (struct order *)&machines[nmachines];
+    /* completion times in the monotonic clock of the server which wrote them */
+    long shift = (snapshot->real_ms - snapshot->mono_ms) - (real_ms() - now_ms());
+    for(int i = 0; i < nmachines; i++){
+        struct machine *m = &machines[i];
+        if(restore && !valid_machine(m, capacity)){
+            errno = 0;
+            bail_out(EXIT_FAILURE, "%s has a damaged machine %d", options->state_file, i);
+        }
+        if(!restore){
+            m->id = i;
+            m->water = options->water;
+            m->binsize = options->binsize;
+            m->cups = 0;
+            m->queue.first = m->queue.count = 0;
+        }
+        m->queue.orders = orders + i * capacity;
+        m->queue.capacity = capacity;
+        for(size_t j = 0; restore && j < m->queue.count; j++){
+            m->queue.orders[(m->queue.first + j) % capacity].done += shift;
+        }
+    }
+    if(restore){
+        log_msg(LVL_INFO, "Restored %d machines from %s.", nmachines, options->state_file);
+        for(int i = 0; i < nmachines; i++){
+            log_msg(LVL_INFO, "Machine %d: %ldml, %d cups bin, %zu coffees queued.", i,
+                machines[i].water, machines[i].cups, machines[i].queue.count);
+        }
+    }
+    else{
+        (void) memcpy(snapshot->magic, SNAPSHOT_MAGIC, sizeof(snapshot->magic));
+        snapshot->nmachines = nmachines;
+        snapshot->capacity = capacity;
+        snapshot->machine_size = sizeof(struct machine);
+        snapshot->order_size = sizeof(struct order);
+    }
+    sync_snapshot(false);
+    /* every worker owns at least one machine */
+    if(options->workers > nmachines){
+        options->workers = nmachines;
+    }
+    return restore;
+}
+
+static bool valid_machine(const struct machine *m, long capacity){
+    /* a full bin takes one more cup, see create_coffee */
+    return m->water >= 0 && m->binsize >= 0 && m->binsize <= capacity
+        && m->cups >= 0 && m->cups <= m->binsize + 1
+        && m->queue.first < (size_t)capacity && m->queue.count <= (size_t)capacity;
+}
+
+static void sync_snapshot(bool wait){
+    snapshot->mono_ms = now_ms();
+    snapshot->real_ms = real_ms();
+    (void) msync(snapshot, snapshot_size, wait ? MS_SYNC : MS_ASYNC);
+}
+
+static long real_ms(void){
+    struct timespec ts;
+
+    (void)clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+static void init_queue(struct coffee_queue *queue, long capacity){
+    queue->capacity = capacity < 1 ? 1 : capacity;
+    queue->orders = malloc(queue->capacity * sizeof(*queue->orders));
+    if(queue->orders==NULL){
+        bail_out(EXIT_FAILURE, "Error malloc queue failed");
+    }
+}
+
+static void free_list(struct coffee_queue *queue){
+    free(queue->orders);
+    queue->orders = NULL;
+    queue->count = 0;
+}
+
 static void parse_args(int argc, char *argv[], struct opts *options)
 {
     char *endptr;
@@ -504,11 +1508,17 @@ static void parse_args(int argc, char *argv[], struct opts *options)
     options->portno = "1821";
     options->water = 1000;
     options->binsize = 10;
-    options->cups = 0;
-    int pcount, lcount, ccount;
-    pcount = lcount = ccount = 0;
+    options->timeout = CONN_TIMEOUT;
+    options->machines = 1;
+    options->workers = 1;
+    options->state_file = NULL;
+    options->max_depth = 0;
+    options->max_wait = 0;
+    options->rate = 0;
+    int pcount, lcount, ccount, tcount, mcount, wcount;
+    pcount = lcount = ccount = tcount = mcount = wcount = 0;
     int argument;
-    while ((argument = getopt (argc, argv, "p:l:c:")) != -1){
+    while ((argument = getopt (argc, argv, "p:l:c:t:m:w:v:s:q:d:r:")) != -1){
         switch(argument){
             case 'p':
                 if(pcount==0){
@@ -520,7 +1530,7 @@ static void parse_args(int argc, char *argv[], struct opts *options)
                 }
                 ++pcount;
                 break;
-            case 'l': 
+            case 'l':
                  if(lcount==0){
                     options->water = strtol(optarg, &endptr, 10);
                  }
@@ -530,7 +1540,7 @@ static void parse_args(int argc, char *argv[], struct opts *options)
                   }
                   ++lcount;
                  break;
-            case 'c': 
+            case 'c':
                  if(ccount==0){
                     options->binsize = strtol(optarg, &endptr, 10);
                  }
@@ -540,75 +1550,126 @@ static void parse_args(int argc, char *argv[], struct opts *options)
                  }
                  ++ccount;
                 break;
-            case '?': 
+            case 't':
+                 if(tcount==0){
+                    options->timeout = strtol(optarg, &endptr, 10);
+                    if(*endptr != '\0' || options->timeout < 1 || options->timeout > MAX_TIMEOUT){
+                        (void)fprintf(stderr, "Timeout must be between 1 and %d ms.\n", MAX_TIMEOUT);
+                        exit(EXIT_FAILURE);
+                    }
+                 }
+                 else{
+                    (void)fprintf(stderr, "Multiple occurrences of argument -t.\n");
+                    exit(EXIT_FAILURE);
+                 }
+                 ++tcount;
+                break;
+            case 'm':
+                 if(mcount==0){
+                    options->machines = strtol(optarg, &endptr, 10);
+                    if(*endptr != '\0' || options->machines < 1 || options->machines > MAX_MACHINES){
+                        (void)fprintf(stderr, "Number of machines must be between 1 and %d.\n", MAX_MACHINES);
+                        exit(EXIT_FAILURE);
+                    }
+                 }
+                 else{
+                    (void)fprintf(stderr, "Multiple occurrences of argument -m.\n");
+                    exit(EXIT_FAILURE);
+                 }
+                 ++mcount;
+                break;
+            case 'w':
+                 if(wcount==0){
+                    options->workers = strtol(optarg, &endptr, 10);
+                    if(*endptr != '\0' || options->workers < 1 || options->workers > MAX_WORKERS){
+                        (void)fprintf(stderr, "Number of workers must be between 1 and %d.\n", MAX_WORKERS);
+                        exit(EXIT_FAILURE);
+                    }
+                 }
+                 else{
+                    (void)fprintf(stderr, "Multiple occurrences of argument -w.\n");
+                    exit(EXIT_FAILURE);
+                 }
+                 ++wcount;
+                break;
+            case 's':
+                options->state_file = optarg;
+                break;
+            case 'q':
+                options->max_depth = strtol(optarg, &endptr, 10);
+                if(*endptr != '\0' || options->max_depth < 0){
+                    (void)fprintf(stderr, "Queue depth must be at least 0.\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'd':
+                options->max_wait = strtol(optarg, &endptr, 10);
+                if(*endptr != '\0' || options->max_wait < 0 || options->max_wait > MAX_WAIT){
+                    (void)fprintf(stderr, "Waiting time must be between 0 and %d s.\n", MAX_WAIT);
+                    exit(EXIT_FAILURE);
+                }
+                options->max_wait *= 1000;
+                break;
+            case 'r':
+                options->rate = strtol(optarg, &endptr, 10);
+                if(*endptr != '\0' || options->rate < 0 || options->rate > 1000000){
+                    (void)fprintf(stderr, "Rate must be between 0 and 1000000 orders/s.\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'v':
+                if(log_parse_level(optarg, &log_level) < 0){
+                    (void)fprintf(stderr, "Log level must be error, warn, info or debug.\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case '?':
                 bail_out(EXIT_FAILURE, "");
-            default: 
+            default:
                 assert(0); //unreachable
         }
     }
-    (void)printf("[%s] Initialstatus: %ld ml water , %ld cups bin\n",progname ,options->water, options->binsize);
+    /* every worker owns at least one machine */
+    if(options->workers > options->machines){
+        options->workers = options->machines;
+    }
 }
 
-static void push(uint16_t size, uint8_t flavourID){
-    if(head==NULL){
-        head = malloc(sizeof(node_t));
-        if(head==NULL){
-            bail_out(EXIT_FAILURE, "Error malloc head failed");
-        }
-        head->size = size;
-        head->flavourID = flavourID;
-        head->next = NULL;
-    }
-    else{
-        node_t * current = head;
-        while (current->next != NULL) {
-            current = current->next;
-        }
-        /* now we can add a new variable */
-        current->next = malloc(sizeof(node_t));
-        current->next->size = size;
-        current->next->flavourID = flavourID;
-        current->next->next = NULL;
+static void push(struct coffee_queue *queue, uint16_t size, uint16_t flavourID, long done){
+    if(queue->count == queue->capacity){
+        bail_out(EXIT_FAILURE, "Error queue full");
     }
+    struct order *o = &queue->orders[(queue->first + queue->count) % queue->capacity];
+    o->size = size;
+    o->flavourID = flavourID;
+    o->done = done;
+    ++queue->count;
 }
 
-static int pop(void){
-    int size = -1;
-    node_t * next_node = NULL;
-    if (head == NULL) {
+static int pop(struct coffee_queue *queue){
+    if (queue->count == 0) {
         return -1;
     }
-    next_node = head->next;
-    size = head->size;
-    free(head);
-    head = next_node;
+    int size = queue->orders[queue->first].size;
+    queue->first = (queue->first + 1) % queue->capacity;
+    --queue->count;
     return size;
 }
 
-static int peak(void){
-    return head->size;
-}
-
-static int sum_list(void){
-    node_t * current = head;
-    int sum = 0;
-    while (current != NULL) {
-        sum += current->size;
-        current = current->next;
+static void print_list(const struct machine *m){
+    const struct coffee_queue *q = &m->queue;
+    if(nmachines > 1){
+        log_msg(LVL_INFO, "Machine %d:", m->id);
     }
-    return sum;
-}
-
-static void print_list(char *arr[]){
-    node_t * current = head;
-    if(current==NULL){
-        (void)printf("[%s] List is empty\n", progname);
+    log_msg(LVL_INFO, "Status: %ldml, %d cups bin.", m->water, m->cups);
+    if(q->count==0){
+        log_msg(LVL_INFO, "List is empty");
     }
     else{
-        (void)printf("[%s] List elements:\n", progname);
+        log_msg(LVL_INFO, "List elements:");
     }
-    while (current != NULL) {
-        (void)printf("[%s] %dml cup of coffee with flavour '%s' (id=%d).\n",progname, current->size, arr[current->flavourID], current->flavourID);
-        current = current->next;
+    for (size_t i = 0; i < q->count; ++i) {
+        const struct order *o = &q->orders[(q->first + i) % q->capacity];
+        log_msg(LVL_INFO, "%dml cup of coffee with flavour '%s' (id=%d).", o->size, flavour_names[o->flavourID], o->flavourID);
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,82 @@
+/**
+ * @file codec.h
+ * @date 2017-05-12
+ *
+ * @brief Wire format helpers shared by the mastermind and coffeemaker
+ *        programs: little endian fields and parity bits.
+ *
+ *        Both protocols send a value with a parity bit in its highest bit.
+ *        codec_parity() is branch free, the compiler turns it into a popcount
+ *        or a few xor-shifts, instead of a loop over the bits.
+ **/
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <stdint.h>
+
+/**
+ * @brief Returns the parity of a value.
+ * @param value the value
+ * @return 1 if an odd number of bits is set, else 0
+ */
+static inline unsigned int codec_parity(uint64_t value)
+{
+    return __builtin_parityll(value);
+}
+
+/**
+ * @brief Sets the parity bit of a value.
+ * @param value the value, bits from parity_bit upwards are zero
+ * @param parity_bit position of the parity bit
+ * @return the value with the parity of its lower bits at parity_bit
+ */
+static inline uint64_t codec_add_parity(uint64_t value, int parity_bit)
+{
+    return value | ((uint64_t) codec_parity(value) << parity_bit);
+}
+
+/**
+ * @brief Checks and strips the parity bit of a received value.
+ * @param wire the received value, bits above parity_bit are ignored
+ * @param parity_bit position of the parity bit
+ * @param value where the value without parity bit is stored
+ * @return 0 if the parity bit matches, -1 on a parity error
+ */
+static inline int codec_check_parity(uint64_t wire, int parity_bit, uint64_t *value)
+{
+    uint64_t mask = ((uint64_t) 1 << parity_bit) - 1;
+
+    *value = wire & mask;
+    return codec_parity(wire & (mask | (uint64_t) 1 << parity_bit)) == 0 ? 0 : -1;
+}
+
+/**
+ * @brief Stores a value little endian.
+ * @param buffer where the bytes are stored
+ * @param value the value
+ * @param count number of bytes
+ */
+static inline void codec_put(uint8_t *buffer, uint64_t value, int count)
+{
+    for (int i = 0; i < count; i++) {
+        buffer[i] = (value >> (8 * i)) & 0xff;
+    }
+}
+
+/**
+ * @brief Reads a little endian value stored by codec_put.
+ * @param buffer the received bytes
+ * @param count number of bytes
+ * @return the value
+ */
+static inline uint64_t codec_get(const uint8_t *buffer, int count)
+{
+    uint64_t value = 0;
+
+    for (int i = 0; i < count; i++) {
+        value |= (uint64_t) buffer[i] << (8 * i);
+    }
+    return value;
+}
+
+#endif /* CODEC_H */
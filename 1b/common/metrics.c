@@ -0,0 +1,137 @@
+/**
+ * @file metrics.c
+ * @date 2017-05-14
+ *
+ * @brief Shared memory page of the server metrics, see metrics.h.
+ **/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "metrics.h"
+
+/* @brief The mapped page, its size and the name of the object, "" if private */
+static struct metrics_page *page = NULL;
+static size_t page_size = 0;
+static char page_name[64] = "";
+
+/**
+ * @brief Creates and maps a new shared memory object of page_size bytes. An
+ *        object of a running server is left alone, only the page of a server
+ *        which died without metrics_close is replaced.
+ * @param name name of the object
+ * @return the mapping, NULL on errors or if the name is taken
+ */
+static struct metrics_page *map_shared(const char *name);
+
+/**
+ * @brief Checks if an existing object is the complete page of a server
+ *        which no longer runs.
+ * @param name name of the object
+ * @return true if the object can be removed
+ */
+static bool page_stale(const char *name);
+
+struct metrics_thread *metrics_open(const char *name, int nthreads,
+                                    const char *const counters[], int ncounters,
+                                    const char *const hists[], int nhists)
+{
+    page_size = sizeof(struct metrics_page) + nthreads * sizeof(struct metrics_thread);
+    if ((page = map_shared(name)) != NULL) {
+        (void) snprintf(page_name, sizeof(page_name), "%s", name);
+    } else if ((page = calloc(1, page_size)) == NULL) {
+        return NULL;
+    }
+    page->nthreads = nthreads;
+    page->ncounters = ncounters;
+    page->nhists = nhists;
+    page->pid = getpid();
+    page->started = time(NULL);
+    for (int i = 0; i < ncounters; i++) {
+        (void) snprintf(page->counter_names[i], METRICS_NAME, "%s", counters[i]);
+    }
+    for (int i = 0; i < nhists; i++) {
+        (void) snprintf(page->hist_names[i], METRICS_NAME, "%s", hists[i]);
+    }
+    /* readers check the magic last */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    (void) memcpy(page->magic, METRICS_MAGIC, sizeof(METRICS_MAGIC));
+    return page->threads;
+}
+
+void metrics_close(void)
+{
+    if (page == NULL) {
+        return;
+    }
+    if (page_name[0] != '\0') {
+        (void) munmap(page, page_size);
+        (void) shm_unlink(page_name);
+        page_name[0] = '\0';
+    } else {
+        free(page);
+    }
+    page = NULL;
+}
+
+static struct metrics_page *map_shared(const char *name)
+{
+    struct metrics_page *p;
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+
+    if (fd < 0 && errno == EEXIST && page_stale(name)) {
+        (void) shm_unlink(name);
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    }
+    if (fd < 0) {
+        return NULL;
+    }
+    if (ftruncate(fd, page_size) < 0) {
+        (void) close(fd);
+        (void) shm_unlink(name);
+        return NULL;
+    }
+    p = mmap(NULL, page_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    (void) close(fd);
+    if (p == MAP_FAILED) {
+        (void) shm_unlink(name);
+        return NULL;
+    }
+    return p;
+}
+
+static bool page_stale(const char *name)
+{
+    const struct metrics_page *p;
+    struct stat st;
+    bool stale = false;
+    int fd = shm_open(name, O_RDONLY, 0);
+
+    if (fd < 0) {
+        return false;
+    }
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(*p)) {
+        (void) close(fd);
+        return false;
+    }
+    p = mmap(NULL, sizeof(*p), PROT_READ, MAP_SHARED, fd, 0);
+    (void) close(fd);
+    if (p == MAP_FAILED) {
+        return false;
+    }
+    /* a page without magic may still be filled in by a starting server */
+    if (memcmp(p->magic, METRICS_MAGIC, sizeof(METRICS_MAGIC)) == 0
+        && kill(p->pid, 0) < 0 && errno == ESRCH) {
+        stale = true;
+    }
+    (void) munmap((void *) p, sizeof(*p));
+    return stale;
+}
@@ -0,0 +1,112 @@
+/**
+ * @file metrics.h
+ * @date 2017-05-14
+ *
+ * @brief Counters and histograms of the mastermind and coffeemaker servers,
+ *        in a POSIX shared memory object read by metricstat.
+ *
+ *        Every worker thread owns a slot of the page and is its only writer:
+ *        an update is a plain load and a relaxed atomic store, no lock and no
+ *        read-modify-write, and the slots are cache line aligned so workers
+ *        do not share lines. A reader maps the page read only and sums the
+ *        slots, the server does not notice it. Histograms count values in
+ *        power of two buckets: bucket 0 holds 0, bucket i the values from
+ *        2^(i-1) to 2^i - 1.
+ **/
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+
+/* Identification of a metrics page */
+#define METRICS_MAGIC "METRICS"
+
+/* Limits of a page */
+#define METRICS_COUNTERS (16)
+#define METRICS_HISTS (4)
+#define METRICS_BUCKETS (48)
+#define METRICS_NAME (32)
+
+/* @brief The slot of a worker thread */
+struct metrics_thread {
+    uint64_t counters[METRICS_COUNTERS];
+    uint64_t buckets[METRICS_HISTS][METRICS_BUCKETS];
+    uint64_t sums[METRICS_HISTS];           /* < sum of the observed values */
+} __attribute__((aligned(64)));
+
+/* @brief Layout of the shared memory object */
+struct metrics_page {
+    char magic[8];
+    int32_t nthreads;
+    int32_t ncounters;
+    int32_t nhists;
+    int32_t pid;                            /* < pid of the server */
+    int64_t started;                        /* < real time in s the server started */
+    char counter_names[METRICS_COUNTERS][METRICS_NAME];
+    char hist_names[METRICS_HISTS][METRICS_NAME];
+    struct metrics_thread threads[];
+};
+
+/**
+ * @brief Creates the shared memory object and names the metrics. Without
+ *        shared memory, or if the object belongs to another running server,
+ *        the metrics are kept in private memory, so the servers never have to
+ *        check the result of this call. Call it once the listening socket is
+ *        bound, so a server failing to start never touches the page of the
+ *        one serving the port.
+ * @param name name of the object, "/program.port"
+ * @param nthreads number of slots
+ * @param counters names of the counters
+ * @param ncounters number of counters, at most METRICS_COUNTERS
+ * @param hists names of the histograms
+ * @param nhists number of histograms, at most METRICS_HISTS
+ * @return the first slot, NULL if even private memory is out
+ */
+struct metrics_thread *metrics_open(const char *name, int nthreads,
+                                    const char *const counters[], int ncounters,
+                                    const char *const hists[], int nhists);
+
+/**
+ * @brief Unmaps the metrics and removes the shared memory object if
+ *        metrics_open created it.
+ */
+void metrics_close(void);
+
+/**
+ * @brief Adds to a counter of the calling thread's slot.
+ * @param t the slot
+ * @param counter index of the counter
+ * @param n the increment
+ */
+static inline void metrics_add(struct metrics_thread *t, int counter, uint64_t n)
+{
+    __atomic_store_n(&t->counters[counter], t->counters[counter] + n, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Returns the histogram bucket of a value.
+ * @param value the value
+ * @return 0 for 0, else the number of bits of the value
+ */
+static inline int metrics_bucket(uint64_t value)
+{
+    int b = value == 0 ? 0 : 64 - __builtin_clzll(value);
+
+    return b < METRICS_BUCKETS ? b : METRICS_BUCKETS - 1;
+}
+
+/**
+ * @brief Counts a value in a histogram of the calling thread's slot.
+ * @param t the slot
+ * @param hist index of the histogram
+ * @param value the value
+ */
+static inline void metrics_observe(struct metrics_thread *t, int hist, uint64_t value)
+{
+    uint64_t *bucket = &t->buckets[hist][metrics_bucket(value)];
+
+    __atomic_store_n(bucket, *bucket + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&t->sums[hist], t->sums[hist] + value, __ATOMIC_RELAXED);
+}
+
+#endif /* METRICS_H */
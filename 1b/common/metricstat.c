@@ -0,0 +1,234 @@
+/**
+ * @file metricstat.c
+ * @date 2017-05-14
+ *
+ * @brief Prints the metrics of a running mastermind or coffeemaker server,
+ *        see metrics.h. Maps the server's shared memory page read only and
+ *        sums the slots of all worker threads: every counter, and for every
+ *        histogram the count, mean and the bucket holding the 50th, 99th and
+ *        99.9th percentile. With INTERVAL it prints the rates and histograms
+ *        of every INTERVAL s until the server exits or SIGINT.
+ *
+ *        usage: metricstat NAME [INTERVAL], NAME as "/coffeemaker.1821"
+ **/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "metrics.h"
+
+/* @brief Sum of all slots */
+struct totals {
+    uint64_t counters[METRICS_COUNTERS];
+    uint64_t buckets[METRICS_HISTS][METRICS_BUCKETS];
+    uint64_t sums[METRICS_HISTS];
+};
+
+static const char *progname = "metricstat";
+
+static volatile sig_atomic_t quit = 0;
+
+/**
+ * @brief Signal handler, ends the interval loop.
+ */
+static void signal_handler(int sig);
+
+/**
+ * @brief Maps the page of a server read only, terminates on errors.
+ * @param name name of the shared memory object
+ * @return the page
+ */
+static const struct metrics_page *map_page(const char *name);
+
+/**
+ * @brief Sums the slots of all threads.
+ * @param page the page
+ * @param t where the sums are stored
+ */
+static void collect(const struct metrics_page *page, struct totals *t);
+
+/**
+ * @brief Prints the difference of two sums.
+ * @param page the page, for the names
+ * @param now the current sums
+ * @param before earlier sums, all zero for the absolute values
+ * @param seconds time between both, 0 to print totals instead of rates
+ */
+static void print_totals(const struct metrics_page *page, const struct totals *now,
+                         const struct totals *before, double seconds);
+
+/**
+ * @brief Returns the upper bound of the bucket holding a percentile.
+ * @param buckets the bucket counts
+ * @param count sum of the bucket counts
+ * @param percentile the percentile
+ * @return the largest value of the bucket
+ */
+static uint64_t percentile_bound(const uint64_t *buckets, uint64_t count, double percentile);
+
+/**
+ * @brief Program entry point
+ * @param argc The argument counter
+ * @param argv The argument vector
+ * @return EXIT_SUCCESS on success
+ */
+int main(int argc, char *argv[])
+{
+    const struct metrics_page *page;
+    struct totals before, now;
+    long interval = 0;
+    char *endptr;
+
+    progname = argv[0];
+    if (argc != 2 && argc != 3) {
+        (void) fprintf(stderr, "usage: %s NAME [INTERVAL]\n", progname);
+        return EXIT_FAILURE;
+    }
+    if (argc == 3) {
+        interval = strtol(argv[2], &endptr, 10);
+        if (*endptr != '\0' || interval < 1) {
+            (void) fprintf(stderr, "%s: INTERVAL must be a positive number of seconds\n", progname);
+            return EXIT_FAILURE;
+        }
+    }
+    page = map_page(argv[1]);
+    (void) printf("pid %d, %d threads, up %lds\n", (int) page->pid, (int) page->nthreads,
+        (long) (time(NULL) - page->started));
+
+    (void) memset(&before, 0, sizeof(before));
+    collect(page, &now);
+    print_totals(page, &now, &before, 0);
+    if (interval == 0) {
+        return EXIT_SUCCESS;
+    }
+
+    struct sigaction s;
+    (void) memset(&s, 0, sizeof(s));
+    s.sa_handler = signal_handler;
+    (void) sigaction(SIGINT, &s, NULL);
+    (void) sigaction(SIGTERM, &s, NULL);
+    while (!quit && kill(page->pid, 0) == 0) {
+        before = now;
+        (void) sleep(interval);
+        if (quit) {
+            break;
+        }
+        collect(page, &now);
+        (void) printf("--- last %lds\n", interval);
+        print_totals(page, &now, &before, interval);
+    }
+    return EXIT_SUCCESS;
+}
+
+static void signal_handler(int sig)
+{
+    quit = 1;
+}
+
+static const struct metrics_page *map_page(const char *name)
+{
+    struct metrics_page *page;
+    struct stat st;
+    int fd = shm_open(name, O_RDONLY, 0);
+
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        (void) fprintf(stderr, "%s: %s: %s\n", progname, name, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    if ((size_t) st.st_size < sizeof(*page)) {
+        (void) fprintf(stderr, "%s: %s: no metrics page\n", progname, name);
+        exit(EXIT_FAILURE);
+    }
+    page = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    (void) close(fd);
+    if (page == MAP_FAILED) {
+        (void) fprintf(stderr, "%s: mmap: %s\n", progname, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    if (memcmp(page->magic, METRICS_MAGIC, sizeof(METRICS_MAGIC)) != 0
+        || page->ncounters > METRICS_COUNTERS || page->nhists > METRICS_HISTS
+        || sizeof(*page) + page->nthreads * sizeof(struct metrics_thread) > (size_t) st.st_size) {
+        (void) fprintf(stderr, "%s: %s: no metrics page\n", progname, name);
+        exit(EXIT_FAILURE);
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return page;
+}
+
+static void collect(const struct metrics_page *page, struct totals *t)
+{
+    (void) memset(t, 0, sizeof(*t));
+    for (int i = 0; i < page->nthreads; i++) {
+        const struct metrics_thread *th = &page->threads[i];
+
+        for (int c = 0; c < page->ncounters; c++) {
+            t->counters[c] += __atomic_load_n(&th->counters[c], __ATOMIC_RELAXED);
+        }
+        for (int h = 0; h < page->nhists; h++) {
+            for (int b = 0; b < METRICS_BUCKETS; b++) {
+                t->buckets[h][b] += __atomic_load_n(&th->buckets[h][b], __ATOMIC_RELAXED);
+            }
+            t->sums[h] += __atomic_load_n(&th->sums[h], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static void print_totals(const struct metrics_page *page, const struct totals *now,
+                         const struct totals *before, double seconds)
+{
+    for (int c = 0; c < page->ncounters; c++) {
+        uint64_t n = now->counters[c] - before->counters[c];
+
+        if (seconds > 0) {
+            (void) printf("%-20s %12.1f/s\n", page->counter_names[c], n / seconds);
+        } else {
+            (void) printf("%-20s %12llu\n", page->counter_names[c], (unsigned long long) n);
+        }
+    }
+    for (int h = 0; h < page->nhists; h++) {
+        uint64_t buckets[METRICS_BUCKETS];
+        uint64_t count = 0;
+
+        for (int b = 0; b < METRICS_BUCKETS; b++) {
+            buckets[b] = now->buckets[h][b] - before->buckets[h][b];
+            count += buckets[b];
+        }
+        if (count == 0) {
+            (void) printf("%-20s %12s\n", page->hist_names[h], "-");
+            continue;
+        }
+        (void) printf("%-20s %12llu  mean %.1f  p50 <%llu  p99 <%llu  p999 <%llu\n",
+            page->hist_names[h], (unsigned long long) count,
+            (double) (now->sums[h] - before->sums[h]) / count,
+            (unsigned long long) percentile_bound(buckets, count, 50),
+            (unsigned long long) percentile_bound(buckets, count, 99),
+            (unsigned long long) percentile_bound(buckets, count, 99.9));
+    }
+    (void) fflush(stdout);
+}
+
+static uint64_t percentile_bound(const uint64_t *buckets, uint64_t count, double percentile)
+{
+    uint64_t rank = (uint64_t) (percentile / 100 * count + 0.5);
+    uint64_t seen = 0;
+    int b;
+
+    if (rank < 1) {
+        rank = 1;
+    }
+    for (b = 0; b < METRICS_BUCKETS - 1; b++) {
+        seen += buckets[b];
+        if (seen >= rank) {
+            break;
+        }
+    }
+    return (uint64_t) 1 << b;
+}
@@ -0,0 +1,142 @@
+/**
+ * @file sockio.c
+ * @date 2017-05-15
+ *
+ * @brief Buffered socket I/O, see sockio.h.
+ **/
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "sockio.h"
+
+void sockio_init(struct sockio *io, int fd, uint8_t *in, size_t in_size,
+                 uint8_t *out, size_t out_size)
+{
+    io->fd = fd;
+    io->in = in;
+    io->in_size = in_size;
+    io->in_start = io->in_end = 0;
+    io->out = out;
+    io->out_size = out_size;
+    io->out_start = io->out_end = 0;
+}
+
+ssize_t sockio_fill(struct sockio *io)
+{
+    if (io->in_start > 0) {
+        /* move the head of an incomplete message to the front */
+        (void) memmove(io->in, io->in + io->in_start, io->in_end - io->in_start);
+        io->in_end -= io->in_start;
+        io->in_start = 0;
+    }
+    if (io->in_end == io->in_size) {
+        errno = ENOBUFS;
+        return -1;
+    }
+    for (;;) {
+        ssize_t r = recv(io->fd, io->in + io->in_end, io->in_size - io->in_end, 0);
+
+        if (r >= 0) {
+            io->in_end += r;
+            return r;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return SOCKIO_AGAIN;
+        }
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+}
+
+int sockio_read(struct sockio *io, void *buf, size_t n)
+{
+    while (sockio_buffered(io) < n) {
+        ssize_t r = sockio_fill(io);
+
+        if (r == 0) {
+            errno = 0;
+            return -1;
+        }
+        if (r < 0) {
+            return r;
+        }
+    }
+    (void) memcpy(buf, sockio_data(io), n);
+    sockio_consume(io, n);
+    return 0;
+}
+
+int sockio_write(struct sockio *io, const void *buf, size_t n)
+{
+    const uint8_t *p = buf;
+
+    /* send until the rest fits, but always keep the tail of buf buffered,
+       so the flush which pushes out the MSG_MORE data has something to send */
+    while (sockio_pending(io) + n > io->out_size) {
+        size_t pending = sockio_pending(io);
+        size_t direct = n > io->out_size ? n - io->out_size : 0;
+        struct iovec iov[2];
+        struct msghdr msg;
+        ssize_t r;
+
+        (void) memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        if (pending > 0) {
+            iov[msg.msg_iovlen].iov_base = io->out + io->out_start;
+            iov[msg.msg_iovlen++].iov_len = pending;
+        }
+        if (direct > 0) {
+            iov[msg.msg_iovlen].iov_base = (void *) p;
+            iov[msg.msg_iovlen++].iov_len = direct;
+        }
+        r = sendmsg(io->fd, &msg, MSG_NOSIGNAL | MSG_MORE);
+        if (r < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                errno = ENOBUFS;
+            }
+            return -1;
+        }
+        if ((size_t) r < pending) {
+            io->out_start += r;
+        } else {
+            io->out_start = io->out_end = 0;
+            p += r - pending;
+            n -= r - pending;
+        }
+    }
+    if (io->out_end + n > io->out_size) {
+        (void) memmove(io->out, io->out + io->out_start, sockio_pending(io));
+        io->out_end -= io->out_start;
+        io->out_start = 0;
+    }
+    (void) memcpy(io->out + io->out_end, p, n);
+    io->out_end += n;
+    return 0;
+}
+
+int sockio_flush(struct sockio *io)
+{
+    while (sockio_pending(io) > 0) {
+        ssize_t r = send(io->fd, io->out + io->out_start, sockio_pending(io), MSG_NOSIGNAL);
+
+        if (r < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return SOCKIO_AGAIN;
+            }
+            if (errno != EINTR) {
+                return -1;
+            }
+            continue;
+        }
+        io->out_start += r;
+    }
+    io->out_start = io->out_end = 0;
+    return 0;
+}
@@ -0,0 +1,147 @@
+/**
+ * @file sockio.h
+ * @date 2017-05-15
+ *
+ * @brief Buffered socket I/O shared by the mastermind and coffeemaker
+ *        servers, clients and tools.
+ *
+ *        A struct sockio wraps a connected socket and two buffers owned by
+ *        the caller. Input is read ahead: sockio_fill() asks for all free
+ *        space of the input buffer with one recv(), so a frame header and
+ *        its body, or a response and the ones after it, cost one syscall.
+ *        Complete frames are then taken from the buffer with sockio_data()
+ *        and sockio_consume(), or copied with sockio_read().
+ *
+ *        Output is collected by sockio_write() and sent with one send() by
+ *        sockio_flush(). Data which does not fit into the output buffer is
+ *        sent together with the buffered data by one sendmsg() (a gather
+ *        write) flagged MSG_MORE, the rest follows with the next flush.
+ *
+ *        All calls retry on EINTR, never raise SIGPIPE and work on blocking
+ *        and non-blocking sockets. On a non-blocking socket they return
+ *        SOCKIO_AGAIN instead of waiting and keep what they have buffered,
+ *        the caller waits for EPOLLIN or EPOLLOUT and calls again. There,
+ *        the output buffer has to hold everything written between two
+ *        flushes.
+ **/
+#ifndef SOCKIO_H
+#define SOCKIO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Returned instead of waiting on a non-blocking socket */
+#define SOCKIO_AGAIN (-2)
+
+/* Size of the buffers of the clients and tools */
+#define SOCKIO_BUFFER (4096)
+
+/* @brief A socket and its buffers */
+struct sockio {
+    int fd;
+    uint8_t *in;            /* < received data is in[in_start .. in_end) */
+    size_t in_size;
+    size_t in_start;
+    size_t in_end;
+    uint8_t *out;           /* < unsent data is out[out_start .. out_end) */
+    size_t out_size;
+    size_t out_start;
+    size_t out_end;
+};
+
+/**
+ * @brief Attaches buffers to a connected socket.
+ * @param io the struct to initialize
+ * @param fd the socket
+ * @param in input buffer, the largest message read at once must fit
+ * @param in_size size of the input buffer
+ * @param out output buffer
+ * @param out_size size of the output buffer
+ */
+void sockio_init(struct sockio *io, int fd, uint8_t *in, size_t in_size,
+                 uint8_t *out, size_t out_size);
+
+/**
+ * @brief Receives as much as fits into the free space of the input buffer
+ *        with one recv().
+ * @param io the socket
+ * @return number of bytes received; 0 if the peer closed the connection;
+ *         SOCKIO_AGAIN if a non-blocking socket has no data; -1 on errors,
+ *         ENOBUFS if the buffer is full
+ */
+ssize_t sockio_fill(struct sockio *io);
+
+/**
+ * @brief Reads exactly n bytes, receiving only if the input buffer holds
+ *        fewer. Nothing is consumed unless all n bytes are there.
+ * @param io the socket
+ * @param buf where the bytes are stored
+ * @param n number of bytes, at most the size of the input buffer
+ * @return 0 on success; SOCKIO_AGAIN if a non-blocking socket has not
+ *         received all of them yet; -1 on errors, with errno 0 if the peer
+ *         closed the connection
+ */
+int sockio_read(struct sockio *io, void *buf, size_t n);
+
+/**
+ * @brief Queues bytes for sending. Only if they do not fit into the output
+ *        buffer, buffered data and the head of buf are sent right away.
+ * @param io the socket
+ * @param buf the bytes
+ * @param n number of bytes
+ * @return 0 on success; -1 on errors, ENOBUFS if a non-blocking socket
+ *         could not take data which does not fit into the buffer
+ */
+int sockio_write(struct sockio *io, const void *buf, size_t n);
+
+/**
+ * @brief Sends all queued bytes.
+ * @param io the socket
+ * @return 0 if everything was sent; SOCKIO_AGAIN if a non-blocking socket
+ *         could not take all of it, the rest stays queued; -1 on errors
+ */
+int sockio_flush(struct sockio *io);
+
+/**
+ * @brief Returns the number of received, unconsumed bytes.
+ * @param io the socket
+ */
+static inline size_t sockio_buffered(const struct sockio *io)
+{
+    return io->in_end - io->in_start;
+}
+
+/**
+ * @brief Returns the received, unconsumed bytes, valid until the next
+ *        sockio_fill() or sockio_read().
+ * @param io the socket
+ */
+static inline const uint8_t *sockio_data(const struct sockio *io)
+{
+    return io->in + io->in_start;
+}
+
+/**
+ * @brief Drops bytes returned by sockio_data().
+ * @param io the socket
+ * @param n number of bytes, at most sockio_buffered()
+ */
+static inline void sockio_consume(struct sockio *io, size_t n)
+{
+    io->in_start += n;
+    if (io->in_start == io->in_end) {
+        io->in_start = io->in_end = 0;
+    }
+}
+
+/**
+ * @brief Returns the number of queued, unsent bytes.
+ * @param io the socket
+ */
+static inline size_t sockio_pending(const struct sockio *io)
+{
+    return io->out_end - io->out_start;
+}
+
+#endif /* SOCKIO_H */
@@ -0,0 +1,211 @@
+/**
+ * @file tcpconn.c
+ * @date 2017-05-07
+ *
+ * @brief Client side TCP connection setup, see tcpconn.h.
+ **/
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "tcpconn.h"
+
+/* Maximum number of addresses tried per connection */
+#define MAX_ADDRS (16)
+
+/* Last error of getaddrinfo */
+static int resolve_error = 0;
+
+/**
+ * @brief Orders addresses for racing: alternating address families,
+ *        starting with the family of the first address.
+ * @param addrs addresses returned by getaddrinfo
+ * @param ordered where at most MAX_ADDRS addresses are stored
+ * @return number of stored addresses
+ */
+static int order_addrs(const struct addrinfo *addrs, const struct addrinfo **ordered);
+
+/**
+ * @brief Starts a non-blocking connect.
+ * @param ai the address
+ * @return the socket, -1 if the connect failed right away
+ */
+static int start_connect(const struct addrinfo *ai);
+
+/**
+ * @brief Returns the current time of the monotonic clock in milliseconds.
+ */
+static long now_ms(void);
+
+int tcpconn_open(const char *host, const char *port, int timeout)
+{
+    struct addrinfo *addrs = tcpconn_resolve(host, port);
+    int fd;
+
+    if (addrs == NULL) {
+        return -2;
+    }
+    fd = tcpconn_open_addrs(addrs, timeout);
+    freeaddrinfo(addrs);
+    return fd;
+}
+
+int tcpconn_open_addrs(const struct addrinfo *addrs, int timeout)
+{
+    const struct addrinfo *ordered[MAX_ADDRS];
+    struct pollfd pending[MAX_ADDRS];
+    int naddrs = order_addrs(addrs, ordered);
+    int npending = 0;
+    int next = 0;
+    int error = ECONNREFUSED;
+    long deadline = now_ms() + timeout;
+    long next_start = 0;
+
+    for (;;) {
+        long now = now_ms();
+        long wait;
+        int ready;
+
+        /* start the next attempt if it is due or nothing is pending */
+        while (next < naddrs && (now >= next_start || npending == 0)) {
+            int fd = start_connect(ordered[next++]);
+            if (fd < 0) {
+                error = errno;
+                continue;
+            }
+            pending[npending].fd = fd;
+            pending[npending].events = POLLOUT;
+            npending++;
+            next_start = now + TCPCONN_STAGGER;
+            break;
+        }
+        if (npending == 0) {
+            errno = error;
+            return -1;
+        }
+        if (now >= deadline) {
+            break;
+        }
+
+        wait = deadline - now;
+        if (next < naddrs && next_start - now < wait) {
+            wait = next_start - now;
+        }
+        ready = poll(pending, npending, wait);
+        if (ready < 0 && errno != EINTR) {
+            error = errno;
+            deadline = 0;
+            break;
+        }
+        for (int i = 0; ready > 0 && i < npending; i++) {
+            int err = 0;
+            socklen_t len = sizeof(err);
+
+            if (pending[i].revents == 0) {
+                continue;
+            }
+            if (getsockopt(pending[i].fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) {
+                err = errno;
+            }
+            if (err == 0) {
+                int fd = pending[i].fd;
+                /* the winner: drop the other attempts */
+                for (int j = 0; j < npending; j++) {
+                    if (j != i) {
+                        (void) close(pending[j].fd);
+                    }
+                }
+                (void) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+                return fd;
+            }
+            /* failed: start the next address without waiting */
+            error = err;
+            (void) close(pending[i].fd);
+            pending[i--] = pending[--npending];
+            next_start = 0;
+            ready--;
+        }
+    }
+
+    for (int i = 0; i < npending; i++) {
+        (void) close(pending[i].fd);
+    }
+    errno = deadline == 0 ? error : ETIMEDOUT;
+    return -1;
+}
+
+const char *tcpconn_error(void)
+{
+    return gai_strerror(resolve_error);
+}
+
+struct addrinfo *tcpconn_resolve(const char *host, const char *port)
+{
+    struct addrinfo hints;
+    struct addrinfo *addrs;
+
+    (void) memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_ADDRCONFIG;
+    if ((resolve_error = getaddrinfo(host, port, &hints, &addrs)) != 0) {
+        return NULL;
+    }
+    return addrs;
+}
+
+static int order_addrs(const struct addrinfo *addrs, const struct addrinfo **ordered)
+{
+    const struct addrinfo *first[MAX_ADDRS], *other[MAX_ADDRS];
+    int nfirst = 0, nother = 0, n = 0;
+
+    for (const struct addrinfo *ai = addrs; ai != NULL; ai = ai->ai_next) {
+        if (ai->ai_family == addrs->ai_family) {
+            if (nfirst < MAX_ADDRS) {
+                first[nfirst++] = ai;
+            }
+        } else if (nother < MAX_ADDRS) {
+            other[nother++] = ai;
+        }
+    }
+    for (int i = 0; n < MAX_ADDRS && (i < nfirst || i < nother); i++) {
+        if (i < nfirst) {
+            ordered[n++] = first[i];
+        }
+        if (i < nother && n < MAX_ADDRS) {
+            ordered[n++] = other[i];
+        }
+    }
+    return n;
+}
+
+static int start_connect(const struct addrinfo *ai)
+{
+    int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+
+    if (fd < 0) {
+        return -1;
+    }
+    if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0
+        || (connect(fd, ai->ai_addr, ai->ai_addrlen) < 0 && errno != EINPROGRESS)) {
+        int err = errno;
+        (void) close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+static long now_ms(void)
+{
+    struct timespec ts;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
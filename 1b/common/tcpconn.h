@@ -0,0 +1,62 @@
+/**
+ * @file tcpconn.h
+ * @date 2017-05-07
+ *
+ * @brief Client side TCP connection setup shared by the mastermind and
+ *        coffeemaker clients and tools.
+ *
+ *        tcpconn_open() resolves all addresses of a host and races
+ *        non-blocking connects across them (Happy Eyeballs, RFC 8305): the
+ *        next address is tried TCPCONN_STAGGER ms after the previous one or
+ *        as soon as it failed, the first established connection wins. A dead
+ *        or slow address thus costs at most TCPCONN_STAGGER ms instead of a
+ *        full TCP timeout.
+ *
+ *        Programs opening many connections to one host resolve it once with
+ *        tcpconn_resolve() and connect with tcpconn_open_addrs().
+ **/
+#ifndef TCPCONN_H
+#define TCPCONN_H
+
+#include <netdb.h>
+
+/* Default timeout for establishing a connection in milliseconds */
+#define TCPCONN_TIMEOUT (5000)
+
+/* Delay before the next address is tried in milliseconds */
+#define TCPCONN_STAGGER (250)
+
+/**
+ * @brief Connects to a host.
+ * @param host host name or address
+ * @param port port number or service name
+ * @param timeout timeout in milliseconds for the whole connection setup
+ * @return a connected, blocking socket; -1 on errors with errno set, or -2
+ *         if the host could not be resolved (see tcpconn_error)
+ */
+int tcpconn_open(const char *host, const char *port, int timeout);
+
+/**
+ * @brief Resolves a host for tcpconn_open_addrs.
+ * @param host host name or address
+ * @param port port number or service name
+ * @return the addresses, to be freed with freeaddrinfo; NULL if the host
+ *         could not be resolved (see tcpconn_error)
+ */
+struct addrinfo *tcpconn_resolve(const char *host, const char *port);
+
+/**
+ * @brief Connects to one of several resolved addresses, see tcpconn_open.
+ * @param addrs addresses returned by getaddrinfo
+ * @param timeout timeout in milliseconds
+ * @return a connected, blocking socket; -1 on errors with errno set
+ */
+int tcpconn_open_addrs(const struct addrinfo *addrs, int timeout);
+
+/**
+ * @brief Returns the message of the last resolver error.
+ * @return the message
+ */
+const char *tcpconn_error(void);
+
+#endif /* TCPCONN_H */
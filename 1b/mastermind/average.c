@@ -1,224 +1,396 @@
+/**
+ * @file average.c
+ * @date 2017-04-02
+ *
+ * @brief Evaluates solver strategies by playing against every possible secret
+ *        (or an evenly spread sample of them, see -n).
+ *        The secrets are distributed over a pool of threads, each owning its
+ *        own solver state. Prints a histogram of the needed rounds, max, mean,
+ *        the hardest secret and the number of games per second for every strategy.
+ *        With -m every strategy is also evaluated with the feedback looked up in
+ *        a matrix file of genmatrix (columns marked with +m).
+ **/
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdarg.h>
 #include <stdbool.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
 
-#define TESTSIZE (32768)
-#define PARITY_ERR_BIT (6)
-#define SHIFT_WIDTH (3)
-#define MAX_TRIES (35)
-#define SLOTS (5)
-#define COLORS (8)
-#define COMBINATIONS (32768)
-
-#define BUFFER_BYTES (2)
-#define EXIT_PARITY_ERROR (2)
-#define EXIT_GAME_LOST (3)
-#define EXIT_MULTIPLE_ERRORS (4)
-
-#define BACKLOG (5)
-
-uint16_t compute_patern(void);
-
-uint16_t allCombinations[COMBINATIONS];
-int red, white;
-
-void compute_all_combinations(void);
-
-void exclude_combinations(uint8_t *buff, uint8_t *prev_guess);
-
-int check_answer(uint16_t req, uint8_t *resp, uint8_t *secret);
-
-
-int main(void) {
-    bool found = false;
-    int max = 0, sum = 0;
-    int games = 0;
-    int neuner = 0;
-    int achter = 0;
-    uint16_t hardestComb;
-    for(uint16_t s = 0; s < TESTSIZE; ++s) {
-      //uint16_t secret = rand() % COMBINATIONS;
-      uint16_t secret = s;
-      (void)compute_all_combinations();
-        int i = 1;
-        found = false;
-        for(; i < MAX_TRIES; ++i) {
-            uint16_t try = compute_patern();
-            uint8_t secretAsArray[SLOTS];
-            uint8_t buff[BUFFER_BYTES];
-            uint16_t value = try;
-            uint16_t tempSecret = secret;
-            buff[0] = value & 0xff;
-            buff[1] = (value >> 8) & 0xff;
-            for (int j = 0; j < SLOTS; ++j) {
-                int tmp = tempSecret & 0x7;
-                secretAsArray[j] = tmp;
-                tempSecret >>= SHIFT_WIDTH;
+#include "solver.h"
+#include "matrix.h"
+
+/* Number of secrets a thread takes from the pool at once */
+#define CHUNK (256)
+
+/* Maximum number of threads */
+#define MAX_THREADS (256)
+
+/* === Type Definitions === */
+
+/* @brief Result of the evaluation of one strategy */
+struct result {
+    long histogram[MAX_TRIES + 1]; /* < games won after n rounds, index 0 counts lost games */
+    long sum;
+    int max;
+    code_t worst;
+    double seconds;
+};
+
+/* @brief Work shared by all threads evaluating one strategy */
+struct evaluation {
+    enum strategy strategy;
+    const struct matrix *matrix;  /* < feedback matrix used by the solver, or NULL */
+    pthread_mutex_t lock;
+    uint64_t games;          /* < number of games, spread evenly over all secrets */
+    uint64_t next;           /* < next game to hand out, protected by lock */
+    struct result result;    /* < merged result, protected by lock */
+};
+
+/* === Global Variables === */
+
+/* @brief Name of the program */
+static const char *progname = "average";
+
+/* === Prototypes === */
+
+/**
+ * @brief terminate program on program error
+ * @param exitcode exit code
+ * @param fmt format string
+ */
+static void bail_out(int exitcode, const char *fmt, ...);
+
+/**
+ * @brief Plays one game against the given secret.
+ * @param s solver state, reinitialised for this game
+ * @param ev the evaluation, selects strategy and matrix
+ * @param secret the secret to guess
+ * @return number of rounds needed, 0 if the game was lost
+ */
+static int play(struct solver *s, const struct evaluation *ev, code_t secret);
+
+/**
+ * @brief Thread function: takes chunks of secrets from the pool until it is empty
+ *        and merges the results into the evaluation.
+ * @param arg the struct evaluation
+ * @return NULL
+ */
+static void *worker(void *arg);
+
+/**
+ * @brief Returns the secret of a game, the games are spread evenly over all
+ *        combinations.
+ * @param game number of the game, 0 to games - 1
+ * @param games number of games, at most COMBINATIONS
+ * @return the secret
+ */
+static code_t game_secret(uint64_t game, uint64_t games);
+
+/**
+ * @brief Evaluates one strategy with the given number of threads.
+ * @param ev evaluation to run, result is stored in ev->result
+ * @param threads number of threads, at most MAX_THREADS
+ * @param games number of games to play
+ */
+static void evaluate(struct evaluation *ev, int threads, uint64_t games);
+
+/**
+ * @brief Prints the results of all evaluated strategies side by side.
+ * @param ev evaluated strategies
+ * @param n number of strategies
+ */
+static void print_results(struct evaluation *ev, int n);
+
+/**
+ * @brief Returns the elapsed time since start in seconds.
+ * @param start start time
+ * @return elapsed seconds
+ */
+static double elapsed(const struct timespec *start);
+
+/* === Implementations === */
+
+/**
+ * @brief Program entry point
+ * @param argc The argument counter
+ * @param argv The argument vector
+ * @return EXIT_SUCCESS if every game was won
+ */
+int main(int argc, char *argv[])
+{
+    struct evaluation ev[2 * STRATEGY_COUNT];
+    struct matrix matrix;
+    const char *matrix_path = NULL;
+    int n = 0;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    long games = COMBINATIONS;
+    int opt;
+    bool lost = false;
+
+    if (argc > 0) {
+        progname = argv[0];
+    }
+    while ((opt = getopt(argc, argv, "t:n:s:m:")) != -1) {
+        char *endptr;
+        int strategy;
+        switch (opt) {
+        case 't':
+            threads = strtol(optarg, &endptr, 10);
+            if (*endptr != '\0' || threads < 1 || threads > MAX_THREADS) {
+                bail_out(EXIT_FAILURE, "Invalid number of threads '%s', 1-%d", optarg, MAX_THREADS);
             }
-            int c = check_answer(try, buff, secretAsArray);
-            red = (buff[0] & 7);
-            white = (buff[0] >> 3) & 7;
-            if(c==5) {
-                found = true;
-                break;
+            break;
+        case 'n':
+            games = strtol(optarg, &endptr, 10);
+            if (*endptr != '\0' || games < 1 || games > COMBINATIONS) {
+                bail_out(EXIT_FAILURE, "Invalid number of games '%s'", optarg);
             }
-            uint8_t prev_Try[SLOTS];
-            for (int j = 0; j < SLOTS; ++j) {
-                int tmp = try & 0x7;
-                prev_Try[j] = tmp;
-                try >>= SHIFT_WIDTH;
+            break;
+        case 's':
+            strategy = solver_strategy(optarg);
+            if (strategy < 0) {
+                bail_out(EXIT_FAILURE, "Unknown strategy '%s'", optarg);
             }
-            exclude_combinations(buff, prev_Try);
-        }
-        if(found==false){
-          break;
-        }
-        if(i==8){
-          ++achter;
-        }
-        else if(i==9){
-          ++neuner;
+            if (n == STRATEGY_COUNT) {
+                bail_out(EXIT_FAILURE, "Too many strategies");
+            }
+            ev[n++].strategy = strategy;
+            break;
+        case 'm':
+            matrix_path = optarg;
+            break;
+        default:
+            bail_out(EXIT_FAILURE,
+                "Usage: %s [-t THREADS] [-n GAMES] [-m MATRIX] [-s STRATEGY]...", progname);
         }
-        else if(i==10){
-          ++games;
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (threads > MAX_THREADS) {
+        threads = MAX_THREADS;
+    }
+    if (n == 0) {
+        ev[n++].strategy = STRATEGY_DISTINCT;
+    }
+    for (int i = 0; i < n; i++) {
+        ev[i].matrix = NULL;
+    }
+    if (matrix_path != NULL) {
+        if (matrix_open(&matrix, matrix_path) < 0) {
+            bail_out(EXIT_FAILURE, "Can't map matrix file '%s'", matrix_path);
         }
-        if(max < i) {
-            hardestComb = secret;
-            max = i;
+        for (int i = 0, strategies = n; i < strategies; i++) {
+            ev[n].strategy = ev[i].strategy;
+            ev[n++].matrix = &matrix;
         }
-        sum += i;
     }
-    if(found == false){
-      printf("not found");
-    }
-    uint8_t prev_try[SLOTS];
-    for (int j = 0; j < SLOTS; ++j) {
-        int tmp = hardestComb & 0x7;
-        prev_try[j] = tmp;
-        hardestComb >>= SHIFT_WIDTH;
+
+    for (int i = 0; i < n; i++) {
+        evaluate(&ev[i], threads, games);
+        if (ev[i].result.histogram[0] > 0) {
+            lost = true;
+        }
     }
-    for (size_t p = 0; p < 5; p++) {
-      printf("%d ", prev_try[p]);
+    print_results(ev, n);
+    if (matrix_path != NULL) {
+        matrix_close(&matrix);
     }
-    printf("\n");
-    printf("Anzahl 8er: %d\n", achter);
-    printf("Anzahl 9er: %d\n", neuner);
-    printf("Anzahl 10er: %d\n", games);
-    printf("Max: %d \tAvg %lf\tTotal: %d\n", max, ((double)sum)/TESTSIZE, sum);
-    return 0;
+    return lost ? EXIT_GAME_LOST : EXIT_SUCCESS;
 }
 
-void compute_all_combinations(void) {
-  for (uint16_t i = 0; i < COMBINATIONS; i++) {
-    allCombinations[i] = i;
-  }
+static int play(struct solver *s, const struct evaluation *ev, code_t secret)
+{
+    solver_init(s, ev->strategy);
+    solver_use_matrix(s, ev->matrix);
+    for (int round = 1; round <= MAX_TRIES; ++round) {
+        code_t guess = solver_next_guess(s);
+        resp_t response = solver_score(guess, secret);
+        if (RESP_RED(response) == SLOTS) {
+            return round;
+        }
+        (void) solver_update(s, guess, response);
+    }
+    return 0;
 }
 
-int check_answer(uint16_t req, uint8_t *resp, uint8_t *secret){
-    int colors_left[COLORS];
-    int guess[COLORS];
-    int red_temp, white_temp;
-    int j;
-
+static void *worker(void *arg)
+{
+    struct evaluation *ev = arg;
+    struct result local;
+    struct solver solver;
+    struct solver *s = &solver;
 
-    /* extract the guess and calculate parity */
-    for (j = 0; j < SLOTS; ++j) {
-        int tmp = req & 0x7;
-        guess[j] = tmp;
-        req >>= SHIFT_WIDTH;
+    if (solver_alloc(s) < 0) {
+        bail_out(EXIT_FAILURE, "malloc");
     }
+    memset(&local, 0, sizeof(local));
 
-    /* marking red and white */
-    (void) memset(&colors_left[0], 0, sizeof(colors_left));
-    red_temp = white_temp = 0;
-    for (j = 0; j < SLOTS; ++j) {
-        /* mark red */
-        if (guess[j] == secret[j]) {
-            red_temp++;
-        } else {
-            colors_left[secret[j]]++;
+    for (;;) {
+        uint64_t first;
+
+        pthread_mutex_lock(&ev->lock);
+        first = ev->next;
+        ev->next += CHUNK;
+        pthread_mutex_unlock(&ev->lock);
+        if (first >= ev->games) {
+            break;
         }
-    }
-    for (j = 0; j < SLOTS; ++j) {
-        /* not marked red */
-        if (guess[j] != secret[j]) {
-            if (colors_left[guess[j]] > 0) {
-                white_temp++;
-                colors_left[guess[j]]--;
+
+        for (uint64_t game = first; game < first + CHUNK && game < ev->games; ++game) {
+            code_t secret = game_secret(game, ev->games);
+            int rounds = play(s, ev, secret);
+            /* lost games count as MAX_TRIES + 1 rounds for the worst case */
+            int cost = rounds == 0 ? MAX_TRIES + 1 : rounds;
+            local.histogram[rounds]++;
+            local.sum += rounds;
+            if (cost > local.max) {
+                local.max = cost;
+                local.worst = secret;
             }
         }
     }
+    solver_free(s);
 
-    /* build response buffer */
+    pthread_mutex_lock(&ev->lock);
+    for (int i = 0; i <= MAX_TRIES; i++) {
+        ev->result.histogram[i] += local.histogram[i];
+    }
+    ev->result.sum += local.sum;
+    if (local.max > ev->result.max
+        || (local.max == ev->result.max && local.worst < ev->result.worst)) {
+        ev->result.max = local.max;
+        ev->result.worst = local.worst;
+    }
+    pthread_mutex_unlock(&ev->lock);
+    return NULL;
+}
 
-    return red_temp;
+static code_t game_secret(uint64_t game, uint64_t games)
+{
+    /* game * COMBINATIONS / games without the 64 bit overflow of the product */
+    uint64_t quotient = COMBINATIONS / games;
+    uint64_t remainder = COMBINATIONS % games;
 
+    return solver_code(game * quotient + game * remainder / games);
 }
 
-void exclude_combinations(uint8_t *buff, uint8_t *prev_guess){
-  int red_temp;
-  int white_temp;
-  int count = 0;
-  for (size_t i = 0; i < COMBINATIONS; i++) {
-    if(allCombinations[i] < COMBINATIONS){
-      (void)check_answer(allCombinations[i],buff, prev_guess);
-      red_temp = (buff[0] & 7);
-      white_temp = (buff[0] >> 3) & 7;
-      if(white_temp!=white || red_temp!=red ) {
-        allCombinations[i] ^= (1 << 15);
-      }
-    }
-    else{
-      ++count;
-    }
-  }
-}
+static void evaluate(struct evaluation *ev, int threads, uint64_t games)
+{
+    pthread_t tids[MAX_THREADS];
+    struct timespec start;
 
-uint16_t compute_patern(void) {
-  int bestCount = 0;
-  uint16_t selected_colors;
-    for (size_t i = 0; i < COMBINATIONS; i++) {
-      if(allCombinations[i] < COMBINATIONS){
-        uint8_t possibleGuess[SLOTS];
-        uint8_t countCoulors[COLORS];
-        uint8_t parity_calc = 0;
-        uint16_t selected_colors_temp = allCombinations[i];
-        for (size_t j = 0; j < COLORS; j++) {
-          countCoulors[j] = 16;
+    memset(&ev->result, 0, sizeof(ev->result));
+    ev->games = games;
+    ev->next = 0;
+    if (pthread_mutex_init(&ev->lock, NULL) != 0) {
+        bail_out(EXIT_FAILURE, "pthread_mutex_init");
+    }
+    if (clock_gettime(CLOCK_MONOTONIC, &start) < 0) {
+        bail_out(EXIT_FAILURE, "clock_gettime");
+    }
+    for (int i = 0; i < threads; i++) {
+        errno = pthread_create(&tids[i], NULL, worker, ev);
+        if (errno != 0) {
+            bail_out(EXIT_FAILURE, "pthread_create");
         }
-        int count = 0;
-        for (size_t j = 0; j < SLOTS; ++j) {
-            int tmp = selected_colors_temp & 0x7;
-            parity_calc ^= tmp ^ (tmp >> 1) ^ (tmp >> 2);
-            possibleGuess[j] = tmp;
-            if(countCoulors[possibleGuess[j]] != possibleGuess[j]){
-              countCoulors[possibleGuess[j]] = possibleGuess[j];
-              ++count;
-              if(count>bestCount){
-                bestCount = count;
-              }
+    }
+    for (int i = 0; i < threads; i++) {
+        (void) pthread_join(tids[i], NULL);
+    }
+    ev->result.seconds = elapsed(&start);
+    (void) pthread_mutex_destroy(&ev->lock);
+}
+
+static void print_results(struct evaluation *ev, int n)
+{
+    int last = 1;
+
+    for (int i = 0; i < n; i++) {
+        for (int r = 1; r <= MAX_TRIES; r++) {
+            if (ev[i].result.histogram[r] > 0 && r > last) {
+                last = r;
             }
-            selected_colors_temp >>= SHIFT_WIDTH;
         }
-        if(count >= bestCount){
-          selected_colors = allCombinations[i];
+    }
+
+    (void) printf("%-8s", "rounds");
+    for (int i = 0; i < n; i++) {
+        char name[32];
+        (void) snprintf(name, sizeof(name), "%s%s",
+            solver_strategy_name(ev[i].strategy), ev[i].matrix != NULL ? "+m" : "");
+        (void) printf(" %12s", name);
+    }
+    (void) printf("\n");
+    for (int r = 1; r <= last; r++) {
+        (void) printf("%-8d", r);
+        for (int i = 0; i < n; i++) {
+            (void) printf(" %12ld", ev[i].result.histogram[r]);
+        }
+        (void) printf("\n");
+    }
+    (void) printf("%-8s", "lost");
+    for (int i = 0; i < n; i++) {
+        (void) printf(" %12ld", ev[i].result.histogram[0]);
+    }
+    (void) printf("\n%-8s", "max");
+    for (int i = 0; i < n; i++) {
+        if (ev[i].result.max > MAX_TRIES) {
+            (void) printf(" %12s", "lost");
+        } else {
+            (void) printf(" %12d", ev[i].result.max);
         }
-        if(bestCount>=4){
-          break;
+    }
+    (void) printf("\n%-8s", "mean");
+    for (int i = 0; i < n; i++) {
+        long won = ev[i].games - ev[i].result.histogram[0];
+        (void) printf(" %12.4f", won > 0 ? (double) ev[i].result.sum / won : 0.0);
+    }
+    (void) printf("\n%-8s", "worst");
+    for (int i = 0; i < n; i++) {
+        char secret[SLOTS + 1];
+        for (int j = 0; j < SLOTS; j++) {
+            secret[j] = COLOR_CHARS[(ev[i].result.worst >> (j * SHIFT_WIDTH)) & SLOT_MASK];
         }
-      }
+        secret[SLOTS] = '\0';
+        (void) printf(" %12s", secret);
+    }
+    (void) printf("\n%-8s", "games/s");
+    for (int i = 0; i < n; i++) {
+        (void) printf(" %12.0f", ev[i].games / ev[i].result.seconds);
     }
-    /* calculate parity */
-    uint8_t parity_calc = 0;
-    int tmp = selected_colors;
+    (void) printf("\n");
+}
+
+static double elapsed(const struct timespec *start)
+{
+    struct timespec now;
 
-    for (int j = 0; j < 15; ++j) {
-        parity_calc ^= tmp;
-        tmp >>= 0x1;
+    if (clock_gettime(CLOCK_MONOTONIC, &now) < 0) {
+        bail_out(EXIT_FAILURE, "clock_gettime");
     }
-    parity_calc &= 0x1;
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void bail_out(int exitcode, const char *fmt, ...)
+{
+    va_list ap;
 
-    return (selected_colors & 0x7FFF) | (parity_calc << 15);
+    (void) fprintf(stderr, "%s: ", progname);
+    if (fmt != NULL) {
+        va_start(ap, fmt);
+        (void) vfprintf(stderr, fmt, ap);
+        va_end(ap);
+    }
+    if (errno != 0) {
+        (void) fprintf(stderr, ": %s", strerror(errno));
+    }
+    (void) fprintf(stderr, "\n");
+    exit(exitcode);
 }
@@ -22,18 +22,11 @@
 #include <getopt.h>
 #include <stdbool.h>
 
-#define PARITY_ERR_BIT (6)
-#define SHIFT_WIDTH (3)
-#define MAX_TRIES (35)
-#define SLOTS (5)
-#define COLORS (8)
-#define COMBINATIONS (32768)
-
-#define BUFFER_BYTES (2)
-#define RESPONSE_WIDTH (1)
-#define EXIT_PARITY_ERROR (2)
-#define EXIT_GAME_LOST (3)
-#define EXIT_MULTIPLE_ERRORS (4)
+#include "solver.h"
+#include "openings.h"
+#include "feedback.h"
+#include "tcpconn.h"
+#include "sockio.h"
 
 #define BACKLOG (5)
 
@@ -49,8 +42,11 @@
 
 /* === Global Variables === */
 
-/*stores all possible Combinations*/
-uint16_t allCombinations[COMBINATIONS];
+/* State of the solver for the current game */
+static struct solver game;
+
+/* Opening tables published by solverd, NULL if it does not run */
+static const struct openings *openings = NULL;
 
 /* Name of the program */
 static const char *progname = "client";
@@ -58,6 +54,10 @@ static const char *progname = "client";
 /* File descriptor for connection socket */
 static int connfd = -1;
 
+/* Buffered I/O on connfd */
+static struct sockio conn;
+static uint8_t conn_in[SOCKIO_BUFFER], conn_out[SOCKIO_BUFFER];
+
 
 /* === Prototypes === */
 
@@ -75,39 +75,26 @@ static int connect_to_server(char *host, char *port);
 /**
  *
  * @brief Sends and receives bytes to and from the server
+ * @param batch number of guesses sent at once, 1 for the original protocol
+ * @return exit code of the program
  */
-static int communicate(void);
+static int communicate(int batch);
 
 /**
- * @brief Selects one of the not yet excluded combinations in the array.
-    selects the first combination with 4 different colours
-    or if there is no such combination selects the last combination with the most different coulors.
- * @return two bytes containing the color information and a parity bit
+ * @brief Asks the server to use the batch protocol. Terminates the program if
+ *        the server does not support it: an old server answers with a parity
+ *        error and ends, so the game cannot continue without batches.
+ * @param batch requested batch size, lowered to the server's maximum
  */
-static uint16_t compute_patern(void);
+static void negotiate_batch(int *batch);
 
 /**
-  * @brief Writes all combinations in the global array allCombinations
-*/
-static void compute_all_combinations(void);
-
-/**
-  *@brief exludes combinations by comparing the previous guess with all combinations left
-    and the answer of the previous guess.
-  *@param redWhiteBuff contains the number of red and white for the previous guess
-  *@param prev_guess is the previous guess as an array
-  *@return number of remaining combinations
-*/
-static int exclude_combinations(uint8_t redWhiteBuff, uint8_t *prev_guess);
-
-/**
- * @brief Compute answer to request
- * @param req Client's next guess
- * @param resp Buffer will contain the answer for the guess req
- * @param secret is the the prev_guess of client
- * @return Number of correct matches on success
+ * @brief Checks a response of the server. Terminates the program on errors.
+ * @param read_buffer the response
+ * @param round the round the response belongs to
+ * @return true if the game was won
  */
-static int check_answer(uint16_t req, uint8_t *resp, uint8_t *secret);
+static bool check_response(resp_t read_buffer, int round);
 
 /**
  * @brief terminate program on program error
@@ -116,36 +103,24 @@ static int check_answer(uint16_t req, uint8_t *resp, uint8_t *secret);
  */
 static void bail_out(int exitcode, const char *fmt, ...);
 
-/**
-* @brief calculates the parity bit for the combination
-* @param selected_colors combination to calculate parity bit
-* @return the partity bit
-*/
-static uint8_t calculate_parity(uint16_t selected_colors);
-
 /**
  * @brief free allocated resources (closes socket)
  */
 static void free_resources(void);
 
 /**
- * @brief Writes message to server
- *
- * @param sockfd_con Socket to write from
- * @param buffer Buffer where wirte data is stored
- * @param n Size to write
- * @return number of bytes written
+ * @brief Sends a message to the server, terminates on errors.
+ * @param buffer the message
+ * @param n its size
  */
-static size_t write_to_server(int fd, uint8_t *buffer, size_t n);
+static void write_to_server(const uint8_t *buffer, size_t n);
 
 /**
- * @brief Read message from socket (deals with partial reads)
- * @param sockfd_con Socket to read from
- * @param buffer Buffer where read data is stored
- * @param n Size to read
- * @return Pointer to buffer on success, else NULL
+ * @brief Reads n bytes from the server, terminates on errors.
+ * @param buffer where the bytes are stored
+ * @param n number of bytes
  */
-static size_t read_from_server(int fd, uint8_t *buffer, size_t n);
+static void read_from_server(uint8_t *buffer, size_t n);
 
 
 /* === Implementations === */
@@ -160,258 +135,171 @@ static size_t read_from_server(int fd, uint8_t *buffer, size_t n);
  */
 int main(int argc, char **argv) {
 
-    if (argc != 3){
-      bail_out(EXIT_FAILURE,"Usage: %s <hostname> <server-port>", progname);
+    int batch = 1;
+    int opt;
+    char *endptr;
+
+    while ((opt = getopt(argc, argv, "b:")) != -1) {
+        switch (opt) {
+        case 'b':
+            batch = strtol(optarg, &endptr, 10);
+            if (*endptr != '\0' || batch < 1 || batch > MAX_BATCH) {
+                bail_out(EXIT_FAILURE, "Batch size has to be in 1-%d", MAX_BATCH);
+            }
+            break;
+        default:
+            bail_out(EXIT_FAILURE,"Usage: %s [-b batch] <hostname> <server-port>", progname);
+        }
+    }
+    if (argc - optind != 2){
+      bail_out(EXIT_FAILURE,"Usage: %s [-b batch] <hostname> <server-port>", progname);
     }
+    char *host = argv[optind];
+    char *port = argv[optind + 1];
     int ret = EXIT_SUCCESS;
 
-    if (connect_to_server(argv[1], argv[2]) < 0){
+    if (solver_alloc(&game) < 0){
+        bail_out(EXIT_FAILURE, "malloc");
+    }
+    if (connect_to_server(host, port) < 0){
         bail_out(EXIT_FAILURE, "connection");
-      }
-    else {
-        ret = communicate();
-        if(ret < 0){
-          bail_out(EXIT_FAILURE, "communicate");
-        }
-      }
+    }
+    if (batch > 1) {
+        negotiate_batch(&batch);
+    }
+    ret = communicate(batch);
+    if(ret < 0){
+      bail_out(EXIT_FAILURE, "communicate");
+    }
     free_resources();
     return ret;
 }
 
 static int connect_to_server(char *host, char *port) {
 
-    struct addrinfo hints;
-    struct addrinfo *result;
-
-    int addr, conn;
-    bzero(&hints, sizeof hints);
-
-    hints.ai_family = AF_INET;          //IPv4
-    hints.ai_socktype = SOCK_STREAM;    //TCP
-    addr = getaddrinfo(host, port, &hints, &result);
-
-    if(addr!=0){
-      bail_out(EXIT_FAILURE, "getaddrinfo: %s\n", gai_strerror(addr));
+    connfd = tcpconn_open(host, port, TCPCONN_TIMEOUT);
+    if(connfd == -2){
+      errno = 0;
+      bail_out(EXIT_FAILURE, "getaddrinfo: %s", tcpconn_error());
     }
-    //create socket file descriptor
-    connfd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
     if(connfd == -1){
-      bail_out(EXIT_FAILURE, "socket()");
-    }
-
-    /* Connect the socket to the address */
-    conn = connect(connfd, result->ai_addr, result->ai_addrlen);
-    if(conn == -1){
       bail_out(EXIT_FAILURE, "connect()");
     }
-    freeaddrinfo(result);
-
-    return conn;
+    sockio_init(&conn, connfd, conn_in, sizeof(conn_in), conn_out, sizeof(conn_out));
+    return 0;
 }
 
-static int communicate(void) {
-    int ret = EXIT_SUCCESS;
-    uint8_t read_buffer;
-    uint16_t next_try;
-
-    compute_all_combinations();
-
-    for (int i = 0; i < MAX_TRIES; i++) {
-        int error = 0;
-        next_try = compute_patern();
-        uint8_t buff[BUFFER_BYTES];
-        uint16_t value = next_try;
-        buff[0] = value & 0xff;
-        buff[1] = (value >> 8) & 0xff;
-        if(write_to_server(connfd, buff, BUFFER_BYTES) < 0) {
-		        bail_out(EXIT_FAILURE, "Error writing to server");
-          }
-
-        DEBUG("Sent 0x%x\n", next_try);
-
-        if(read_from_server(connfd, buff, RESPONSE_WIDTH) < 0) {
-		      bail_out(EXIT_FAILURE, "Error reading from server");
-        }
+static void negotiate_batch(int *batch) {
+    uint8_t buff[GUESS_BYTES];
 
-        read_buffer = buff[0];
-        DEBUG("Got byte 0x%x\n", read_buffer);
-
-        // check for errors in received buffer
-        switch (read_buffer >> 6) {
-              //linux.die.net/man/2/recv
-            case 0:       //All ok
-                break;
-            case 1:
-                (void)printf("%s\n", "Parity error");
-                error = 1;
-                ret = EXIT_PARITY_ERROR;
-                break;
-
-            case 2:
-                (void)printf("%s\n", "Game lost");
-                error = 1;
-                ret = EXIT_GAME_LOST;
-                break;
-
-            case 3:
-                (void)printf("%s\n", "Multiple errors");
-                error = 1;
-                ret = EXIT_MULTIPLE_ERRORS;
-                break;
-
-            default:
-                assert(0); //Unreachable
-        }
-        if(error){
-          free_resources();
-          exit(ret);
-        }
-        // correct combination found
-        else if ((read_buffer & 7) == 5) {
-            printf("Runden: %d\n", i + 1);
-            return ret;
-        }
-        else{
-          uint8_t prev_try[SLOTS];
-          value = next_try;
-          buff[0] = value & 0xff;
-          buff[1] = (value >> 8) & 0xff;
-          for (int j = 0; j < SLOTS; ++j) {
-              int tmp = next_try & 0x7;
-              prev_try[j] = tmp;
-              next_try >>= SHIFT_WIDTH;
-          }
-
-          int comb = exclude_combinations(read_buffer, prev_try);
-          assert(comb > 0); //its impossible, that there are less combinations remaining than 0
-          DEBUG("remaining comb: %d\n", comb);
-        }
+    codec_put(buff, PROTO_HELLO, GUESS_BYTES);
+    write_to_server(buff, GUESS_BYTES);
+    read_from_server(buff, RESP_BYTES);
+    if (codec_get(buff, RESP_BYTES) != PROTO_ACK) {
+        errno = 0;
+        bail_out(EXIT_FAILURE, "Server does not support batches, run without -b");
     }
-    return ret;
-}
-
-static void compute_all_combinations(void) {
-  for (uint16_t i = 0; i < COMBINATIONS; i++) {
-    allCombinations[i] = i;
-  }
+    read_from_server(buff, 1);
+    if (buff[0] < *batch) {
+        *batch = buff[0];
+    }
+    DEBUG("Using batches of %d guesses\n", *batch);
 }
 
-
-static int check_answer(uint16_t req, uint8_t *resp, uint8_t *secret){
-    int colors_left[COLORS];
-    int guess[COLORS];
-    int red_temp, white_temp;
-    int j;
-
-    /* extract the guess  */
-    for (j = 0; j < SLOTS; ++j) {
-        int tmp = req & 0x7;
-        guess[j] = tmp;
-        req >>= SHIFT_WIDTH;
+static int communicate(int batch) {
+    int ret = EXIT_SUCCESS;
+    int round = 0;
+
+    /* with solverd running the first round needs no own tables */
+    if ((openings = openings_map()) != NULL) {
+        DEBUG("Using the tables of solverd\n");
+        solver_init_opening(&game, STRATEGY_DISTINCT, openings);
+    } else {
+        solver_init(&game, STRATEGY_DISTINCT);
     }
 
-    /* marking red and white */
-    (void) memset(&colors_left[0], 0, sizeof(colors_left));
-    red_temp = white_temp = 0;
-    for (j = 0; j < SLOTS; ++j) {
-        /* mark red */
-        if (guess[j] == secret[j]) {
-            red_temp++;
+    while (round < MAX_TRIES) {
+        code_t guesses[MAX_BATCH];
+        uint8_t buff[1 + MAX_BATCH * GUESS_BYTES];
+        size_t len = 0;
+        int n = 1;
+        int answered = 1;
+
+        if (batch > 1) {
+            int left = MAX_TRIES - round;
+            n = solver_next_guesses(&game, guesses, batch < left ? batch : left);
+            buff[len++] = n;
         } else {
-            colors_left[secret[j]]++;
+            guesses[0] = solver_next_guess(&game);
         }
-    }
-    for (j = 0; j < SLOTS; ++j) {
-        /* not marked red */
-        if (guess[j] != secret[j]) {
-            if (colors_left[guess[j]] > 0) {
-                white_temp++;
-                colors_left[guess[j]]--;
-            }
+        for (int i = 0; i < n; i++) {
+            codec_put(buff + len, fb_wire_guess(guesses[i]), GUESS_BYTES);
+            len += GUESS_BYTES;
+            DEBUG("Sent 0x%llx\n", (unsigned long long) fb_wire_guess(guesses[i]));
         }
-    }
-
-    /* build response buffer */
-    resp[0] = red_temp;
-    resp[0] |= (white_temp << SHIFT_WIDTH);
+        write_to_server(buff, len);
 
-    return red_temp;
-}
-
-static int exclude_combinations(uint8_t redWhiteBuff, uint8_t *prev_guess){
-  int red = (redWhiteBuff & 7);
-  int white = (redWhiteBuff >> 3) & 7;
-
-  uint8_t buff[1];
-
-  int red_temp;
-  int white_temp;
-  int count = 0;
-  for (size_t i = 0; i < COMBINATIONS; i++) {
-    if(allCombinations[i] < COMBINATIONS){
-      (void)check_answer(allCombinations[i],buff, prev_guess);
-      red_temp = (buff[0] & 7);
-      white_temp = (buff[0] >> 3) & 7;
-      if(white_temp!=white || red_temp!=red ) {
-        allCombinations[i] ^= (1 << 15);
-        ++count;
-      }
-    }
-    else{
-      ++count;
-    }
-  }
-  return COMBINATIONS - count;
-}
-
-static uint16_t compute_patern(void) {
-  int bestCount = 0;
-  uint16_t selected_colors;
-    for (size_t i = 0; i < COMBINATIONS; i++) {
-      if(allCombinations[i] < COMBINATIONS){
-        uint8_t possibleGuess[SLOTS];
-        uint8_t countCoulors[COLORS];
-        uint8_t parity_calc = 0;
-        uint16_t selected_colors_temp = allCombinations[i];
-        for (size_t j = 0; j < COLORS; j++) {
-          countCoulors[j] = 16;
-        }
-        int count = 0;
-        for (size_t j = 0; j < SLOTS; ++j) {
-            int tmp = selected_colors_temp & 0x7;
-            parity_calc ^= tmp ^ (tmp >> 1) ^ (tmp >> 2);
-            possibleGuess[j] = tmp;
-            if(countCoulors[possibleGuess[j]] != possibleGuess[j]){
-              countCoulors[possibleGuess[j]] = possibleGuess[j];
-              ++count;
-              if(count>bestCount){
-                bestCount = count;
-              }
+        if (batch > 1) {
+            read_from_server(buff, 1);
+            answered = buff[0];
+            if (answered < 1 || answered > n) {
+                bail_out(EXIT_FAILURE, "Bad batch response");
             }
-            selected_colors_temp >>= SHIFT_WIDTH;
         }
-        if(count >= bestCount){
-          //printf("Count: %d\n", count);
-          selected_colors = allCombinations[i];
+        read_from_server(buff, answered * RESP_BYTES);
+
+        for (int i = 0; i < answered; i++) {
+            resp_t response = codec_get(buff + i * RESP_BYTES, RESP_BYTES);
+            DEBUG("Got 0x%x\n", response);
+            round++;
+            if (check_response(response, round)) {
+                return ret;
+            }
+            uint64_t comb = solver_update(&game, guesses[i], response);
+            assert(comb > 0); //its impossible, that there are less combinations remaining than 0
+            DEBUG("remaining comb: %llu\n", (unsigned long long) comb);
         }
-        if(bestCount>=4){
-          break;
+        if (answered < n) {
+            bail_out(EXIT_FAILURE, "Server ended the game early");
         }
-      }
     }
-    /* calculate parity */
-    uint8_t parity_calc = calculate_parity(selected_colors);
-
-    return (selected_colors & 0x7FFF) | (parity_calc << 15);
+    return ret;
 }
 
-static uint8_t calculate_parity(uint16_t selected_colors){
-  int8_t parity_calc = 0;
-  for (int i = 0; i < 15; ++i) {
-    parity_calc ^= selected_colors;
-    selected_colors >>= 0x1;
-  }
-  return parity_calc &= 0x1;
+static bool check_response(resp_t read_buffer, int round) {
+    int ret;
+
+    // check for errors in received buffer
+    switch (RESP_ERRORS(read_buffer)) {
+          //linux.die.net/man/2/recv
+        case 0:       //All ok
+            // correct combination found
+            if (RESP_RED(read_buffer) == SLOTS) {
+                printf("Runden: %d\n", round);
+                return true;
+            }
+            return false;
+        case 1:
+            (void)printf("%s\n", "Parity error");
+            ret = EXIT_PARITY_ERROR;
+            break;
+
+        case 2:
+            (void)printf("%s\n", "Game lost");
+            ret = EXIT_GAME_LOST;
+            break;
+
+        case 3:
+            (void)printf("%s\n", "Multiple errors");
+            ret = EXIT_MULTIPLE_ERRORS;
+            break;
+
+        default:
+            assert(0); //Unreachable
+            ret = EXIT_FAILURE;
+    }
+    free_resources();
+    exit(ret);
 }
 
 static void bail_out(int exitcode, const char *fmt, ...) {
@@ -433,45 +321,19 @@ static void bail_out(int exitcode, const char *fmt, ...) {
     exit(exitcode);
 }
 
-static size_t write_to_server(int fd, uint8_t *buffer, size_t n){
-
-	size_t bytes_sent = 0;
-
-	do {
-		ssize_t r;
-		r = write(fd, buffer + bytes_sent, n - bytes_sent);
-		if (r <= 0) {
-			return -1;
-		}
-		bytes_sent += r;
-	} while (bytes_sent < n);
-
-	if (bytes_sent < n) {
-		return -1;
-	}
-
-	return bytes_sent;
+static void write_to_server(const uint8_t *buffer, size_t n)
+{
+    if (sockio_write(&conn, buffer, n) < 0 || sockio_flush(&conn) < 0) {
+        bail_out(EXIT_FAILURE, "Error writing to server");
+    }
 }
 
-static size_t read_from_server(int fd, uint8_t *buffer, size_t n)
+static void read_from_server(uint8_t *buffer, size_t n)
 {
-
-	size_t bytes_read = 0;
-
-	do {
-		ssize_t r;
-		r = read(fd, buffer + bytes_read, n - bytes_read);
-		if (r <= 0) {
-			return -1;
-		}
-		bytes_read += r;
-	} while (bytes_read < n);
-
-	if (bytes_read < n) {
-		return -1;
-	}
-
-	return bytes_read;
+    /* the read-ahead usually holds the batch count and the responses at once */
+    if (sockio_read(&conn, buffer, n) < 0) {
+        bail_out(EXIT_FAILURE, "Error reading from server");
+    }
 }
 
 static void free_resources(void) {
@@ -480,5 +342,9 @@ static void free_resources(void) {
     DEBUG("Shutting down client\n");
     if (connfd >= 0) {
         (void) close(connfd);
+        connfd = -1;
     }
+    openings_unmap(openings);
+    openings = NULL;
+    solver_free(&game);
 }
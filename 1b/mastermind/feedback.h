@@ -0,0 +1,142 @@
+/**
+ * @file feedback.h
+ * @date 2017-04-16
+ *
+ * @brief Scoring of guesses with the tables generated by gentables.
+ *        A score is a handful of table loads and popcounts instead of
+ *        loops over the slots and colours. Games too large for the colour
+ *        table count the colours of the secret instead. Also adds the parity
+ *        bit of the wire format to guesses, see codec.h for the byte order.
+ **/
+#ifndef FEEDBACK_H
+#define FEEDBACK_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "codec.h"
+#include "mastermind.h"
+#include "feedback_tables.h"
+
+/* Mask of the colour bits of an encoded combination (without parity bit) */
+#define CODE_MASK ((code_t) ((1ULL << CODE_BITS) - 1))
+
+/* @brief A guess prepared for being scored against many secrets */
+struct fb_guess {
+    code_t code;
+#if FB_COLOR_TABLE
+    uint64_t colors;          /* < colour mask, see gentables.c */
+#else
+    uint8_t count[COLORS];    /* < occurrences of every colour */
+#endif
+};
+
+/**
+ * @brief Prepares a guess for fb_score_prepared.
+ * @param g where the prepared guess is stored
+ * @param guess encoded guess (parity bit is ignored)
+ */
+static inline void fb_prepare(struct fb_guess *g, code_t guess)
+{
+    g->code = guess & CODE_MASK;
+#if FB_COLOR_TABLE
+    g->colors = fb_colors[g->code];
+#else
+    (void) memset(g->count, 0, sizeof(g->count));
+    for (int j = 0; j < SLOTS; j++) {
+        g->count[(g->code >> (j * SHIFT_WIDTH)) & SLOT_MASK]++;
+    }
+#endif
+}
+
+/**
+ * @brief Compares a prepared guess with a secret.
+ * @param g the prepared guess
+ * @param secret encoded secret
+ * @return response with red pegs in the low and white pegs in the next PEG_BITS bits
+ */
+static inline resp_t fb_score_prepared(const struct fb_guess *g, code_t secret)
+{
+    uint64_t d, diff;
+    int red, common;
+
+    secret &= CODE_MASK;
+
+    /* a slot differs if any of its bits differ */
+    d = diff = g->code ^ secret;
+    for (int k = 1; k < SHIFT_WIDTH; k++) {
+        diff |= d >> k;
+    }
+    red = SLOTS - __builtin_popcountll(diff & FB_SLOT_LOW);
+
+#if FB_COLOR_TABLE
+    common = __builtin_popcountll(g->colors & fb_colors[secret]);
+#else
+    uint8_t left[COLORS];
+    (void) memcpy(left, g->count, sizeof(left));
+    common = 0;
+    for (int j = 0; j < SLOTS; j++) {
+        int c = (secret >> (j * SHIFT_WIDTH)) & SLOT_MASK;
+        int hit = left[c] != 0;
+        common += hit;
+        left[c] -= hit;
+    }
+#endif
+    return red | ((common - red) << PEG_BITS);
+}
+
+/**
+ * @brief Compares a guess with a secret.
+ * @param guess encoded guess (parity bit is ignored)
+ * @param secret encoded secret
+ * @return response with red pegs in the low and white pegs in the next PEG_BITS bits
+ */
+static inline resp_t fb_score(code_t guess, code_t secret)
+{
+    struct fb_guess g;
+
+    fb_prepare(&g, guess);
+    return fb_score_prepared(&g, secret);
+}
+
+/**
+ * @brief Returns the parity bit of an encoded combination.
+ * @param code encoded combination (parity bit is ignored)
+ * @return the parity bit
+ */
+static inline uint8_t fb_code_parity(uint64_t code)
+{
+    return codec_parity(code & CODE_MASK);
+}
+
+/**
+ * @brief Checks that every slot of a code holds a valid colour.
+ * @param code encoded combination without parity bit
+ * @return non-zero if the code is a valid combination
+ */
+static inline int fb_code_valid(uint64_t code)
+{
+    if (code > CODE_MASK) {
+        return 0;
+    }
+#if COLORS < (1 << SHIFT_WIDTH)
+    for (int j = 0; j < SLOTS; j++) {
+        if (((code >> (j * SHIFT_WIDTH)) & SLOT_MASK) >= COLORS) {
+            return 0;
+        }
+    }
+#endif
+    return 1;
+}
+
+/**
+ * @brief Returns the wire format of a guess, i.e. the code with its parity bit.
+ * @param code encoded guess
+ * @return value to be sent in GUESS_BYTES bytes
+ */
+static inline uint64_t fb_wire_guess(code_t code)
+{
+    return codec_add_parity(code & CODE_MASK, GUESS_PARITY_BIT);
+}
+
+#endif /* FEEDBACK_H */
@@ -0,0 +1,119 @@
+/**
+ * @file genmatrix.c
+ * @date 2017-04-30
+ *
+ * @brief Writes the feedback matrix file used by the solver's matrix mode
+ *        (see matrix.h), e.g. ./genmatrix feedback.matrix && ./average -m feedback.matrix
+ **/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+
+#include "matrix.h"
+#include "solver.h"
+#include "feedback.h"
+
+/* === Global Variables === */
+
+/* @brief Name of the program */
+static const char *progname = "genmatrix";
+
+/* @brief The file being written, removed on errors */
+static FILE *out = NULL;
+static const char *out_path = NULL;
+
+/* === Prototypes === */
+
+/**
+ * @brief terminate program on program error
+ * @param exitcode exit code
+ * @param fmt format string
+ */
+static void bail_out(int exitcode, const char *fmt, ...);
+
+/* === Implementations === */
+
+/**
+ * @brief Program entry point
+ * @param argc The argument counter
+ * @param argv The argument vector, argv[1] is the file to write
+ * @return EXIT_SUCCESS on success
+ */
+int main(int argc, char *argv[])
+{
+    static uint8_t header[MATRIX_HEADER_BYTES];
+    struct matrix_header h;
+    code_t *codes;
+    uint8_t *row;
+
+    if (argc > 0) {
+        progname = argv[0];
+    }
+    if (argc != 2) {
+        bail_out(EXIT_FAILURE, "Usage: %s <file>", progname);
+    }
+
+    matrix_header_init(&h);
+    if ((codes = malloc(COMBINATIONS * sizeof(*codes))) == NULL
+        || (row = malloc(h.row_bytes)) == NULL) {
+        bail_out(EXIT_FAILURE, "malloc");
+    }
+    for (long i = 0; i < COMBINATIONS; i++) {
+        codes[i] = solver_code(i);
+    }
+
+    out_path = argv[1];
+    if ((out = fopen(out_path, "w")) == NULL) {
+        bail_out(EXIT_FAILURE, "fopen %s", out_path);
+    }
+    (void) memcpy(header, &h, sizeof(h));
+    if (fwrite(header, sizeof(header), 1, out) != 1) {
+        bail_out(EXIT_FAILURE, "fwrite");
+    }
+    for (long g = 0; g < COMBINATIONS; g++) {
+        struct fb_guess guess;
+
+        fb_prepare(&guess, codes[g]);
+        (void) memset(row, 0, h.row_bytes);
+        for (long s = 0; s < COMBINATIONS; s++) {
+            matrix_set(h.bits, row, s, h.class_of[fb_score_prepared(&guess, codes[s])]);
+        }
+        if (fwrite(row, h.row_bytes, 1, out) != 1) {
+            bail_out(EXIT_FAILURE, "fwrite");
+        }
+    }
+    if (fclose(out) != 0) {
+        out = NULL;
+        bail_out(EXIT_FAILURE, "fclose");
+    }
+    (void) printf("%s: %ld x %ld entries of %d bits, %.1f MiB\n", out_path,
+        (long) COMBINATIONS, (long) COMBINATIONS, (int) h.bits,
+        (MATRIX_HEADER_BYTES + (double) COMBINATIONS * h.row_bytes) / (1 << 20));
+    free(codes);
+    free(row);
+    return EXIT_SUCCESS;
+}
+
+static void bail_out(int exitcode, const char *fmt, ...)
+{
+    va_list ap;
+
+    (void) fprintf(stderr, "%s: ", progname);
+    if (fmt != NULL) {
+        va_start(ap, fmt);
+        (void) vfprintf(stderr, fmt, ap);
+        va_end(ap);
+    }
+    if (errno != 0) {
+        (void) fprintf(stderr, ": %s", strerror(errno));
+    }
+    (void) fprintf(stderr, "\n");
+
+    if (out != NULL) {
+        (void) fclose(out);
+        (void) remove(out_path);
+    }
+    exit(exitcode);
+}
@@ -0,0 +1,96 @@
+/**
+ * @file gentables.c
+ * @date 2017-04-16
+ *
+ * @brief Generates the lookup tables used to score guesses (feedback_tables.h
+ *        and feedback_tables.c). Called by make, see feedback.h for their use.
+ *
+ *        fb_colors[code] holds the colour counts of a code in unary: colour c
+ *        owns SLOTS bits starting at bit c * SLOTS, its n-th occurrence sets the
+ *        n-th of these bits. popcount(fb_colors[a] & fb_colors[b]) thus is the
+ *        number of colours a and b have in common (red + white).
+ *
+ *        fb_colors has an entry for every value of CODE_BITS bits, so it is
+ *        only generated for small games (FB_COLOR_TABLE). Larger games count
+ *        the colours while scoring.
+ **/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mastermind.h"
+
+/**
+ * @brief Prints the header with the declarations of the tables.
+ */
+static void print_header(void);
+
+/**
+ * @brief Prints the definitions of the tables.
+ */
+static void print_tables(void);
+
+/**
+ * @brief Program entry point
+ * @param argc The argument counter
+ * @param argv The argument vector, argv[1] is either "h" or "c"
+ * @return EXIT_SUCCESS on success
+ */
+int main(int argc, char *argv[])
+{
+    if (argc != 2 || (strcmp(argv[1], "h") != 0 && strcmp(argv[1], "c") != 0)) {
+        (void) fprintf(stderr, "Usage: %s h|c\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (argv[1][0] == 'h') {
+        print_header();
+    } else {
+        print_tables();
+    }
+    return EXIT_SUCCESS;
+}
+
+static void print_header(void)
+{
+    unsigned long long slot_low = 0;
+    int color_table = CODE_BITS <= 16 && COLORS * SLOTS <= 64;
+
+    for (int j = 0; j < SLOTS; j++) {
+        slot_low |= 1ULL << (j * SHIFT_WIDTH);
+    }
+
+    (void) printf("/* generated by gentables, do not edit */\n");
+    (void) printf("#ifndef FEEDBACK_TABLES_H\n#define FEEDBACK_TABLES_H\n\n");
+    (void) printf("#include <stdint.h>\n\n");
+    (void) printf("/* lowest bit of every slot of a code */\n");
+    (void) printf("#define FB_SLOT_LOW (0x%llxULL)\n\n", slot_low);
+    (void) printf("#define FB_COLOR_TABLE (%d)\n\n", color_table);
+    if (color_table) {
+        (void) printf("extern const uint64_t fb_colors[%ld];\n", 1L << CODE_BITS);
+    }
+    (void) printf("\n#endif /* FEEDBACK_TABLES_H */\n");
+}
+
+static void print_tables(void)
+{
+    (void) printf("/* generated by gentables, do not edit */\n");
+    (void) printf("#include \"feedback_tables.h\"\n\n");
+
+    if (CODE_BITS <= 16 && COLORS * SLOTS <= 64) {
+        (void) printf("const uint64_t fb_colors[%ld] = {\n", 1L << CODE_BITS);
+        for (long code = 0; code < 1L << CODE_BITS; code++) {
+            int count[1 << SHIFT_WIDTH] = {0};
+            uint64_t colors = 0;
+            for (int j = 0; j < SLOTS; j++) {
+                int c = (code >> (j * SHIFT_WIDTH)) & SLOT_MASK;
+                /* slots with an invalid colour don't match anything */
+                if (c < COLORS) {
+                    colors |= (uint64_t) 1 << (c * SLOTS + count[c]++);
+                }
+            }
+            (void) printf("0x%llxULL,%s", (unsigned long long) colors, code % 8 == 7 ? "\n" : " ");
+        }
+        (void) printf("};\n");
+    }
+}
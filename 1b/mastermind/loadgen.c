@@ -0,0 +1,756 @@
+/**
+ * @file loadgen.c
+ * @date 2017-04-09
+ *
+ * @brief Load generator for the mastermind server. Keeps many connections open
+ *        at the same time, each playing full games with the solver, spread over
+ *        several threads with an epoll instance each. Reports
+ *        games/s, latency percentiles of the round trips and, if the pid of the
+ *        server is given, the server's CPU time per game.
+ **/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <time.h>
+#include <getopt.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netdb.h>
+#include <pthread.h>
+
+#include "solver.h"
+#include "feedback.h"
+#include "sockio.h"
+
+/* Maximum number of events handled per epoll_wait() */
+#define MAX_EVENTS (256)
+
+/* Milliseconds a loader sleeps in epoll_wait before checking `quit`, the
+   duration and the deadlines of its connections */
+#define POLL_TIMEOUT (100)
+
+/* Milliseconds a connection waits for the connect or an answer of the server
+   before its game counts as failed */
+#define ROUND_TIMEOUT (5000)
+
+/* Size of the send and receive buffers of a connection */
+#define FRAME_BYTES (1 + MAX_BATCH * (GUESS_BYTES > RESP_BYTES ? GUESS_BYTES : RESP_BYTES))
+
+/* === Type Definitions === */
+
+/* @brief States of a connection */
+enum state {
+    CONNECTING,   /* < non-blocking connect() in progress */
+    HELLO,        /* < waiting for the answer to PROTO_HELLO */
+    PLAYING       /* < waiting for the responses to the sent guesses */
+};
+
+/* @brief One connection playing one game after another */
+struct connection {
+    int fd;
+    enum state state;
+    int batch;                         /* < guesses per round trip, 1 for the original protocol */
+    int round;                         /* < rounds played in the current game */
+    int sent;                          /* < guesses waiting for a response */
+    code_t guesses[MAX_BATCH];
+    struct sockio io;
+    uint8_t in[FRAME_BYTES];
+    uint8_t out[FRAME_BYTES];
+    struct timespec sent_at;           /* < time the connect started or the guesses were sent */
+    struct solver solver;
+};
+
+/* @brief Parsed arguments */
+struct opts {
+    const char *host;
+    const char *port;
+    int connections;
+    int threads;
+    int batch;
+    long games;            /* < stop after this many games, 0 for no limit */
+    double duration;       /* < stop starting games after this many seconds */
+    long server_pid;       /* < pid of the server for the CPU statistics, 0 if unknown */
+    enum strategy strategy;
+};
+
+/* @brief Collected measurements */
+struct stats {
+    long started;
+    long won;
+    long failed;           /* < games lost or aborted by an error */
+    long rounds;
+    uint64_t *latencies;   /* < round trip times in nanoseconds */
+    size_t nlatencies;
+    size_t capacity;
+};
+
+/* @brief A thread driving its share of the connections */
+struct loader {
+    pthread_t thread;
+    int epfd;
+    int nconns;
+    long games;                /* < games this loader plays, -1 for no limit */
+    struct connection *conns;
+    const struct opts *options;
+    struct stats stats;
+};
+
+/* === Global Variables === */
+
+/* @brief Name of the program */
+static const char *progname = "loadgen";
+
+/* @brief Address of the server */
+static struct addrinfo *server_addr = NULL;
+
+/* @brief Time the load generator started */
+static struct timespec start;
+
+/* @brief This variable is set upon receipt of a signal */
+volatile sig_atomic_t quit = 0;
+
+/* === Prototypes === */
+
+/**
+ * @brief Parse command line options
+ * @param argc The argument counter
+ * @param argv The argument vector
+ * @param options Struct where parsed arguments are stored
+ */
+static void parse_args(int argc, char **argv, struct opts *options);
+
+/**
+ * @brief Thread function: plays games on the loader's connections until the
+ *        duration or the number of games is reached. After the duration the
+ *        running games are finished, a signal aborts them. A game whose
+ *        server did not answer within ROUND_TIMEOUT fails.
+ * @param arg the struct loader
+ * @return NULL
+ */
+static void *run_loader(void *arg);
+
+/**
+ * @brief Opens a new connection and starts a game on it.
+ * @param l the loader owning the connection
+ * @param c the connection
+ * @return true on success
+ */
+static bool start_game(struct loader *l, struct connection *c);
+
+/**
+ * @brief Sends the next guess or batch of guesses of the current game.
+ * @param c the connection
+ * @return true on success
+ */
+static bool send_guesses(struct connection *c);
+
+/**
+ * @brief Handles an event on a connection.
+ * @param l the loader owning the connection
+ * @param c the connection
+ * @param events the epoll events
+ * @param stats collected measurements
+ * @return true if the game is over (won, lost or failed)
+ */
+static bool handle_event(struct loader *l, struct connection *c, uint32_t events, struct stats *stats);
+
+/**
+ * @brief Processes complete responses in the receive buffer.
+ * @param c the connection
+ * @param stats collected measurements
+ * @return 1 if the game is over, 0 if it goes on, -1 on a protocol error
+ */
+static int process_responses(struct connection *c, struct stats *stats);
+
+/**
+ * @brief Adds a latency sample.
+ * @param stats collected measurements
+ * @param ns round trip time in nanoseconds
+ */
+static void add_latency(struct stats *stats, uint64_t ns);
+
+/**
+ * @brief Closes the socket of a connection.
+ * @param c the connection
+ */
+static void close_connection(struct connection *c);
+
+/**
+ * @brief Adds the measurements of a loader to the total.
+ * @param total merged measurements
+ * @param stats measurements of one loader
+ */
+static void merge_stats(struct stats *total, struct stats *stats);
+
+/**
+ * @brief Prints the collected measurements.
+ * @param stats collected measurements
+ * @param seconds duration of the run
+ * @param server_cpu CPU seconds used by the server, negative if unknown
+ */
+static void print_stats(struct stats *stats, double seconds, double server_cpu);
+
+/**
+ * @brief Reads the CPU time used by a process from /proc.
+ * @param pid the process
+ * @return user and system time in seconds, negative on error
+ */
+static double process_cpu(long pid);
+
+/**
+ * @brief Returns the difference between two points in time in nanoseconds.
+ * @param from start
+ * @param to end
+ * @return to - from in nanoseconds
+ */
+static uint64_t diff_ns(const struct timespec *from, const struct timespec *to);
+
+/**
+ * @brief compares two latencies, used by qsort
+ */
+static int compare_latency(const void *a, const void *b);
+
+/**
+ * @brief terminate program on program error
+ * @param exitcode exit code
+ * @param fmt format string
+ */
+static void bail_out(int exitcode, const char *fmt, ...);
+
+/**
+ * @brief Signal handler
+ * @param sig Signal number catched
+ */
+static void signal_handler(int sig);
+
+/* === Implementations === */
+
+/**
+ * @brief Program entry point
+ * @param argc The argument counter
+ * @param argv The argument vector
+ * @return EXIT_SUCCESS if no game failed
+ */
+int main(int argc, char *argv[])
+{
+    struct opts options;
+    struct stats stats;
+    struct loader *loaders;
+    struct timespec now;
+    struct addrinfo hints;
+    struct sigaction s;
+    double cpu_before = -1, cpu_after = -1;
+    int res;
+
+    parse_args(argc, argv, &options);
+
+    s.sa_handler = signal_handler;
+    s.sa_flags = 0;
+    (void) sigemptyset(&s.sa_mask);
+    if (sigaction(SIGINT, &s, NULL) < 0 || sigaction(SIGTERM, &s, NULL) < 0) {
+        bail_out(EXIT_FAILURE, "sigaction");
+    }
+    s.sa_handler = SIG_IGN;
+    if (sigaction(SIGPIPE, &s, NULL) < 0) {
+        bail_out(EXIT_FAILURE, "sigaction");
+    }
+
+    (void) memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if ((res = getaddrinfo(options.host, options.port, &hints, &server_addr)) != 0) {
+        bail_out(EXIT_FAILURE, "getaddrinfo: %s", gai_strerror(res));
+    }
+
+    if ((loaders = calloc(options.threads, sizeof(*loaders))) == NULL) {
+        bail_out(EXIT_FAILURE, "calloc");
+    }
+    for (int i = 0; i < options.threads; i++) {
+        struct loader *l = &loaders[i];
+        l->options = &options;
+        /* spread the connections and games evenly */
+        l->nconns = options.connections / options.threads
+            + (i < options.connections % options.threads);
+        l->games = options.games == 0 ? -1 : options.games / options.threads
+            + (i < options.games % options.threads);
+        if ((l->conns = calloc(l->nconns, sizeof(*l->conns))) == NULL) {
+            bail_out(EXIT_FAILURE, "calloc");
+        }
+        for (int j = 0; j < l->nconns; j++) {
+            if (solver_alloc(&l->conns[j].solver) < 0) {
+                bail_out(EXIT_FAILURE, "malloc");
+            }
+        }
+        if ((l->epfd = epoll_create(MAX_EVENTS)) < 0) {
+            bail_out(EXIT_FAILURE, "epoll_create");
+        }
+    }
+
+    if (options.server_pid > 0 && (cpu_before = process_cpu(options.server_pid)) < 0) {
+        bail_out(EXIT_FAILURE, "Cannot read CPU time of process %ld", options.server_pid);
+    }
+    (void) clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 1; i < options.threads; i++) {
+        errno = pthread_create(&loaders[i].thread, NULL, run_loader, &loaders[i]);
+        if (errno != 0) {
+            bail_out(EXIT_FAILURE, "pthread_create");
+        }
+    }
+    (void) run_loader(&loaders[0]);
+    for (int i = 1; i < options.threads; i++) {
+        (void) pthread_join(loaders[i].thread, NULL);
+    }
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &now);
+    if (options.server_pid > 0) {
+        cpu_after = process_cpu(options.server_pid);
+    }
+
+    (void) memset(&stats, 0, sizeof(stats));
+    for (int i = 0; i < options.threads; i++) {
+        merge_stats(&stats, &loaders[i].stats);
+        free(loaders[i].stats.latencies);
+        for (int j = 0; j < loaders[i].nconns; j++) {
+            solver_free(&loaders[i].conns[j].solver);
+        }
+        free(loaders[i].conns);
+        (void) close(loaders[i].epfd);
+    }
+    print_stats(&stats, diff_ns(&start, &now) / 1e9,
+        cpu_before >= 0 && cpu_after >= 0 ? cpu_after - cpu_before : -1);
+
+    free(stats.latencies);
+    free(loaders);
+    freeaddrinfo(server_addr);
+    return stats.failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static void *run_loader(void *arg)
+{
+    struct loader *l = arg;
+    const struct opts *options = l->options;
+    struct timespec checked;         /* < last check of the deadlines */
+    int active = 0;
+
+    for (int i = 0; i < l->nconns; i++) {
+        l->conns[i].fd = -1;
+        if (start_game(l, &l->conns[i])) {
+            active++;
+        }
+    }
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &checked);
+    while (active > 0) {
+        struct epoll_event events[MAX_EVENTS];
+        struct timespec now;
+        int n = epoll_wait(l->epfd, events, MAX_EVENTS, POLL_TIMEOUT);
+        bool stop;
+
+        if (n < 0) {
+            if (errno != EINTR) {
+                bail_out(EXIT_FAILURE, "epoll_wait");
+            }
+            n = 0; /* <-- a signal, check `quit` */
+        }
+        (void) clock_gettime(CLOCK_MONOTONIC, &now);
+        stop = quit || diff_ns(&start, &now) / 1e9 >= options->duration;
+
+        for (int i = 0; i < n; i++) {
+            struct connection *c = events[i].data.ptr;
+            if (c->fd < 0 || !handle_event(l, c, events[i].events, &l->stats)) {
+                continue;
+            }
+            close_connection(c);
+            if (stop || !start_game(l, c)) {
+                active--;
+            }
+        }
+
+        /* the deadlines are checked once per POLL_TIMEOUT, a signal aborts all games;
+           the guesses sent above are younger than `now` */
+        if (!quit && diff_ns(&checked, &now) < POLL_TIMEOUT * 1000000ULL) {
+            continue;
+        }
+        (void) clock_gettime(CLOCK_MONOTONIC, &now);
+        checked = now;
+        for (int i = 0; i < l->nconns; i++) {
+            struct connection *c = &l->conns[i];
+            if (c->fd < 0 || (!quit && diff_ns(&c->sent_at, &now) < ROUND_TIMEOUT * 1000000ULL)) {
+                continue;
+            }
+            l->stats.failed++;
+            close_connection(c);
+            if (stop || !start_game(l, c)) {
+                active--;
+            }
+        }
+    }
+    return NULL;
+}
+
+static bool start_game(struct loader *l, struct connection *c)
+{
+    const struct opts *options = l->options;
+    struct epoll_event ev;
+
+    if (l->games >= 0 && l->stats.started >= l->games) {
+        return false;
+    }
+    c->fd = socket(server_addr->ai_family, server_addr->ai_socktype, server_addr->ai_protocol);
+    if (c->fd < 0) {
+        bail_out(EXIT_FAILURE, "socket");
+    }
+    if (fcntl(c->fd, F_SETFL, O_NONBLOCK) < 0) {
+        bail_out(EXIT_FAILURE, "fcntl");
+    }
+    if (connect(c->fd, server_addr->ai_addr, server_addr->ai_addrlen) < 0
+        && errno != EINPROGRESS) {
+        bail_out(EXIT_FAILURE, "connect");
+    }
+    c->state = CONNECTING;
+    (void) clock_gettime(CLOCK_MONOTONIC, &c->sent_at);
+    c->batch = options->batch;
+    c->round = 0;
+    c->sent = 0;
+    sockio_init(&c->io, c->fd, c->in, sizeof(c->in), c->out, sizeof(c->out));
+    solver_init(&c->solver, options->strategy);
+
+    ev.events = EPOLLOUT;
+    ev.data.ptr = c;
+    if (epoll_ctl(l->epfd, EPOLL_CTL_ADD, c->fd, &ev) < 0) {
+        bail_out(EXIT_FAILURE, "epoll_ctl");
+    }
+    l->stats.started++;
+    return true;
+}
+
+static bool send_guesses(struct connection *c)
+{
+    uint8_t buff[FRAME_BYTES];
+    size_t len = 0;
+
+    if (c->state == HELLO) {
+        codec_put(buff, PROTO_HELLO, GUESS_BYTES);
+        len += GUESS_BYTES;
+    } else if (c->batch > 1) {
+        int left = MAX_TRIES - c->round;
+        c->sent = solver_next_guesses(&c->solver, c->guesses, c->batch < left ? c->batch : left);
+        buff[len++] = c->sent;
+    } else {
+        c->guesses[0] = solver_next_guess(&c->solver);
+        c->sent = 1;
+    }
+    for (int i = 0; c->state == PLAYING && i < c->sent; i++) {
+        codec_put(buff + len, fb_wire_guess(c->guesses[i]), GUESS_BYTES);
+        len += GUESS_BYTES;
+    }
+    (void) clock_gettime(CLOCK_MONOTONIC, &c->sent_at);
+    /* a few bytes always fit into the empty socket buffer */
+    return sockio_write(&c->io, buff, len) == 0 && sockio_flush(&c->io) == 0;
+}
+
+static bool handle_event(struct loader *l, struct connection *c, uint32_t events, struct stats *stats)
+{
+    if (c->state == CONNECTING) {
+        struct epoll_event ev;
+        int err = 0;
+        socklen_t len = sizeof(err);
+
+        if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+            stats->failed++;
+            return true;
+        }
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        if (epoll_ctl(l->epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0) {
+            bail_out(EXIT_FAILURE, "epoll_ctl");
+        }
+        c->state = c->batch > 1 ? HELLO : PLAYING;
+        if (!send_guesses(c)) {
+            stats->failed++;
+            return true;
+        }
+        return false;
+    }
+
+    /* the server answers only what was sent, one read gets all there is */
+    ssize_t r = sockio_fill(&c->io);
+    int res;
+
+    if (r == SOCKIO_AGAIN) {
+        return false;
+    }
+    if (r <= 0) {
+        stats->failed++;
+        return true;
+    }
+    if ((res = process_responses(c, stats)) != 0) {
+        if (res < 0) {
+            stats->failed++;
+        }
+        return true;
+    }
+    return false;
+}
+
+static int process_responses(struct connection *c, struct stats *stats)
+{
+    const uint8_t *in = sockio_data(&c->io);
+    size_t received = sockio_buffered(&c->io);
+    struct timespec now;
+    size_t need;
+    size_t pos = 0;
+    int answered = 1;
+
+    if (c->state == HELLO) {
+        if (received >= RESP_BYTES && codec_get(in, RESP_BYTES) != PROTO_ACK) {
+            return -1;
+        }
+        if (received < RESP_BYTES + 1) {
+            return 0;
+        }
+        if (in[RESP_BYTES] < c->batch) {
+            c->batch = in[RESP_BYTES];
+        }
+        sockio_consume(&c->io, RESP_BYTES + 1);
+        c->state = PLAYING;
+        return send_guesses(c) ? 0 : -1;
+    }
+
+    if (c->batch > 1) {
+        if (received < 1) {
+            return 0;
+        }
+        answered = in[pos++];
+        if (answered < 1 || answered > c->sent) {
+            return -1;
+        }
+    }
+    need = pos + answered * RESP_BYTES;
+    if (received < need) {
+        return 0;
+    }
+    (void) clock_gettime(CLOCK_MONOTONIC, &now);
+    add_latency(stats, diff_ns(&c->sent_at, &now));
+
+    for (int i = 0; i < answered; i++) {
+        resp_t response = codec_get(in + pos + i * RESP_BYTES, RESP_BYTES);
+        c->round++;
+        stats->rounds++;
+        if (RESP_ERRORS(response)) {
+            return -1;
+        }
+        if (RESP_RED(response) == SLOTS) {
+            stats->won++;
+            return 1;
+        }
+        (void) solver_update(&c->solver, c->guesses[i], response);
+    }
+    sockio_consume(&c->io, need);
+    if (answered < c->sent || c->round >= MAX_TRIES) {
+        return -1;
+    }
+    return send_guesses(c) ? 0 : -1;
+}
+
+static void add_latency(struct stats *stats, uint64_t ns)
+{
+    if (stats->nlatencies == stats->capacity) {
+        size_t capacity = stats->capacity == 0 ? 4096 : 2 * stats->capacity;
+        uint64_t *tmp = realloc(stats->latencies, capacity * sizeof(*tmp));
+        if (tmp == NULL) {
+            bail_out(EXIT_FAILURE, "realloc");
+        }
+        stats->latencies = tmp;
+        stats->capacity = capacity;
+    }
+    stats->latencies[stats->nlatencies++] = ns;
+}
+
+static void close_connection(struct connection *c)
+{
+    if (c->fd >= 0) {
+        (void) close(c->fd);
+        c->fd = -1;
+    }
+}
+
+static void merge_stats(struct stats *total, struct stats *stats)
+{
+    total->started += stats->started;
+    total->won += stats->won;
+    total->failed += stats->failed;
+    total->rounds += stats->rounds;
+    for (size_t i = 0; i < stats->nlatencies; i++) {
+        add_latency(total, stats->latencies[i]);
+    }
+}
+
+static void print_stats(struct stats *stats, double seconds, double server_cpu)
+{
+    const double percentiles[] = {50, 99, 99.9};
+    const char *names[] = {"p50", "p99", "p999"};
+    long games = stats->won + stats->failed;
+
+    (void) printf("games      %ld won, %ld failed in %.2fs\n", stats->won, stats->failed, seconds);
+    (void) printf("games/s    %.1f\n", games / seconds);
+    (void) printf("rounds/s   %.1f\n", stats->rounds / seconds);
+    if (stats->won > 0) {
+        (void) printf("rounds     %.3f per game\n", (double) stats->rounds / stats->won);
+    }
+    if (stats->nlatencies > 0) {
+        qsort(stats->latencies, stats->nlatencies, sizeof(*stats->latencies), compare_latency);
+        for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++) {
+            size_t idx = (size_t) (percentiles[i] / 100 * (stats->nlatencies - 1) + 0.5);
+            (void) printf("%-10s %.1fus\n", names[i], stats->latencies[idx] / 1e3);
+        }
+    }
+    if (server_cpu >= 0 && games > 0) {
+        (void) printf("server cpu %.1fus per game\n", server_cpu / games * 1e6);
+    }
+}
+
+static double process_cpu(long pid)
+{
+    char path[64];
+    char line[1024];
+    char *p;
+    unsigned long utime, stime;
+    FILE *f;
+
+    (void) snprintf(path, sizeof(path), "/proc/%ld/stat", pid);
+    if ((f = fopen(path, "r")) == NULL) {
+        return -1;
+    }
+    p = fgets(line, sizeof(line), f);
+    (void) fclose(f);
+    /* the command name may contain spaces, fields are counted from its end */
+    if (p == NULL || (p = strrchr(line, ')')) == NULL) {
+        return -1;
+    }
+    if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+            &utime, &stime) != 2) {
+        return -1;
+    }
+    return (double) (utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+static uint64_t diff_ns(const struct timespec *from, const struct timespec *to)
+{
+    return (uint64_t) (to->tv_sec - from->tv_sec) * 1000000000 + to->tv_nsec - from->tv_nsec;
+}
+
+static int compare_latency(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+static void signal_handler(int sig)
+{
+    quit = 1;
+}
+
+static void bail_out(int exitcode, const char *fmt, ...)
+{
+    va_list ap;
+
+    (void) fprintf(stderr, "%s: ", progname);
+    if (fmt != NULL) {
+        va_start(ap, fmt);
+        (void) vfprintf(stderr, fmt, ap);
+        va_end(ap);
+    }
+    if (errno != 0) {
+        (void) fprintf(stderr, ": %s", strerror(errno));
+    }
+    (void) fprintf(stderr, "\n");
+    exit(exitcode);
+}
+
+static void parse_args(int argc, char **argv, struct opts *options)
+{
+    const char *usage = "Usage: %s [-c connections] [-t threads] [-b batch] [-n games] [-d seconds] "
+        "[-s strategy] [-P server-pid] <hostname> <server-port>";
+    char *endptr;
+    int opt;
+    int strategy;
+
+    if (argc > 0) {
+        progname = argv[0];
+    }
+    options->connections = 100;
+    options->threads = 1;
+    options->batch = 1;
+    options->games = 0;
+    options->duration = 5;
+    options->server_pid = 0;
+    options->strategy = STRATEGY_DISTINCT;
+
+    while ((opt = getopt(argc, argv, "c:t:b:n:d:s:P:")) != -1) {
+        switch (opt) {
+        case 'c':
+            options->connections = strtol(optarg, &endptr, 10);
+            if (*endptr != '\0' || options->connections < 1) {
+                bail_out(EXIT_FAILURE, "Invalid number of connections '%s'", optarg);
+            }
+            break;
+        case 't':
+            options->threads = strtol(optarg, &endptr, 10);
+            if (*endptr != '\0' || options->threads < 1) {
+                bail_out(EXIT_FAILURE, "Invalid number of threads '%s'", optarg);
+            }
+            break;
+        case 'b':
+            options->batch = strtol(optarg, &endptr, 10);
+            if (*endptr != '\0' || options->batch < 1 || options->batch > MAX_BATCH) {
+                bail_out(EXIT_FAILURE, "Batch size has to be in 1-%d", MAX_BATCH);
+            }
+            break;
+        case 'n':
+            options->games = strtol(optarg, &endptr, 10);
+            if (*endptr != '\0' || options->games < 0) {
+                bail_out(EXIT_FAILURE, "Invalid number of games '%s'", optarg);
+            }
+            break;
+        case 'd':
+            options->duration = strtod(optarg, &endptr);
+            if (*endptr != '\0' || options->duration <= 0) {
+                bail_out(EXIT_FAILURE, "Invalid duration '%s'", optarg);
+            }
+            break;
+        case 's':
+            if ((strategy = solver_strategy(optarg)) < 0) {
+                bail_out(EXIT_FAILURE, "Unknown strategy '%s'", optarg);
+            }
+            options->strategy = strategy;
+            break;
+        case 'P':
+            options->server_pid = strtol(optarg, &endptr, 10);
+            if (*endptr != '\0' || options->server_pid < 1) {
+                bail_out(EXIT_FAILURE, "Invalid pid '%s'", optarg);
+            }
+            break;
+        default:
+            bail_out(EXIT_FAILURE, usage, progname);
+        }
+    }
+    if (argc - optind != 2) {
+        bail_out(EXIT_FAILURE, usage, progname);
+    }
+    if (options->threads > options->connections) {
+        options->threads = options->connections;
+    }
+    options->host = argv[optind];
+    options->port = argv[optind + 1];
+}
@@ -0,0 +1,30 @@
+#!/bin/sh
+# @file loadtest.sh
+# @brief Starts the server on localhost with 1, 2, 4, ... up to one worker per
+#        core and runs the load generator against each of them for SECONDS.
+#        Prints games/s, rounds/s, round trip percentiles and server CPU per game.
+#
+# usage: loadtest.sh [CONNECTIONS] [SECONDS] [BATCH]
+
+PORT=${PORT:-4242}
+CONNECTIONS=${1:-1000}
+SECONDS_PER_RUN=${2:-5}
+BATCH=${3:-1}
+CORES=$(nproc)
+
+trap 'kill $server 2>/dev/null' EXIT
+
+workers=1
+while [ "$workers" -le "$CORES" ]; do
+    ./server -w "$workers" "$PORT" >/dev/null 2>&1 &
+    server=$!
+    sleep 0.2
+
+    echo "=== $workers worker(s), $CONNECTIONS connections, batch $BATCH ==="
+    ./loadgen -c "$CONNECTIONS" -t "$CORES" -b "$BATCH" -d "$SECONDS_PER_RUN" \
+        -P "$server" localhost "$PORT"
+
+    kill -INT "$server"
+    wait "$server" 2>/dev/null
+    workers=$(( workers * 2 ))
+done
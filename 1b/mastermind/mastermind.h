@@ -0,0 +1,120 @@
+/**
+ * @file mastermind.h
+ * @date 2017-04-02
+ *
+ * @brief Game constants shared by the mastermind server, client and tools.
+ *        SLOTS and COLORS can be overridden at compile time (make SLOTS=6
+ *        COLORS=10), everything else is derived from them. Server and client
+ *        have to be built with the same values.
+ **/
+#ifndef MASTERMIND_H
+#define MASTERMIND_H
+
+#include <stdint.h>
+
+#define MAX_TRIES (35)
+
+#ifndef SLOTS
+#define SLOTS (5)
+#endif
+#ifndef COLORS
+#define COLORS (8)
+#endif
+
+#if SLOTS < 1 || SLOTS > 12
+#error "SLOTS has to be in 1-12"
+#endif
+#if COLORS < 2 || COLORS > 16
+#error "COLORS has to be in 2-16"
+#endif
+
+/* Bits per slot of an encoded combination */
+#if COLORS <= 2
+#define SHIFT_WIDTH (1)
+#elif COLORS <= 4
+#define SHIFT_WIDTH (2)
+#elif COLORS <= 8
+#define SHIFT_WIDTH (3)
+#else
+#define SHIFT_WIDTH (4)
+#endif
+
+/* Bits of an encoded combination, the wire format adds a parity bit on top */
+#define CODE_BITS (SLOTS * SHIFT_WIDTH)
+
+/* @brief An encoded combination: slot i holds its colour in bits
+          i * SHIFT_WIDTH to (i + 1) * SHIFT_WIDTH - 1 */
+#if CODE_BITS <= 15
+typedef uint16_t code_t;
+#elif CODE_BITS <= 31
+typedef uint32_t code_t;
+#else
+typedef uint64_t code_t;
+#endif
+
+/* Number of possible combinations, COLORS to the power of SLOTS */
+#define POW_STEP(i) (SLOTS > (i) ? COLORS : 1)
+#define COMBINATIONS ((long) POW_STEP(0) * POW_STEP(1) * POW_STEP(2) * POW_STEP(3) \
+    * POW_STEP(4) * POW_STEP(5) * POW_STEP(6) * POW_STEP(7) \
+    * POW_STEP(8) * POW_STEP(9) * POW_STEP(10) * POW_STEP(11))
+
+/* The solver keeps every combination in memory, 2^32 of them already take 32 GiB */
+#if POW_STEP(0) * POW_STEP(1) * POW_STEP(2) * POW_STEP(3) * POW_STEP(4) * POW_STEP(5) \
+    * POW_STEP(6) * POW_STEP(7) * POW_STEP(8) * POW_STEP(9) * POW_STEP(10) \
+    * POW_STEP(11) > 4294967296
+#error "COLORS to the power of SLOTS has to be at most 2^32"
+#endif
+
+/* Bits needed for a number of pegs (0..SLOTS) in a response */
+#if SLOTS <= 7
+#define PEG_BITS (3)
+#else
+#define PEG_BITS (4)
+#endif
+
+#define PARITY_ERR_BIT (2 * PEG_BITS)
+#define GAME_LOST_ERR_BIT (2 * PEG_BITS + 1)
+
+/* Wire format: a guess is sent as GUESS_BYTES little endian bytes, the code in
+   the low bits and its parity in the highest bit; a response is sent as
+   RESP_BYTES little endian bytes. The default 5x8 game uses 2 and 1 bytes. */
+#define GUESS_BYTES ((CODE_BITS + 1 + 7) / 8)
+#define GUESS_PARITY_BIT (GUESS_BYTES * 8 - 1)
+#define RESP_BYTES ((GAME_LOST_ERR_BIT + 1 + 7) / 8)
+
+/* @brief A response: red pegs, white pegs and the error bits */
+#if RESP_BYTES == 1
+typedef uint8_t resp_t;
+#else
+typedef uint16_t resp_t;
+#endif
+
+#define EXIT_PARITY_ERROR (2)
+#define EXIT_GAME_LOST (3)
+#define EXIT_MULTIPLE_ERRORS (4)
+
+/* Mask of one slot inside an encoded combination */
+#define SLOT_MASK ((1 << SHIFT_WIDTH) - 1)
+
+/* Number of red respectively white pegs in a response */
+#define RESP_RED(resp) ((resp) & ((1 << PEG_BITS) - 1))
+#define RESP_WHITE(resp) (((resp) >> PEG_BITS) & ((1 << PEG_BITS) - 1))
+#define RESP_ERRORS(resp) ((resp) >> PARITY_ERR_BIT)
+
+/* Batch protocol: a client opens the game with PROTO_HELLO instead of a guess.
+   Its parity bit is wrong on purpose, so an old server answers with a parity
+   error and ends the game (the original server exits), while a new server
+   answers with PROTO_ACK followed by the maximum batch size. A client can
+   therefore not fall back to single guesses, batches need a new server.
+   Afterwards the client sends frames of one count byte n (1..MAX_BATCH) and
+   n guesses, and the server answers with one count byte m and the responses
+   to the first m guesses; m < n if the game ended early. */
+#define PROTO_HELLO ((1ULL << CODE_BITS) - 1 \
+    + (CODE_BITS % 2 == 0 ? 1ULL << GUESS_PARITY_BIT : 0))
+#define PROTO_ACK ((1ULL << (RESP_BYTES * 8)) - 1)
+#define MAX_BATCH (16)
+
+/* Colour letters in the order of their numeric value, the first COLORS are used */
+#define COLOR_CHARS "bdgorsvwacehklmn"
+
+#endif /* MASTERMIND_H */
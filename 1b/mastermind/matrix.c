@@ -0,0 +1,80 @@
+/**
+ * @file matrix.c
+ * @date 2017-04-30
+ *
+ * @brief Mapping of feedback matrix files, see matrix.h.
+ **/
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "matrix.h"
+
+void matrix_header_init(struct matrix_header *h)
+{
+    int classes = 0;
+
+    (void) memset(h, 0, sizeof(*h));
+    (void) memset(h->class_of, MATRIX_NO_CLASS, sizeof(h->class_of));
+    for (int red = 0; red <= SLOTS; red++) {
+        for (int white = 0; red + white <= SLOTS; white++) {
+            /* with all but one slot right the last colour can't be elsewhere */
+            if (red == SLOTS - 1 && white == 1) {
+                continue;
+            }
+            h->class_of[red | (white << PEG_BITS)] = classes++;
+        }
+    }
+    h->magic = MATRIX_MAGIC;
+    h->slots = SLOTS;
+    h->colors = COLORS;
+    h->bits = 1;
+    while ((1 << h->bits) < classes) {
+        h->bits++;
+    }
+    h->combinations = COMBINATIONS;
+    h->row_bytes = (COMBINATIONS * h->bits + 7) / 8 + 1;
+}
+
+int matrix_open(struct matrix *m, const char *path)
+{
+    struct matrix_header expected;
+    struct stat st;
+    int fd;
+
+    (void) memset(m, 0, sizeof(*m));
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) < 0) {
+        (void) close(fd);
+        return -1;
+    }
+    m->size = st.st_size;
+    m->map = mmap(NULL, m->size, PROT_READ, MAP_SHARED, fd, 0);
+    (void) close(fd);
+    if (m->map == MAP_FAILED) {
+        m->map = NULL;
+        return -1;
+    }
+
+    matrix_header_init(&expected);
+    m->header = (const struct matrix_header *) m->map;
+    m->rows = m->map + MATRIX_HEADER_BYTES;
+    if (m->size < MATRIX_HEADER_BYTES + COMBINATIONS * expected.row_bytes
+        || memcmp(m->header, &expected, sizeof(expected)) != 0) {
+        matrix_close(m);
+        return -1;
+    }
+    return 0;
+}
+
+void matrix_close(struct matrix *m)
+{
+    if (m->map != NULL) {
+        (void) munmap((void *) m->map, m->size);
+    }
+    (void) memset(m, 0, sizeof(*m));
+}
@@ -0,0 +1,114 @@
+/**
+ * @file matrix.h
+ * @date 2017-04-30
+ *
+ * @brief Precomputed feedback of every (guess, secret) pair, stored in a file
+ *        written by genmatrix and mapped by the solver (see solver_use_matrix).
+ *        Only the feedback class is stored, e.g. 20 classes in 5 bits for the
+ *        5x8 game: 32768 rows of 20 KiB, 640 MiB in total.
+ *        Rows and columns are numbered in solver order (solver_code).
+ **/
+#ifndef MATRIX_H
+#define MATRIX_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "mastermind.h"
+
+/* Marks a matrix file, changes whenever the layout changes */
+#define MATRIX_MAGIC (0x4d4d5831)
+
+/* Size of the file header, the rows start page aligned behind it */
+#define MATRIX_HEADER_BYTES (4096)
+
+/* Number of possible response values (red and white pegs) */
+#define MATRIX_RESPONSES (1 << PARITY_ERR_BIT)
+
+/* Entry of class_of for responses which cannot occur */
+#define MATRIX_NO_CLASS (0xff)
+
+/* @brief Header at the start of a matrix file */
+struct matrix_header {
+    uint32_t magic;
+    int32_t slots;
+    int32_t colors;
+    int32_t bits;                               /* < bits per entry */
+    int64_t combinations;
+    int64_t row_bytes;                          /* < bytes per row, including one byte padding */
+    uint8_t class_of[MATRIX_RESPONSES];         /* < feedback class of a response */
+};
+
+/* @brief A mapped matrix file */
+struct matrix {
+    const uint8_t *map;                         /* < the whole file */
+    size_t size;
+    const struct matrix_header *header;
+    const uint8_t *rows;
+};
+
+/**
+ * @brief Fills in the header for this game size.
+ * @param h the header
+ */
+void matrix_header_init(struct matrix_header *h);
+
+/**
+ * @brief Maps a matrix file read-only.
+ * @param m the matrix
+ * @param path file written by genmatrix
+ * @return 0 on success, -1 if the file could not be mapped or does not fit this game size
+ */
+int matrix_open(struct matrix *m, const char *path);
+
+/**
+ * @brief Unmaps a matrix.
+ * @param m the matrix
+ */
+void matrix_close(struct matrix *m);
+
+/**
+ * @brief Returns the row of a guess.
+ * @param m the matrix
+ * @param guess number of the guess in solver order
+ * @return the row
+ */
+static inline const uint8_t *matrix_row(const struct matrix *m, long guess)
+{
+    return m->rows + guess * m->header->row_bytes;
+}
+
+/**
+ * @brief Reads the feedback class of a secret from a row.
+ *        An entry spans at most two bytes, so this is a 16 bit load and a shift.
+ * @param m the matrix
+ * @param row row of the guess
+ * @param secret number of the secret in solver order
+ * @return the feedback class
+ */
+static inline int matrix_class(const struct matrix *m, const uint8_t *row, long secret)
+{
+    int bits = m->header->bits;
+    long bit = secret * bits;
+    const uint8_t *p = row + (bit >> 3);
+
+    return ((p[0] | (p[1] << 8)) >> (bit & 7)) & ((1 << bits) - 1);
+}
+
+/**
+ * @brief Stores a feedback class in a row, which has to be zeroed before.
+ * @param bits bits per entry
+ * @param row the row
+ * @param secret number of the secret in solver order
+ * @param class the feedback class
+ */
+static inline void matrix_set(int bits, uint8_t *row, long secret, int class)
+{
+    long bit = secret * bits;
+    unsigned int v = (unsigned int) class << (bit & 7);
+
+    row[bit >> 3] |= v & 0xff;
+    row[(bit >> 3) + 1] |= v >> 8;
+}
+
+#endif /* MATRIX_H */
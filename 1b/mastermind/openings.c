@@ -0,0 +1,90 @@
+/**
+ * @file openings.c
+ * @date 2017-04-23
+ *
+ * @brief Building and mapping of the shared opening tables, see openings.h.
+ **/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "openings.h"
+
+int openings_build(struct openings *o)
+{
+    struct solver solver;
+    struct solver *s = &solver;
+
+    if (solver_alloc(s) < 0) {
+        return -1;
+    }
+    o->slots = SLOTS;
+    o->colors = COLORS;
+    for (int k = 0; k < STRATEGY_COUNT; k++) {
+        struct opening *op = &o->strategies[k];
+        long next[RESPONSES];
+
+        solver_init(s, k);
+        op->guess = solver_next_guess(s);
+
+        /* counting sort by response, keeps the solver order inside a group */
+        (void) memset(op->start, 0, sizeof(op->start));
+        for (long i = 0; i < COMBINATIONS; i++) {
+            op->start[solver_score(op->guess, s->combinations[i]) + 1]++;
+        }
+        for (int r = 0; r < RESPONSES; r++) {
+            op->start[r + 1] += op->start[r];
+            next[r] = op->start[r];
+        }
+        for (long i = 0; i < COMBINATIONS; i++) {
+            code_t code = s->combinations[i];
+            op->codes[next[solver_score(op->guess, code)]++] = code;
+        }
+    }
+    solver_free(s);
+    return 0;
+}
+
+const struct openings *openings_map(void)
+{
+    char name[64];
+    struct stat st;
+    struct openings *o;
+    int fd;
+
+    openings_name(name, sizeof(name));
+    if ((fd = shm_open(name, O_RDONLY, 0)) < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(*o)) {
+        (void) close(fd);
+        return NULL;
+    }
+    o = mmap(NULL, sizeof(*o), PROT_READ, MAP_SHARED, fd, 0);
+    (void) close(fd);
+    if (o == MAP_FAILED) {
+        return NULL;
+    }
+    if (__atomic_load_n(&o->magic, __ATOMIC_ACQUIRE) != OPENINGS_MAGIC
+        || o->slots != SLOTS || o->colors != COLORS) {
+        openings_unmap(o);
+        return NULL;
+    }
+    return o;
+}
+
+void openings_unmap(const struct openings *o)
+{
+    if (o != NULL) {
+        (void) munmap((void *) o, sizeof(*o));
+    }
+}
+
+void openings_name(char *name, size_t size)
+{
+    (void) snprintf(name, size, "/mastermind_%dx%d", SLOTS, COLORS);
+}
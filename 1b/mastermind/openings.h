@@ -0,0 +1,68 @@
+/**
+ * @file openings.h
+ * @date 2017-04-23
+ *
+ * @brief Precomputed first round of every strategy, published in shared memory
+ *        by solverd and mapped read-only by the clients. A client then skips
+ *        filling and scanning the whole candidate array for its first guess:
+ *        after the first response its candidates are copied from one slice of
+ *        the shared table.
+ **/
+#ifndef OPENINGS_H
+#define OPENINGS_H
+
+#include <stdint.h>
+
+#include "mastermind.h"
+#include "solver.h"
+
+/* Marks complete tables, changes whenever the layout changes */
+#define OPENINGS_MAGIC (0x4d4d4f32)
+
+/* Number of possible response values (red and white pegs) */
+#define RESPONSES (1 << PARITY_ERR_BIT)
+
+/* @brief The first round of one strategy */
+struct opening {
+    code_t guess;                     /* < the strategy's first guess */
+    long start[RESPONSES + 1];        /* < codes[start[r]..start[r+1]-1] answer guess with r */
+    code_t codes[COMBINATIONS];       /* < all combinations grouped by response, in solver order */
+};
+
+/* @brief Contents of the shared memory object */
+struct openings {
+    uint32_t magic;                   /* < OPENINGS_MAGIC, written last */
+    int slots;
+    int colors;
+    int32_t pid;                      /* < solverd publishing the tables, written first */
+    struct opening strategies[STRATEGY_COUNT];
+};
+
+/**
+ * @brief Computes the openings of all strategies.
+ * @param o where the tables are stored, o->magic is left alone
+ * @return 0 on success, -1 if memory for a solver could not be allocated
+ */
+int openings_build(struct openings *o);
+
+/**
+ * @brief Maps the tables published by solverd.
+ * @return the read-only tables, or NULL if no (complete) tables for this
+ *         game size are published
+ */
+const struct openings *openings_map(void);
+
+/**
+ * @brief Unmaps tables returned by openings_map.
+ * @param o the tables, may be NULL
+ */
+void openings_unmap(const struct openings *o);
+
+/**
+ * @brief Name of the shared memory object for this game size.
+ * @param name where the name is stored
+ * @param size size of name
+ */
+void openings_name(char *name, size_t size);
+
+#endif /* OPENINGS_H */
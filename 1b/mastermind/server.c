@@ -21,33 +21,49 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <unistd.h>
 #include <stdarg.h>
+#include <fcntl.h>
+#include <time.h>
+#include <getopt.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
 #include <netinet/in.h>
 #include <signal.h>
 #include <errno.h>
 #include <limits.h>
+#include <pthread.h>
+
+#include "mastermind.h"
+#include "feedback.h"
+#include "metrics.h"
+#include "sockio.h"
 
 /* === Constants === */
 
-#define MAX_TRIES (35)
-#define SLOTS (5)
-#define COLORS (8)
+/* Size of the receive buffer of a connection, holds several full batch frames */
+#define FRAME_BYTES (1 + MAX_BATCH * GUESS_BYTES)
+#define RECV_BYTES (4 * FRAME_BYTES)
+
+/* Size of the send buffer, every request of GUESS_BYTES bytes gets at most
+   RESP_BYTES + 1 bytes */
+#define SEND_BYTES (RECV_BYTES / GUESS_BYTES * (RESP_BYTES + 1))
+
+#define BACKLOG (128)
+
+/* Maximum number of events handled per epoll_wait() */
+#define MAX_EVENTS (64)
 
-#define READ_BYTES (2)
-#define WRITE_BYTES (1)
-#define BUFFER_BYTES (2)
-#define SHIFT_WIDTH (3)
-#define PARITY_ERR_BIT (6)
-#define GAME_LOST_ERR_BIT (7)
+/* Maximum number of worker threads */
+#define MAX_WORKERS (256)
 
-#define EXIT_PARITY_ERROR (2)
-#define EXIT_GAME_LOST (3)
-#define EXIT_MULTIPLE_ERRORS (4)
+/* Minimum time in us between two messages about refused connections */
+#define REFUSE_LOG_INTERVAL (1000000)
 
-#define BACKLOG (5)
+/* Milliseconds a worker sleeps in epoll_wait() before checking `quit` */
+#define POLL_TIMEOUT (200)
 
 
 /* === Macros === */
@@ -61,29 +77,86 @@
 /* Length of an array */
 #define COUNT_OF(x) (sizeof(x)/sizeof(x[0]))
 
+/* === Type Definitions === */
+
+/* @brief Counters and histograms of every worker, published in the shared
+          memory object /mastermind.PORT, see metrics.h */
+enum counter {
+    M_CONNECTIONS,
+    M_GUESSES,
+    M_WON,
+    M_LOST,
+    M_PARITY,           /* < parity errors and invalid guesses */
+    M_COUNTERS
+};
+
+enum histogram {
+    H_LATENCY,          /* < us to play and answer the requests read in one wakeup */
+    H_PENDING,          /* < requests read in one wakeup */
+    H_HISTS
+};
+
+struct opts {
+    long int portno;
+    bool fixed_secret;       /* < play every game with secret instead of a random one */
+    code_t secret;
+    unsigned int seed;
+    int workers;
+};
+
+/* @brief State of one game, i.e. one client connection */
+struct connection {
+    int fd;
+    int round;                       /* < number of the next round */
+    code_t secret;
+    bool batched;                    /* < client negotiated the batch protocol */
+    bool writing;                    /* < waiting for EPOLLOUT to send the rest of the responses */
+    bool over;                       /* < close the connection once the responses are sent */
+    struct sockio io;
+    uint8_t in[RECV_BYTES];          /* < received, not yet processed requests */
+    uint8_t out[SEND_BYTES];         /* < responses the socket did not take yet */
+    struct connection *prev, *next;  /* < list of open connections */
+};
+
+/* @brief A worker thread. Every worker owns its listening socket (bound with
+          SO_REUSEPORT), its epoll instance and its connections, so workers share
+          nothing but the read-only options. */
+struct worker {
+    pthread_t thread;
+    int sockfd;
+    int epfd;
+    struct connection *connections;
+    unsigned int seed;               /* < state of the worker's random number generator */
+    int spare;                       /* < reserved descriptor, given up to refuse a
+                                          connection when the descriptors run out */
+    bool paused;                     /* < listening socket not watched, no spare */
+    long refused;                    /* < connections refused since the last message */
+    long refused_logged;             /* < monotonic time in us of the last message */
+    struct metrics_thread *metrics;  /* < the worker's slot of the metrics page */
+    const struct opts *options;
+};
+
 /* === Global Variables === */
 
 /* Name of the program */
 static const char *progname = "server"; /* default name */
 
-/* File descriptor for server socket */
-static int sockfd = -1;
+/* All workers, workers[0] runs in the main thread */
+static struct worker workers[MAX_WORKERS];
 
-/* File descriptor for connection socket */
-static int connfd = -1;
+/* Number of initialised workers */
+static int nworkers = 0;
+
+/* Names of the metrics, in the order of enum counter and enum histogram */
+static const char *const counter_names[M_COUNTERS] = {
+    "connections", "guesses", "games_won", "games_lost", "parity_errors"
+};
+static const char *const hist_names[H_HISTS] = {"latency_us", "pending"};
 
 /* This variable is set upon receipt of a signal */
 volatile sig_atomic_t quit = 0;
 
 
-/* === Type Definitions === */
-
-struct opts {
-    long int portno;
-    uint8_t secret[SLOTS];
-};
-
-
 /* === Prototypes === */
 
 /**
@@ -95,36 +168,103 @@ struct opts {
 static void parse_args(int argc, char **argv, struct opts *options);
 
 /**
- * @brief Read message from socket
- *
- * This code *illustrates* one way to deal with partial reads
- *
- * @param sockfd_con Socket to read from
- * @param buffer Buffer where read data is stored
- * @param n Size to read
- * @return Pointer to buffer on success, else NULL
+ * @brief Sends the queued responses of a connection. If the socket does not
+ *        take all of them, the connection waits for EPOLLOUT instead of
+ *        EPOLLIN until they are out.
+ * @param w the worker owning the connection
+ * @param c the connection
+ * @return true if the connection has to be closed
  */
-static uint8_t *read_from_client(int sockfd_con, uint8_t *buffer, size_t n);
-
-/**
- * @brief Writes message to client
- *
- * @param sockfd_con Socket to write from
- * @param buffer Buffer where wirte data is stored
- * @param n Size to write
- * @return number of bytes written
- */
-static size_t write_to_client(int fd, uint8_t *buffer, size_t n);
+static bool send_responses(struct worker *w, struct connection *c);
 
 
 /**
  * @brief Compute answer to request
- * @param req Client's guess
- * @param resp Buffer that will be sent to the client
+ * @param req Client's guess including parity bit
+ * @param resp Response that will be sent to the client
  * @param secret The server's secret
  * @return Number of correct matches on success; -1 in case of a parity error
+ *         or a guess which is no valid combination
+ */
+static int compute_answer(uint64_t req, resp_t *resp, code_t secret);
+
+/**
+ * @brief Creates the non-blocking listening socket and the epoll instance of a worker.
+ * @param w the worker
+ * @param options parsed arguments
+ * @param id number of the worker
+ */
+static void setup(struct worker *w, const struct opts *options, int id);
+
+/**
+ * @brief Event loop of a worker, runs until `quit` is set.
+ * @param arg the struct worker
+ * @return NULL
+ */
+static void *run_worker(void *arg);
+
+/**
+ * @brief Accepts all pending connections and starts a new game for each of them.
+ * @param w the worker owning the listening socket
+ */
+static void accept_clients(struct worker *w);
+
+/**
+ * @brief Handles accept() running out of file descriptors. The spare
+ *        descriptor is closed to accept and close the waiting connection,
+ *        otherwise the level triggered listening socket would wake the worker
+ *        again and again. Without a spare the listening socket is not watched
+ *        until resume_accept gets one back. Logs at most once per
+ *        REFUSE_LOG_INTERVAL.
+ * @param w the worker owning the listening socket
+ * @return true if a connection was refused and the next one may be accepted
+ */
+static bool refuse_client(struct worker *w);
+
+/**
+ * @brief Watches the listening socket again after refuse_client paused it,
+ *        as soon as the spare descriptor can be reopened.
+ * @param w the worker owning the listening socket
+ */
+static void resume_accept(struct worker *w);
+
+/**
+ * @brief Receives what is available with one read, plays the rounds of all
+ *        complete requests and frames and sends all responses with one write.
+ * @param w the worker owning the connection
+ * @param c the connection
+ * @return true if the game is over and the connection has to be closed
+ */
+static bool play_rounds(struct worker *w, struct connection *c);
+
+/**
+ * @brief Plays one round.
+ * @param w the worker owning the connection
+ * @param c the connection
+ * @param request the client's guess including parity bit
+ * @param over set to true if the game is over after this round
+ * @return the response for the client
  */
-static int compute_answer(uint16_t req, uint8_t *resp, uint8_t *secret);
+static resp_t play_round(struct worker *w, struct connection *c, uint64_t request, bool *over);
+
+/**
+ * @brief Returns the time of the monotonic clock in us.
+ */
+static long now_us(void);
+
+/**
+ * @brief Removes a connection from the worker's list, closes and frees it.
+ * @param w the worker owning the connection
+ * @param c the connection
+ */
+static void close_connection(struct worker *w, struct connection *c);
+
+/**
+ * @brief Draws a random secret.
+ * @param seed state of the random number generator
+ * @return the encoded secret
+ */
+static code_t random_secret(unsigned int *seed);
 
 /**
  * @brief terminate program on program error
@@ -146,93 +286,18 @@ static void free_resources(void);
 
 /* === Implementations === */
 
-static uint8_t *read_from_client(int fd, uint8_t *buffer, size_t n)
+static int compute_answer(uint64_t req, resp_t *resp, code_t secret)
 {
-    /* loop, as packet can arrive in several partial reads */
-    size_t bytes_recv = 0;
-    do {
-        ssize_t r;
-        r = recv(fd, buffer + bytes_recv, n - bytes_recv, 0);
-        if (r <= 0) {
-            return NULL;
-        }
-        bytes_recv += r;
-    } while (bytes_recv < n);
-
-    if (bytes_recv < n) {
-        return NULL;
-    }
-    return buffer;
-}
-
-static size_t write_to_client(int fd, uint8_t *buffer, size_t n){
+    uint8_t parity_recv = (req >> GUESS_PARITY_BIT) & 1;
+    uint64_t code = req & ((1ULL << GUESS_PARITY_BIT) - 1);
 
-	size_t bytes_sent = 0;
-
-	do {
-		ssize_t r;
-		r = write(fd, buffer + bytes_sent, n - bytes_sent);
-		if (r <= 0) {
-			return -1;
-		}
-		bytes_sent += r;
-	} while (bytes_sent < n);
-
-	if (bytes_sent < n) {
-		return -1;
-	}
-	return bytes_sent;
-}
-
-static int compute_answer(uint16_t req, uint8_t *resp, uint8_t *secret)
-{
-    int colors_left[COLORS];
-    int guess[COLORS];
-    uint8_t parity_calc, parity_recv;
-    int red, white;
-    int j;
-
-    parity_recv = (req >> 15) & 1;
-
-    /* extract the guess and calculate parity */
-    parity_calc = 0;
-    for (j = 0; j < SLOTS; ++j) {
-        int tmp = req & 0x7;
-        parity_calc ^= tmp ^ (tmp >> 1) ^ (tmp >> 2);
-        guess[j] = tmp;
-        req >>= SHIFT_WIDTH;
-    }
-    parity_calc &= 0x1;
-
-    /* marking red and white */
-    (void) memset(&colors_left[0], 0, sizeof(colors_left));
-    red = white = 0;
-    for (j = 0; j < SLOTS; ++j) {
-        /* mark red */
-        if (guess[j] == secret[j]) {
-            red++;
-        } else {
-            colors_left[secret[j]]++;
-        }
-    }
-    for (j = 0; j < SLOTS; ++j) {
-        /* not marked red */
-        if (guess[j] != secret[j]) {
-            if (colors_left[guess[j]] > 0) {
-                white++;
-                colors_left[guess[j]]--;
-            }
-        }
-    }
-
-    /* build response buffer */
-    resp[0] = red;
-    resp[0] |= (white << SHIFT_WIDTH);
-    if (parity_recv != parity_calc) {
-        resp[0] |= (1 << PARITY_ERR_BIT);
+    /* build response */
+    *resp = fb_score(code, secret);
+    if (parity_recv != fb_code_parity(code) || !fb_code_valid(code)) {
+        *resp |= (1 << PARITY_ERR_BIT);
         return -1;
     } else {
-        return red;
+        return RESP_RED(*resp);
     }
 }
 
@@ -259,12 +324,22 @@ static void free_resources(void)
 {
     /* clean up resources */
     DEBUG("Shutting down server\n");
-    if(connfd >= 0) {
-        (void) close(connfd);
-    }
-    if(sockfd >= 0) {
-        (void) close(sockfd);
+    for (int i = 0; i < nworkers; i++) {
+        struct worker *w = &workers[i];
+        while (w->connections != NULL) {
+            close_connection(w, w->connections);
+        }
+        if(w->epfd >= 0) {
+            (void) close(w->epfd);
+        }
+        if(w->sockfd >= 0) {
+            (void) close(w->sockfd);
+        }
+        if(w->spare >= 0) {
+            (void) close(w->spare);
+        }
     }
+    metrics_close();
 }
 
 static void signal_handler(int sig)
@@ -276,16 +351,12 @@ static void signal_handler(int sig)
  * @brief Program entry point
  * @param argc The argument counter
  * @param argv The argument vector
- * @return EXIT_SUCCESS on success, EXIT_PARITY_ERROR in case of an parity
- * error, EXIT_GAME_LOST in case client needed to many guesses,
- * EXIT_MULTIPLE_ERRORS in case multiple errors occured in one round
+ * @return EXIT_SUCCESS after the server was stopped by a signal
  */
 int main(int argc, char *argv[])
 {
 
     struct opts options;
-    int round;
-    int ret;
 
     parse_args(argc, argv, &options);
 
@@ -303,121 +374,460 @@ int main(int argc, char *argv[])
             bail_out(EXIT_FAILURE, "sigaction");
         }
     }
+    /* a client closing its connection early must not kill the server */
+    s.sa_handler = SIG_IGN;
+    if (sigaction(SIGPIPE, &s, NULL) < 0) {
+        bail_out(EXIT_FAILURE, "sigaction");
+    }
+
+    for (int i = 0; i < options.workers; i++) {
+        setup(&workers[i], &options, i);
+        nworkers++;
+    }
+    /* only once the port is ours, the page may belong to a running server */
+    char metrics_name[64];
+    (void) snprintf(metrics_name, sizeof(metrics_name), "/mastermind.%ld", options.portno);
+    struct metrics_thread *metrics = metrics_open(metrics_name, options.workers,
+        counter_names, M_COUNTERS, hist_names, H_HISTS);
+    if (metrics == NULL) {
+        bail_out(EXIT_FAILURE, "metrics_open");
+    }
+    for (int i = 0; i < nworkers; i++) {
+        workers[i].metrics = &metrics[i];
+    }
+
+    /* only the main thread handles signals, the other workers poll `quit` */
+    sigset_t blocked, old;
+    (void) sigemptyset(&blocked);
+    (void) sigaddset(&blocked, SIGINT);
+    (void) sigaddset(&blocked, SIGTERM);
+    (void) pthread_sigmask(SIG_BLOCK, &blocked, &old);
+    for (int i = 1; i < nworkers; i++) {
+        errno = pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]);
+        if (errno != 0) {
+            bail_out(EXIT_FAILURE, "pthread_create");
+        }
+    }
+    (void) pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    (void) run_worker(&workers[0]);
+    for (int i = 1; i < nworkers; i++) {
+        (void) pthread_join(workers[i].thread, NULL);
+    }
+
+    /* we are done */
+    free_resources();
+    return EXIT_SUCCESS;
+}
+
+static void *run_worker(void *arg)
+{
+    struct worker *w = arg;
 
+    while (!quit) {
+        struct epoll_event events[MAX_EVENTS];
+        int n;
 
+        if (w->paused) {
+            resume_accept(w);
+        }
+        n = epoll_wait(w->epfd, events, MAX_EVENTS, POLL_TIMEOUT);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            bail_out(EXIT_FAILURE, "epoll_wait");
+        }
+        for (int i = 0; i < n; i++) {
+            struct connection *c = events[i].data.ptr;
+            if (c == NULL) {
+                accept_clients(w);
+            } else if (play_rounds(w, c)) {
+                close_connection(w, c);
+            }
+        }
+    }
+    return NULL;
+}
 
-    /* Create a new TCP/IP socket `sockfd`, and set the SO_REUSEADDR
-       option for this socket. Then bind the socket to localhost:portno,
-       listen, and wait for new connections, which should be assigned to
-       `connfd`. Terminate the program in case of an error.
-    */
-    //#error "insert your code here"
-    struct sockaddr_in serv_addr, cli_addr;
+static void setup(struct worker *w, const struct opts *options, int id)
+{
+    struct sockaddr_in serv_addr;
+    struct epoll_event ev;
     int reuse = 1;
-    socklen_t clilen;
 
-    if((sockfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0){
+    w->epfd = -1;
+    w->connections = NULL;
+    w->options = options;
+    w->seed = options->seed + id;
+    w->paused = false;
+    w->refused = 0;
+    w->refused_logged = 0;
+    if ((w->spare = open("/dev/null", O_RDONLY)) < 0) {
+      bail_out(EXIT_FAILURE, "open /dev/null");
+    }
+    if((w->sockfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0){
       bail_out(EXIT_FAILURE, "socket");
     }
 
-    serv_addr.sin_port = htons(options.portno);
+    (void) memset(&serv_addr, 0, sizeof(serv_addr));
+    serv_addr.sin_port = htons(options->portno);
     serv_addr.sin_family = AF_INET;
     serv_addr.sin_addr.s_addr = INADDR_ANY;
 
-    if((setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse))) < 0){
+    if((setsockopt(w->sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse))) < 0){
       bail_out(EXIT_FAILURE, "setsockopt");
     }
-    if((bind(sockfd, (struct sockaddr*) &serv_addr, sizeof(serv_addr))) < 0){
+    /* every worker binds its own socket, the kernel balances new connections */
+    if(options->workers > 1
+        && (setsockopt(w->sockfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse))) < 0){
+      bail_out(EXIT_FAILURE, "setsockopt");
+    }
+    if((bind(w->sockfd, (struct sockaddr*) &serv_addr, sizeof(serv_addr))) < 0){
       bail_out(EXIT_FAILURE, "bind");
     }
-    if((listen(sockfd, BACKLOG)) < 0){
+    if((listen(w->sockfd, BACKLOG)) < 0){
       bail_out(EXIT_FAILURE, "listen");
     }
-    clilen = sizeof(cli_addr);
+    if (fcntl(w->sockfd, F_SETFL, O_NONBLOCK) < 0) {
+      bail_out(EXIT_FAILURE, "fcntl");
+    }
 
-    if((connfd = accept(sockfd,(struct sockaddr *) &cli_addr, &clilen)) < 0){
-      bail_out(EXIT_FAILURE, "accept");
+    if ((w->epfd = epoll_create(MAX_EVENTS)) < 0) {
+      bail_out(EXIT_FAILURE, "epoll_create");
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; /* marks the listening socket */
+    if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->sockfd, &ev) < 0) {
+      bail_out(EXIT_FAILURE, "epoll_ctl");
     }
+}
 
+static void accept_clients(struct worker *w)
+{
+    const struct opts *options = w->options;
 
-    /* accepted the connection */
-    ret = EXIT_SUCCESS;
-    for (round = 1; round <= MAX_TRIES && !quit; ++round) {
-        uint16_t request;
-        static uint8_t buffer[BUFFER_BYTES];
-        int correct_guesses;
-        int error = 0;
+    for (;;) {
+        struct epoll_event ev;
+        struct connection *c;
+        int fd = accept(w->sockfd, NULL, NULL);
 
-        /* read from client */
-        if (read_from_client(connfd, &buffer[0], READ_BYTES) == NULL) {
-            if (quit) break; /* caught signal */
-            bail_out(EXIT_FAILURE, "read_from_client");
+        if (fd < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return;
+            }
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno == EMFILE || errno == ENFILE) {
+                if (refuse_client(w)) {
+                    continue;
+                }
+                return;
+            }
+            (void) fprintf(stderr, "%s: accept: %s\n", progname, strerror(errno));
+            return;
+        }
+        if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0 || (c = malloc(sizeof(*c))) == NULL) {
+            (void) close(fd);
+            continue;
+        }
+        c->fd = fd;
+        c->round = 1;
+        c->batched = false;
+        c->writing = false;
+        c->over = false;
+        sockio_init(&c->io, fd, c->in, sizeof(c->in), c->out, sizeof(c->out));
+        if (options->fixed_secret) {
+            c->secret = options->secret;
+        } else {
+            c->secret = random_secret(&w->seed);
         }
-        request = (buffer[1] << 8) | buffer[0];
-        DEBUG("Round %d: Received 0x%x\n", round, request);
 
-        /* compute answer */
-        correct_guesses = compute_answer(request, buffer, options.secret);
-        if (round == MAX_TRIES && correct_guesses != SLOTS) {
-            buffer[0] |= 1 << GAME_LOST_ERR_BIT;
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            (void) close(fd);
+            free(c);
+            continue;
+        }
+        c->prev = NULL;
+        c->next = w->connections;
+        if (w->connections != NULL) {
+            w->connections->prev = c;
         }
+        w->connections = c;
+        metrics_add(w->metrics, M_CONNECTIONS, 1);
+        DEBUG("Accepted connection %d\n", fd);
+    }
+}
 
-        DEBUG("Sending byte 0x%x\n", buffer[0]);
+static bool refuse_client(struct worker *w)
+{
+    struct epoll_event ev;
+    long now = now_us();
+    bool refused = false;
+    int fd;
+
+    if (w->spare >= 0) {
+        (void) close(w->spare);
+        if ((fd = accept(w->sockfd, NULL, NULL)) >= 0) {
+            (void) close(fd);
+            w->refused++;
+            refused = true;
+        }
+        w->spare = open("/dev/null", O_RDONLY);
+    }
+    if (!refused && w->spare < 0) {
+        /* another thread took the descriptor, wait for it to come back */
+        ev.events = 0;
+        ev.data.ptr = NULL;
+        if (epoll_ctl(w->epfd, EPOLL_CTL_MOD, w->sockfd, &ev) == 0) {
+            w->paused = true;
+        }
+    }
+    if (w->refused > 0 && now - w->refused_logged >= REFUSE_LOG_INTERVAL) {
+        (void) fprintf(stderr, "%s: accept: out of file descriptors, refused %ld connections\n",
+            progname, w->refused);
+        w->refused = 0;
+        w->refused_logged = now;
+    }
+    return refused;
+}
 
-        /* send message to client */
-        //#error "insert your code here"
+static void resume_accept(struct worker *w)
+{
+    struct epoll_event ev;
 
-        if(write_to_client(connfd, &buffer[0], sizeof(buffer[0])) < 0){
-          bail_out(EXIT_FAILURE, "send");
-        }
+    if (w->spare < 0 && (w->spare = open("/dev/null", O_RDONLY)) < 0) {
+        return;
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(w->epfd, EPOLL_CTL_MOD, w->sockfd, &ev) == 0) {
+        w->paused = false;
+    }
+}
 
-        /* We sent the answer to the client; now stop the game
-           if its over, or an error occured */
-        if (*buffer & (1<<PARITY_ERR_BIT)) {
-            (void) fprintf(stderr, "Parity error\n");
-            error = 1;
-            ret = EXIT_PARITY_ERROR;
-        }
-        if (*buffer & (1 << GAME_LOST_ERR_BIT)) {
-            (void) fprintf(stderr, "Game lost\n");
-            error = 1;
-            if (ret == EXIT_PARITY_ERROR) {
-                ret = EXIT_MULTIPLE_ERRORS;
-            } else {
-                ret = EXIT_GAME_LOST;
+static bool play_rounds(struct worker *w, struct connection *c)
+{
+    long start = now_us();
+    int requests = 0;
+    uint8_t out[SEND_BYTES];
+    size_t nout = 0;
+    size_t pos = 0;
+    bool over = false;
+    const uint8_t *buffer;
+    ssize_t r;
+
+    if (c->writing) {
+        /* no new requests before the last responses are out */
+        return send_responses(w, c);
+    }
+    r = sockio_fill(&c->io);
+    if (r == SOCKIO_AGAIN) {
+        return false;
+    }
+    if (r == 0 || r == -1) {
+        /* peer closed, still answer what it sent before */
+        c->over = true;
+    }
+    buffer = sockio_data(&c->io);
+
+    while (!over) {
+        size_t left = sockio_buffered(&c->io) - pos;
+        uint64_t request;
+
+        if (!c->batched) {
+            if (left < GUESS_BYTES) {
+                break;
+            }
+            request = codec_get(buffer + pos, GUESS_BYTES);
+            pos += GUESS_BYTES;
+            if (c->round == 1 && request == PROTO_HELLO) {
+                DEBUG("Client %d uses the batch protocol\n", c->fd);
+                c->batched = true;
+                codec_put(out + nout, PROTO_ACK, RESP_BYTES);
+                nout += RESP_BYTES;
+                out[nout++] = MAX_BATCH;
+                continue;
+            }
+            codec_put(out + nout, play_round(w, c, request, &over), RESP_BYTES);
+            nout += RESP_BYTES;
+            requests++;
+        } else {
+            size_t count_pos = nout;
+            int n;
+
+            if (left < 1) {
+                break;
             }
+            n = buffer[pos];
+            if (n < 1 || n > MAX_BATCH) {
+                (void) fprintf(stderr, "Bad batch size %d\n", n);
+                over = true;
+                break;
+            }
+            if (left < 1 + n * GUESS_BYTES) {
+                break;
+            }
+            out[nout++] = 0;
+            for (int i = 0; i < n && !over; i++) {
+                request = codec_get(buffer + pos + 1 + i * GUESS_BYTES, GUESS_BYTES);
+                codec_put(out + nout, play_round(w, c, request, &over), RESP_BYTES);
+                nout += RESP_BYTES;
+                out[count_pos]++;
+                requests++;
+            }
+            pos += 1 + n * GUESS_BYTES;
         }
-        if (error) {
-            break;
-        } else if (correct_guesses == SLOTS) {
-            /* won */
-            (void) printf("Runden: %d\n", round);
-            break;
+    }
+
+    /* an incomplete request stays buffered for the next wakeup */
+    sockio_consume(&c->io, pos);
+    if (over) {
+        c->over = true;
+    }
+    if (nout > 0 && sockio_write(&c->io, out, nout) < 0) {
+        return true;
+    }
+    if (requests > 0) {
+        metrics_observe(w->metrics, H_PENDING, requests);
+        metrics_observe(w->metrics, H_LATENCY, now_us() - start);
+    }
+    return send_responses(w, c);
+}
+
+static bool send_responses(struct worker *w, struct connection *c)
+{
+    int r = sockio_flush(&c->io);
+    bool writing = r == SOCKIO_AGAIN;
+
+    if (r == -1) {
+        return true;
+    }
+    if (writing != c->writing) {
+        struct epoll_event ev;
+
+        ev.events = writing ? EPOLLOUT : EPOLLIN;
+        ev.data.ptr = c;
+        if (epoll_ctl(w->epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0) {
+            return true;
         }
+        c->writing = writing;
     }
+    return !writing && c->over;
+}
 
-    /* we are done */
-    free_resources();
-    return ret;
+static resp_t play_round(struct worker *w, struct connection *c, uint64_t request, bool *over)
+{
+    resp_t response;
+    int correct_guesses;
+
+    DEBUG("Round %d: Received 0x%llx\n", c->round, (unsigned long long) request);
+
+    /* compute answer */
+    correct_guesses = compute_answer(request, &response, c->secret);
+    if (c->round == MAX_TRIES && correct_guesses != SLOTS) {
+        response |= 1 << GAME_LOST_ERR_BIT;
+    }
+
+    DEBUG("Sending 0x%x\n", response);
+
+    /* stop the game if its over, or an error occured */
+    *over = false;
+    metrics_add(w->metrics, M_GUESSES, 1);
+    if (response & (1 << PARITY_ERR_BIT)) {
+        (void) fprintf(stderr, "Parity error\n");
+        metrics_add(w->metrics, M_PARITY, 1);
+        *over = true;
+    }
+    if (response & (1 << GAME_LOST_ERR_BIT)) {
+        (void) fprintf(stderr, "Game lost\n");
+        metrics_add(w->metrics, M_LOST, 1);
+        *over = true;
+    }
+    if (!*over && correct_guesses == SLOTS) {
+        /* won */
+        (void) printf("Runden: %d\n", c->round);
+        metrics_add(w->metrics, M_WON, 1);
+        *over = true;
+    }
+    c->round++;
+    return response;
+}
+
+static void close_connection(struct worker *w, struct connection *c)
+{
+    if (c->prev != NULL) {
+        c->prev->next = c->next;
+    } else {
+        w->connections = c->next;
+    }
+    if (c->next != NULL) {
+        c->next->prev = c->prev;
+    }
+    /* closing the socket also removes it from the epoll instance */
+    (void) close(c->fd);
+    free(c);
+}
+
+static long now_us(void)
+{
+    struct timespec ts;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+static code_t random_secret(unsigned int *seed)
+{
+    code_t secret = 0;
+
+    for (int j = 0; j < SLOTS; j++) {
+        secret |= (code_t) (rand_r(seed) % COLORS) << (j * SHIFT_WIDTH);
+    }
+    return secret;
 }
 
 static void parse_args(int argc, char **argv, struct opts *options)
 {
     int i;
+    int opt;
     char *port_arg;
     char *secret_arg;
     char *endptr;
-    enum { beige, darkblue, green, orange, red, black, violet, white };
 
     if(argc > 0) {
         progname = argv[0];
     }
-    if (argc != 3) {
+    options->seed = time(NULL) ^ getpid();
+    options->workers = 1;
+    while ((opt = getopt(argc, argv, "s:w:")) != -1) {
+        switch (opt) {
+        case 's':
+            options->seed = strtoul(optarg, &endptr, 10);
+            if (*endptr != '\0') {
+                bail_out(EXIT_FAILURE, "Invalid seed '%s'", optarg);
+            }
+            break;
+        case 'w':
+            options->workers = strtol(optarg, &endptr, 10);
+            if (*endptr != '\0' || options->workers < 1 || options->workers > MAX_WORKERS) {
+                bail_out(EXIT_FAILURE, "Number of workers has to be in 1-%d", MAX_WORKERS);
+            }
+            break;
+        default:
+            bail_out(EXIT_FAILURE,
+                "Usage: %s [-s seed] [-w workers] <server-port> [<secret-sequence>]", progname);
+        }
+    }
+    if (argc - optind != 1 && argc - optind != 2) {
         bail_out(EXIT_FAILURE,
-            "Usage: %s <server-port> <secret-sequence>", progname);
+            "Usage: %s [-s seed] [-w workers] <server-port> [<secret-sequence>]", progname);
     }
-    port_arg = argv[1];
-    secret_arg = argv[2];
+    port_arg = argv[optind];
+    secret_arg = argv[optind + 1];
 
     errno = 0;
     options->portno = strtol(port_arg, &endptr, 10);
@@ -445,43 +855,25 @@ static void parse_args(int argc, char **argv, struct opts *options)
         bail_out(EXIT_FAILURE, "Use a valid TCP/IP port range (1-65535)");
     }
 
+    /* without a secret every game gets a random one */
+    options->fixed_secret = secret_arg != NULL;
+    if (!options->fixed_secret) {
+        return;
+    }
+
     if (strlen(secret_arg) != SLOTS) {
         bail_out(EXIT_FAILURE,
             "<secret-sequence> has to be %d chars long", SLOTS);
     }
 
     /* read secret */
+    options->secret = 0;
     for (i = 0; i < SLOTS; ++i) {
-        uint8_t color;
-        switch (secret_arg[i]) {
-        case 'b':
-            color = beige;
-            break;
-        case 'd':
-            color = darkblue;
-            break;
-        case 'g':
-            color = green;
-            break;
-        case 'o':
-            color = orange;
-            break;
-        case 'r':
-            color = red;
-            break;
-        case 's':
-            color = black;
-            break;
-        case 'v':
-            color = violet;
-            break;
-        case 'w':
-            color = white;
-            break;
-        default:
+        const char *color = strchr(COLOR_CHARS, secret_arg[i]);
+        if (color == NULL || color - COLOR_CHARS >= COLORS) {
             bail_out(EXIT_FAILURE,
                 "Bad Color '%c' in <secret-sequence>", secret_arg[i]);
         }
-        options->secret[i] = color;
+        options->secret |= (code_t) (color - COLOR_CHARS) << (i * SHIFT_WIDTH);
     }
 }
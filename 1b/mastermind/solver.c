@@ -0,0 +1,262 @@
+/**
+ * @file solver.c
+ * @date 2017-04-02
+ *
+ * @brief Reentrant mastermind solver, used by the client and the evaluation harness.
+ **/
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "solver.h"
+#include "openings.h"
+#include "matrix.h"
+#include "feedback.h"
+
+/* @brief names of the strategies, indexed by enum strategy */
+static const char *strategy_names[STRATEGY_COUNT] = {"distinct", "first"};
+
+/**
+ * @brief Selects the first combination with 4 different colours
+ *        or if there is no such combination the last combination with the most different colours.
+ * @param s solver state
+ * @return the selected combination
+ */
+static code_t next_distinct(struct solver *s);
+
+/**
+ * @brief Selects the first combination which is not excluded yet.
+ * @param s solver state
+ * @return the selected combination
+ */
+static code_t next_first(struct solver *s);
+
+/**
+ * @brief Fills the candidate array with all combinations in solver order.
+ * @param s solver state
+ */
+static void fill_combinations(struct solver *s);
+
+/**
+ * @brief solver_update with the feedback taken from the matrix.
+ * @param s solver state, s->matrix is set
+ * @param guess the guess
+ * @param expected the response without error bits
+ * @return number of remaining combinations
+ */
+static uint64_t update_matrix(struct solver *s, code_t guess, resp_t expected);
+
+int solver_alloc(struct solver *s)
+{
+    s->combinations = malloc(COMBINATIONS * sizeof(*s->combinations));
+    return s->combinations == NULL ? -1 : 0;
+}
+
+void solver_free(struct solver *s)
+{
+    free(s->combinations);
+    s->combinations = NULL;
+}
+
+void solver_init(struct solver *s, enum strategy strategy)
+{
+    s->strategy = strategy;
+    s->remaining = COMBINATIONS;
+    s->opening = NULL;
+    s->matrix = NULL;
+    fill_combinations(s);
+}
+
+void solver_init_opening(struct solver *s, enum strategy strategy, const struct openings *o)
+{
+    s->strategy = strategy;
+    s->remaining = COMBINATIONS;
+    s->opening = &o->strategies[strategy];
+    s->matrix = NULL;
+}
+
+void solver_use_matrix(struct solver *s, const struct matrix *m)
+{
+    s->matrix = m;
+}
+
+static void fill_combinations(struct solver *s)
+{
+#if COLORS == 1 << SHIFT_WIDTH
+    /* every value of CODE_BITS bits is a valid combination */
+    for (long i = 0; i < COMBINATIONS; i++) {
+        s->combinations[i] = i;
+    }
+#else
+    for (long i = 0; i < COMBINATIONS; i++) {
+        s->combinations[i] = solver_code(i);
+    }
+#endif
+}
+
+long solver_index(code_t code)
+{
+#if COLORS == 1 << SHIFT_WIDTH
+    return code;
+#else
+    long index = 0;
+
+    for (int j = SLOTS - 1; j >= 0; j--) {
+        index = index * COLORS + ((code >> (j * SHIFT_WIDTH)) & SLOT_MASK);
+    }
+    return index;
+#endif
+}
+
+code_t solver_code(long index)
+{
+    code_t code = 0;
+
+    for (int j = 0; j < SLOTS; j++) {
+        code |= (code_t) (index % COLORS) << (j * SHIFT_WIDTH);
+        index /= COLORS;
+    }
+    return code;
+}
+
+code_t solver_next_guess(struct solver *s)
+{
+    if (s->opening != NULL) {
+        return s->opening->guess;
+    }
+    switch (s->strategy) {
+    case STRATEGY_FIRST:
+        return next_first(s);
+    case STRATEGY_DISTINCT:
+    default:
+        return next_distinct(s);
+    }
+}
+
+int solver_next_guesses(struct solver *s, code_t *guesses, int n)
+{
+    int count = 0;
+
+    if (n < 1) {
+        return 0;
+    }
+    guesses[count++] = solver_next_guess(s);
+    for (int k = 0; k < n - 1; k++) {
+        /* the first combination of part k which is not the first guess */
+        uint64_t end = (k + 1) * s->remaining / (n - 1);
+        for (uint64_t i = k * s->remaining / (n - 1); i < end; i++) {
+            /* the candidate array is not filled yet, but in solver order anyway */
+            code_t code = s->opening != NULL ? solver_code(i) : s->combinations[i];
+            if (code != guesses[0]) {
+                guesses[count++] = code;
+                break;
+            }
+        }
+    }
+    return count;
+}
+
+uint64_t solver_update(struct solver *s, code_t guess, resp_t response)
+{
+    resp_t expected = response & ((1 << PARITY_ERR_BIT) - 1);
+    struct fb_guess prev_guess;
+    uint64_t count = 0;
+
+    if (s->opening != NULL) {
+        const struct opening *op = s->opening;
+        s->opening = NULL;
+        if (guess == op->guess) {
+            count = op->start[expected + 1] - op->start[expected];
+            (void) memcpy(s->combinations, op->codes + op->start[expected],
+                count * sizeof(code_t));
+            s->remaining = count;
+            return count;
+        }
+        fill_combinations(s);
+    }
+    if (s->matrix != NULL) {
+        return update_matrix(s, guess, expected);
+    }
+
+    /* move the combinations which are still possible to the front, in their
+       original order, the rest of the array is not looked at again */
+    fb_prepare(&prev_guess, guess);
+    for (uint64_t i = 0; i < s->remaining; i++) {
+        code_t code = s->combinations[i];
+        s->combinations[count] = code;
+        count += fb_score_prepared(&prev_guess, code) == expected;
+    }
+    s->remaining = count;
+    return count;
+}
+
+static uint64_t update_matrix(struct solver *s, code_t guess, resp_t expected)
+{
+    const struct matrix *m = s->matrix;
+    const uint8_t *row = matrix_row(m, solver_index(guess));
+    int class = m->header->class_of[expected];
+    uint64_t count = 0;
+
+    for (uint64_t i = 0; i < s->remaining; i++) {
+        code_t code = s->combinations[i];
+        s->combinations[count] = code;
+        count += matrix_class(m, row, solver_index(code)) == class;
+    }
+    s->remaining = count;
+    return count;
+}
+
+resp_t solver_score(code_t guess, code_t secret)
+{
+    return fb_score(guess, secret);
+}
+
+int solver_strategy(const char *name)
+{
+    for (int i = 0; i < STRATEGY_COUNT; i++) {
+        if (strcmp(strategy_names[i], name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char *solver_strategy_name(enum strategy strategy)
+{
+    return strategy_names[strategy];
+}
+
+static code_t next_distinct(struct solver *s)
+{
+    int bestCount = 0;
+    code_t selected_colors = 0;
+
+    for (uint64_t i = 0; i < s->remaining; i++) {
+        bool seen[COLORS] = {false};
+        code_t selected_colors_temp = s->combinations[i];
+        int count = 0;
+        for (size_t j = 0; j < SLOTS; ++j) {
+            int tmp = selected_colors_temp & SLOT_MASK;
+            if (!seen[tmp]) {
+                seen[tmp] = true;
+                ++count;
+                if (count > bestCount) {
+                    bestCount = count;
+                }
+            }
+            selected_colors_temp >>= SHIFT_WIDTH;
+        }
+        if (count >= bestCount) {
+            selected_colors = s->combinations[i];
+        }
+        if (bestCount >= 4) {
+            break;
+        }
+    }
+    return selected_colors;
+}
+
+static code_t next_first(struct solver *s)
+{
+    return s->remaining > 0 ? s->combinations[0] : 0;
+}
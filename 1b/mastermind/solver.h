@@ -0,0 +1,140 @@
+/**
+ * @file solver.h
+ * @date 2017-04-02
+ *
+ * @brief Reentrant mastermind solver. All state of a game lives in a
+ *        struct solver, so several games can be played at the same time.
+ **/
+#ifndef SOLVER_H
+#define SOLVER_H
+
+#include <stdint.h>
+
+#include "mastermind.h"
+
+/* @brief Strategies used to pick the next guess out of the remaining combinations */
+enum strategy {
+    STRATEGY_DISTINCT,  /* < first combination with 4 different colours (client default) */
+    STRATEGY_FIRST,     /* < first combination that is still possible */
+    STRATEGY_COUNT
+};
+
+struct openings;
+struct matrix;
+
+/* @brief State of one game */
+struct solver {
+    enum strategy strategy;
+    uint64_t remaining;                /* < number of combinations still possible */
+    const struct opening *opening;     /* < shared first round, until the first update */
+    const struct matrix *matrix;       /* < precomputed feedback, NULL to compute it */
+    code_t *combinations;              /* < COMBINATIONS entries, the first `remaining`
+                                            are still possible */
+};
+
+/**
+ * @brief Allocates the candidate array. Has to be called once before the
+ *        first solver_init, the solver can then play any number of games.
+ * @param s solver state
+ * @return 0 on success, -1 if there is not enough memory
+ */
+int solver_alloc(struct solver *s);
+
+/**
+ * @brief Frees the candidate array allocated by solver_alloc.
+ * @param s solver state
+ */
+void solver_free(struct solver *s);
+
+/**
+ * @brief Resets the solver to the start of a new game.
+ * @param s solver state
+ * @param strategy strategy used by solver_next_guess
+ */
+void solver_init(struct solver *s, enum strategy strategy);
+
+/**
+ * @brief Resets the solver like solver_init, but takes the first round from
+ *        the shared tables of solverd instead of filling and scanning the
+ *        whole candidate array.
+ * @param s solver state
+ * @param strategy strategy used by solver_next_guess
+ * @param o tables returned by openings_map, they have to stay mapped
+ *        until the first solver_update
+ */
+void solver_init_opening(struct solver *s, enum strategy strategy, const struct openings *o);
+
+/**
+ * @brief Makes solver_update look up the feedback in a mapped matrix file
+ *        instead of computing it. Has to be called after (every) solver_init.
+ * @param s solver state
+ * @param m the matrix, NULL to compute the feedback again
+ */
+void solver_use_matrix(struct solver *s, const struct matrix *m);
+
+/**
+ * @brief Selects one of the not yet excluded combinations.
+ * @param s solver state
+ * @return the next guess without parity bit
+ */
+code_t solver_next_guess(struct solver *s);
+
+/**
+ * @brief Selects several different guesses to be sent at once. The first one is
+ *        the guess of solver_next_guess, the others are further combinations
+ *        which are still possible, one from each of n - 1 equal parts of them,
+ *        so a batch samples all of the remaining combinations.
+ * @param s solver state
+ * @param guesses where the guesses (without parity bit) are stored
+ * @param n maximum number of guesses
+ * @return number of guesses stored, at most the number of remaining combinations
+ */
+int solver_next_guesses(struct solver *s, code_t *guesses, int n);
+
+/**
+ * @brief Excludes all combinations which would not have led to the given response.
+ * @param s solver state
+ * @param guess the guess the response belongs to (without parity bit)
+ * @param response red and white pegs of the guess (error bits are ignored)
+ * @return number of remaining combinations
+ */
+uint64_t solver_update(struct solver *s, code_t guess, resp_t response);
+
+/**
+ * @brief Compares a guess with a secret.
+ * @param guess encoded guess (parity bit is ignored)
+ * @param secret encoded secret
+ * @return response with red pegs in the low and white pegs in the next PEG_BITS bits
+ */
+resp_t solver_score(code_t guess, code_t secret);
+
+/**
+ * @brief Returns a combination by its number, combinations are numbered in the
+ *        order the solver considers them.
+ * @param index number of the combination, 0 to COMBINATIONS - 1
+ * @return the encoded combination
+ */
+code_t solver_code(long index);
+
+/**
+ * @brief Returns the number of a combination, the inverse of solver_code.
+ * @param code encoded combination
+ * @return number of the combination
+ */
+long solver_index(code_t code);
+
+/**
+ * @brief Looks up a strategy by its name.
+ * @param name name of the strategy, e.g. "distinct"
+ * @return the strategy or -1 if the name is unknown
+ */
+int solver_strategy(const char *name);
+
+/**
+ * @brief Returns the name of a strategy.
+ * @param strategy the strategy
+ * @return name of the strategy
+ */
+const char *solver_strategy_name(enum strategy strategy);
+
+#endif /* SOLVER_H */
@@ -0,0 +1,206 @@
+/**
+ * @file solverd.c
+ * @date 2017-04-23
+ *
+ * @brief Publishes the opening tables (see openings.h) in shared memory for all
+ *        clients on this host, until it is stopped with SIGINT or SIGTERM.
+ *        The shared memory object is removed on exit, clients which have it
+ *        mapped keep using it.
+ **/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "openings.h"
+
+/* @brief Permission of the shared memory object (everybody may read) */
+#define PERMISSION (0644)
+
+/* Length of an array */
+#define COUNT_OF(x) (sizeof(x)/sizeof(x[0]))
+
+/* === Global Variables === */
+
+/* Name of the program */
+static const char *progname = "solverd";
+
+/* Name of the shared memory object */
+static char shm_name[64];
+
+/* The published tables, NULL if not mapped */
+static struct openings *shared = NULL;
+
+/* true once the shared memory object was created */
+static int created = 0;
+
+/* This variable is set upon receipt of a signal */
+volatile sig_atomic_t quit = 0;
+
+/* === Prototypes === */
+
+/**
+ * @brief terminate program on program error
+ * @param exitcode exit code
+ * @param fmt format string
+ */
+static void bail_out(int exitcode, const char *fmt, ...);
+
+/**
+ * @brief Signal handler
+ * @param sig Signal number catched
+ */
+static void signal_handler(int sig);
+
+/**
+ * @brief free allocated resources, removes the shared memory object
+ */
+static void free_resources(void);
+
+/**
+ * @brief Checks if an existing shared memory object was left behind by a
+ *        solverd which no longer runs, e.g. after kill -9.
+ * @param name name of the object
+ * @return true if the object can be removed
+ */
+static bool stale_object(const char *name);
+
+/* === Implementations === */
+
+/**
+ * @brief Program entry point
+ * @param argc The argument counter
+ * @param argv The argument vector
+ * @return EXIT_SUCCESS after the daemon was stopped by a signal
+ */
+int main(int argc, char *argv[])
+{
+    const int signals[] = {SIGINT, SIGTERM};
+    struct sigaction s;
+    int fd;
+
+    if (argc > 0) {
+        progname = argv[0];
+    }
+    if (argc != 1) {
+        bail_out(EXIT_FAILURE, "Usage: %s", progname);
+    }
+
+    s.sa_handler = signal_handler;
+    s.sa_flags = 0;
+    if (sigfillset(&s.sa_mask) < 0) {
+        bail_out(EXIT_FAILURE, "sigfillset");
+    }
+    for (int i = 0; i < COUNT_OF(signals); i++) {
+        if (sigaction(signals[i], &s, NULL) < 0) {
+            bail_out(EXIT_FAILURE, "sigaction");
+        }
+    }
+
+    openings_name(shm_name, sizeof(shm_name));
+    fd = shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL, PERMISSION);
+    if (fd < 0 && errno == EEXIST && stale_object(shm_name)) {
+        (void) shm_unlink(shm_name);
+        fd = shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL, PERMISSION);
+    }
+    if (fd < 0) {
+        bail_out(EXIT_FAILURE, "shm_open %s", shm_name);
+    }
+    created = 1;
+    if (ftruncate(fd, sizeof(*shared)) < 0) {
+        (void) close(fd);
+        bail_out(EXIT_FAILURE, "ftruncate");
+    }
+    shared = mmap(NULL, sizeof(*shared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    (void) close(fd);
+    if (shared == MAP_FAILED) {
+        shared = NULL;
+        bail_out(EXIT_FAILURE, "mmap");
+    }
+    shared->pid = getpid();
+
+    if (openings_build(shared) < 0) {
+        bail_out(EXIT_FAILURE, "openings_build");
+    }
+    /* clients only use the tables once they are complete */
+    __atomic_store_n(&shared->magic, OPENINGS_MAGIC, __ATOMIC_RELEASE);
+    (void) printf("%s: published %s\n", progname, shm_name);
+    (void) fflush(stdout);
+
+    while (!quit) {
+        (void) pause();
+    }
+
+    free_resources();
+    return EXIT_SUCCESS;
+}
+
+static void bail_out(int exitcode, const char *fmt, ...)
+{
+    va_list ap;
+
+    (void) fprintf(stderr, "%s: ", progname);
+    if (fmt != NULL) {
+        va_start(ap, fmt);
+        (void) vfprintf(stderr, fmt, ap);
+        va_end(ap);
+    }
+    if (errno != 0) {
+        (void) fprintf(stderr, ": %s", strerror(errno));
+    }
+    (void) fprintf(stderr, "\n");
+
+    free_resources();
+    exit(exitcode);
+}
+
+static void signal_handler(int sig)
+{
+    quit = 1;
+}
+
+static void free_resources(void)
+{
+    if (shared != NULL) {
+        (void) munmap(shared, sizeof(*shared));
+        shared = NULL;
+    }
+    if (created && shm_unlink(shm_name) < 0) {
+        (void) fprintf(stderr, "%s: shm_unlink: %s\n", progname, strerror(errno));
+    }
+    created = 0;
+}
+
+static bool stale_object(const char *name)
+{
+    const struct openings *o;
+    struct stat st;
+    bool stale = false;
+    int fd = shm_open(name, O_RDONLY, 0);
+
+    if (fd < 0) {
+        return false;
+    }
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(*o)) {
+        (void) close(fd);
+        return false;
+    }
+    o = mmap(NULL, sizeof(*o), PROT_READ, MAP_SHARED, fd, 0);
+    (void) close(fd);
+    if (o == MAP_FAILED) {
+        return false;
+    }
+    /* a pid of 0 belongs to a solverd which is just starting */
+    if (o->pid > 0 && kill(o->pid, 0) < 0 && errno == ESRCH) {
+        stale = true;
+    }
+    (void) munmap((void *) o, sizeof(*o));
+    return stale;
+}
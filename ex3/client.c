@@ -4,7 +4,8 @@
  * @date 31.05.2017
  *
  * @brief This Program connects to a shared memory object if it does not already exist. Otherwise
-    it exits with an error. Writes request to the server using the shared memory object and prints the answer on stdout.
+    it exits with an error. Writes request to the server using a free slot of the shared memory object and prints the answer on stdout.
+    Many clients can have requests in flight at the same time, see procdb.h.
     Request can be passed to the client by stdin or by argument. If requests are passed by stdin, the client waits for input in a loop,
     and sends the request to the sever. The client terminates if it receives an 'end of file' a SIGINT or a SIGTERM signal.
  **/
@@ -21,27 +22,11 @@
 #include <stdbool.h>
 #include <signal.h>
 
-/* @brief Permission used for sem_open call (owner can read and write) */
-#define PERMISSION (0600)
-
-/* @brief Name of the shared memory Object */
-#define SHM_NAME "01427540_shm"
-
-/* @brief names of the semaphores */
-#define SEM_1 "/01427540_sem_1"
-#define SEM_2 "/01427540_sem_2"
+#include "procdb.h"
 
 /* @brief Length of an array*/
 #define COUNT_OF(x) (sizeof(x)/sizeof(x[0])) 
 
-
-struct myshm { /** < shared memory object*/ 
-    enum OPERATION {pid_op, sum, min, max, avg} op;
-    enum REQUEST {cpu, mem, runtime, command, pid_req} req;
-    int pid_value;
-    char answer[128];
-};
-
 /**
 * This variable is set upon receipt of a signal 
 */
@@ -97,14 +82,21 @@ static int communicate(struct myshm *shared, int argc, char **argv);
 static bool sep_op_req(char *buf, char **operation, char **request, char **endptr, unsigned int *pid);
 
 /**
-* @brief writes request and operation to shared memory object
+* @brief claims a free slot. The caller has taken one with sem_wait(s1), so a free slot exists.
 * @param shared points to shared memory object
+* @return the slot, in state SLOT_CLAIMED
+*/
+static struct slot *claim_slot(struct myshm *shared);
+
+/**
+* @brief writes request and operation to a slot of the shared memory object
+* @param slot points to the slot
 * @param operation stores the operation
 * @param request stores the request
 * @param endptr indicates if operation is a pid or not. If it is a pid, pid_op and pid_value will be set in shared memory.
 * @param pid stores the pid if operation is a number
 */
-static void write_to_shared(struct myshm *shared, char *operation, char *request, char *endptr, int pid);
+static void write_to_shared(struct slot *slot, char *operation, char *request, char *endptr, int pid);
 
 /**
 * @brief synchronizes communciation with server, calls write_to_shared() and prints the servers answer on stdout.
@@ -239,61 +231,80 @@ static int communicate(struct myshm *shared, int argc, char **argv){
 }
 
 static void send_receive(struct myshm *shared, sem_t *s1, sem_t *s2, char *operation, char *request, char *endptr, unsigned int pid){
-        if(sem_wait(s1)!=0){ /*prevent other clients from interfering*/
+        struct slot *slot;
+        uint32_t state;
+
+        if(sem_wait(s1)!=0){ /*waits for a free slot*/
             (void)fprintf(stderr, "%s sem_wait fail\n", progname);
             exit(EXIT_FAILURE);
         }
-        write_to_shared(shared, operation, request, endptr, pid);
-        if(sem_post(s2)!=0){ /*start server*/
+        slot = claim_slot(shared);
+        write_to_shared(slot, operation, request, endptr, pid);
+        __atomic_store_n(&slot->state, SLOT_REQUEST, __ATOMIC_RELEASE);
+        if(sem_post(s2)!=0){ /*wakes a server worker*/
             (void)fprintf(stderr, "%s sem_post fail\n", progname);
             exit(EXIT_FAILURE);
         }
 
-        if(sem_wait(s1)!=0){ /*checks if server is done writing and prevents other clients from interfering*/
-            (void)fprintf(stderr, "%s sem_wait fail\n", progname);
-            exit(EXIT_FAILURE);
+        /*the worker is quick, even after a signal wait for it, else the slot would be lost*/
+        while((state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE)) != SLOT_DONE){
+            futex_wait(&slot->state, state);
         }
-        (void)printf("%s\n", shared->answer);
-        if(sem_post(s1)!=0){ /*gives next client permission to write to shared memory*/
+        (void)printf("%s\n", slot->answer);
+        __atomic_store_n(&slot->state, SLOT_FREE, __ATOMIC_RELEASE);
+        if(sem_post(s1)!=0){ /*gives the slot to the next request*/
             (void)fprintf(stderr, "%s sem_post fail\n", progname);
             exit(EXIT_FAILURE);
         }
 }
 
-static void write_to_shared(struct myshm *shared, char *operation, char *request, char *endptr, int pid){
+static struct slot *claim_slot(struct myshm *shared){
+    unsigned int i = (unsigned int)getpid() % SLOTS; /*clients start at different slots*/
+
+    for(;;){
+        uint32_t expected = SLOT_FREE;
+        if(__atomic_compare_exchange_n(&shared->slots[i].state, &expected, SLOT_CLAIMED,
+                                       false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+            return &shared->slots[i];
+        }
+        i = (i + 1) % SLOTS;
+    }
+}
+
+static void write_to_shared(struct slot *slot, char *operation, char *request, char *endptr, int pid){
         if(strcmp(endptr, "\0")==0){
-            shared->op = pid_op;
-            shared->pid_value = pid;
+            slot->op = pid_op;
+            slot->pid_value = pid;
         }
         else if(strcmp(operation, "sum")==0){
-            shared->op = sum;
+            slot->op = sum;
         }
         else if(strcmp(operation, "min")==0){
-            shared->op = min;
+            slot->op = min;
         }
         else if(strcmp(operation, "max")==0){
-            shared->op = max;
+            slot->op = max;
         }
         else if(strcmp(operation, "avg")==0){
-            shared->op = avg;
+            slot->op = avg;
         }
 
         
         
         if(strcmp(request, "pid")==0){
-            shared->req = pid_req;
+            slot->req = pid_req;
         }
         else if(strcmp(request, "cpu")==0){
-            shared->req = cpu;
+            slot->req = cpu;
         }
         else if(strcmp(request, "mem")==0){
-            shared->req = mem;
+            slot->req = mem;
         }
         else if(strcmp(request, "time")==0){
-            shared->req = runtime;
+            slot->req = runtime;
         }
         else if(strcmp(request, "command")==0){
-            shared->req = command;
+            slot->req = command;
         }
 }
 
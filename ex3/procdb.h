@@ -0,0 +1,82 @@
+/**
+ * @file procdb.h
+ * @date 09.06.2017
+ *
+ * @brief Layout of the shared memory object of the ProcDB server and client.
+    The object holds a ring of SLOTS request slots, so SLOTS clients can have a request in flight
+    at the same time. Semaphore 1 counts the free slots, semaphore 2 the requests waiting for a
+    server worker. A client takes a free slot with sem_wait(SEM_1), claims it, writes its request,
+    marks it SLOT_REQUEST and posts SEM_2. A worker woken by SEM_2 takes the request, writes the
+    answer, marks the slot SLOT_DONE and wakes the client waiting on the slot's state with a futex.
+    The client prints the answer, marks the slot SLOT_FREE and posts SEM_1.
+ **/
+
+#ifndef PROCDB_H
+#define PROCDB_H
+
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/* @brief Permission used for sem_open call (owner can read and write) */
+#define PERMISSION (0600)
+
+/* @brief Name of the shared memory Object */
+#define SHM_NAME "01427540_shm"
+
+/* @brief names of the semaphores */
+#define SEM_1 "/01427540_sem_1"
+#define SEM_2 "/01427540_sem_2"
+
+/* @brief Number of request slots */
+#define SLOTS (64)
+
+/* @brief Size of an answer */
+#define ANSWER_SIZE (128)
+
+enum OPERATION {pid_op, sum, min, max, avg};
+enum REQUEST {cpu, mem, runtime, command, pid_req};
+
+/* @brief State of a slot, the client waits for SLOT_DONE with futex_wait */
+enum SLOT_STATE {
+    SLOT_FREE = 0,      /* < unused, a zeroed object holds only free slots */
+    SLOT_CLAIMED,       /* < a client writes its request */
+    SLOT_REQUEST,       /* < waiting for a worker */
+    SLOT_BUSY,          /* < a worker computes the answer */
+    SLOT_DONE           /* < the answer is there */
+};
+
+struct slot { /** < one request and its answer */
+    uint32_t state;
+    enum OPERATION op;
+    enum REQUEST req;
+    int pid_value;
+    char answer[ANSWER_SIZE];
+};
+
+struct myshm { /** < shared memory object*/
+    struct slot slots[SLOTS];
+};
+
+/**
+ * @brief sleeps until the state of a slot is no longer expected. Returns early on signals, so
+    callers check the state in a loop.
+ * @param state the state word of the slot, in shared memory
+ * @param expected the value last read
+ */
+static inline void futex_wait(uint32_t *state, uint32_t expected)
+{
+    (void)syscall(SYS_futex, state, FUTEX_WAIT, expected, NULL, NULL, 0);
+}
+
+/**
+ * @brief wakes the process waiting on the state of a slot.
+ * @param state the state word of the slot, in shared memory
+ */
+static inline void futex_wake(uint32_t *state)
+{
+    (void)syscall(SYS_futex, state, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+#endif /* PROCDB_H */
@@ -6,7 +6,8 @@
  * @brief This Program creates a shared memory object, if it does not already exist. Otherwise
     it exits with an error. 
     After creation of the shared memory object it waits for clients to connect to it, and answers it's request
-     using the same shared memory object. The database has to be parsed as a file through command line argument. The database is stored as linkedList.
+     using the same shared memory object. Its request slots let many clients have a request in flight, a pool of
+     worker threads (-w, default WORKERS) answers them in parallel, see procdb.h. The database has to be parsed as a file through command line argument. The database is stored as linkedList.
      The server can handle the signal SIGINT, SIGTERM and SIGUSR1. Up on receipt of SIGINT or SIGTERM the server terminates, on SIGUSR1 it prints the
      whole database (content of the linkedList).
  **/
@@ -23,16 +24,15 @@
 #include <limits.h>
 #include <signal.h>
 #include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <pthread.h>
 
-/* @brief Permission used for sem_open call (owner can read and write) */
-#define PERMISSION (0600)
+#include "procdb.h"
 
-/* @brief Name of the shared memory Object */
-#define SHM_NAME "01427540_shm"
-
-/* @brief names of the semaphores */
-#define SEM_1 "/01427540_sem_1"
-#define SEM_2 "/01427540_sem_2"
+/* @brief Default and maximum number of worker threads */
+#define WORKERS (4)
+#define MAX_WORKERS (64)
 
 /* @brief Length of an array*/
 #define COUNT_OF(x) (sizeof(x)/sizeof(x[0])) 
@@ -46,18 +46,21 @@ typedef struct node { /** < The struct for the LinkedList*/
     struct node *next;
 } node_t;
 
-struct myshm { /** < shared memory object*/ 
-    enum OPERATION {pid_op, sum, min, max, avg} op;
-    enum REQUEST {cpu, mem, runtime, command, pid_req} req;
-    int pid_value;
-    char answer[128];
-};
-
 /**
 * This variable is set upon receipt of a signal 
 */
 volatile sig_atomic_t quit = 0; 
 
+/**
+* Set by the main thread before it wakes the workers to stop them
+*/
+static volatile bool stop = false;
+
+/**
+* Number of worker threads
+*/
+static int nworkers = WORKERS;
+
 /**
 * stores address of the first element (head) of the LinkedList
 */
@@ -130,13 +133,31 @@ static void csvParseAndPush(FILE *file);
 static void create_shared(void);
 
 /**
- * @brief synchronises communication between client and server and checks if signals have been recieved.
-    Calls fetch_info and writes answer to the request into the shared memory object. 
+ * @brief starts the worker threads and handles the signals until SIGINT or SIGTERM, then stops the workers.
+    Only this thread receives signals, the workers block all of them.
  * @param shared points to shared memory object.
- * @details global variable: progname, quit, s1, s2
+ * @details global variable: progname, quit, stop, nworkers, s2
  */
 static void communicate(struct myshm *shared);
 
+/**
+ * @brief worker thread: waits for requests with sem_wait(s2), calls fetch_info and writes the answer into the
+    request's slot, then wakes the client waiting on the slot.
+ * @param arg points to shared memory object.
+ * @details global variable: progname, stop, s2
+ * @return NULL
+ */
+static void *serve_requests(void *arg);
+
+/**
+ * @brief takes a request for the calling worker. The worker has taken one with sem_wait(s2), so a slot
+    in state SLOT_REQUEST exists.
+ * @param shared points to shared memory object.
+ * @param next slot the worker looks at first, advanced past the taken slot
+ * @return the slot, in state SLOT_BUSY
+ */
+static struct slot *take_request(struct myshm *shared, unsigned int *next);
+
 /**
  * @brief calls the function for the desired operation.
  * @param op operation code (sum, min, avg, ...)
@@ -259,7 +280,7 @@ static void create_shared(void){
         exit(EXIT_FAILURE);
     }
 
-    s1 = sem_open(SEM_1, O_CREAT | O_EXCL, PERMISSION, 1);
+    s1 = sem_open(SEM_1, O_CREAT | O_EXCL, PERMISSION, SLOTS);
     if(s1==SEM_FAILED){
         (void)fprintf(stderr, "sem_open 1 fail\n");
         exit(EXIT_FAILURE);
@@ -279,34 +300,81 @@ static void create_shared(void){
 }
 
 static void communicate(struct myshm *shared){
-    
-    while(!quit){
-        if(sem_wait(s2)==-1 && !quit){
-            (void)fprintf(stderr, "%s sem_wait fail\n", progname);
-            exit(EXIT_FAILURE);
-        }
-        if(quit==SIGTERM || quit==SIGINT){
+    pthread_t workers[MAX_WORKERS];
+    sigset_t all, wait_mask;
+    int started = 0;
+
+    /* blocks all signals while the workers are created, they inherit the mask */
+    if(sigfillset(&all) < 0 || pthread_sigmask(SIG_BLOCK, &all, &wait_mask) != 0){
+        (void)fprintf(stderr, "%s pthread_sigmask fail\n", progname);
+        exit(EXIT_FAILURE);
+    }
+    for(; started < nworkers; ++started){
+        if(pthread_create(&workers[started], NULL, serve_requests, shared) != 0){
+            (void)fprintf(stderr, "%s pthread_create fail\n", progname);
+            quit = SIGTERM;
             break;
         }
-        else if(quit){
+    }
+
+    while(quit!=SIGTERM && quit!=SIGINT){
+        if(quit){
             print_list();
             quit = 0;
             continue;
         }
-        char *answer = fetch_info(shared->op, shared->req, shared->pid_value); 
-        (void)strcpy(shared->answer, answer!=NULL ? answer : "Unvalid request");
-        
-        if(sem_post(s1)==-1){
+        (void)sigsuspend(&wait_mask); /* unblocks SIGINT, SIGTERM and SIGUSR1 while waiting */
+    }
+
+    stop = true;
+    for(int i = 0; i < started; ++i){
+        if(sem_post(s2)==-1){
             (void)fprintf(stderr, "%s sem_post fail\n", progname);
-            if(answer!=NULL){
-                free(answer);
+            exit(EXIT_FAILURE);
+        }
+    }
+    for(int i = 0; i < started; ++i){
+        (void)pthread_join(workers[i], NULL);
+    }
+}
+
+static void *serve_requests(void *arg){
+    struct myshm *shared = arg;
+    unsigned int next = 0;
+
+    for(;;){
+        if(sem_wait(s2)==-1){
+            if(errno==EINTR){
+                continue;
             }
+            (void)fprintf(stderr, "%s sem_wait fail\n", progname);
             exit(EXIT_FAILURE);
         }
-        
+        if(stop){
+            break;
+        }
+        struct slot *slot = take_request(shared, &next);
+        char *answer = fetch_info(slot->op, slot->req, slot->pid_value); 
+        (void)strcpy(slot->answer, answer!=NULL ? answer : "Unvalid request");
         if(answer!=NULL){
             free(answer);
         }
+        __atomic_store_n(&slot->state, SLOT_DONE, __ATOMIC_RELEASE);
+        futex_wake(&slot->state);
+    }
+    return NULL;
+}
+
+static struct slot *take_request(struct myshm *shared, unsigned int *next){
+    for(;;){
+        struct slot *slot = &shared->slots[*next];
+        uint32_t expected = SLOT_REQUEST;
+
+        *next = (*next + 1) % SLOTS;
+        if(__atomic_compare_exchange_n(&slot->state, &expected, SLOT_BUSY,
+                                       false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+            return slot;
+        }
     }
 }
 
@@ -505,11 +573,27 @@ static void convert_time(unsigned int all_seconds, char **answer){
 }
 
 static FILE* parse_args(int argc, char **argv){
+    char *endptr;
+    int opt;
+
     progname = argv[0];
-    if(argc!=2){
+    while((opt = getopt(argc, argv, "w:")) != -1){
+        switch(opt){
+            case 'w':
+                nworkers = strtol(optarg, &endptr, 10);
+                if(*endptr != '\0' || nworkers < 1 || nworkers > MAX_WORKERS){
+                    (void)fprintf(stderr, "%s number of workers must be between 1 and %d\n", progname, MAX_WORKERS);
+                    usage();
+                }
+                break;
+            default:
+                usage();
+        }
+    }
+    if(argc - optind != 1){
         usage();
     }
-    FILE *file = fopen(argv[1], "r");
+    FILE *file = fopen(argv[optind], "r");
     if(file==NULL){
         (void)fprintf(stderr, "%s open file fail\n", progname);
         usage();
@@ -519,7 +603,7 @@ static FILE* parse_args(int argc, char **argv){
 
 static void usage(){
     (void)fprintf(stderr, "%s usage:\n", progname);
-    (void)fprintf(stderr, "%s <file>\n", progname);
+    (void)fprintf(stderr, "%s [-w workers] <file>\n", progname);
     exit(EXIT_FAILURE);
 }
 